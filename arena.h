@@ -0,0 +1,55 @@
+#pragma once
+
+// Scratch memory for one request.
+//
+// The reactor keeps a connection's buffers between requests, so its steady
+// state does not allocate. Server2 answers frames on whichever pool worker
+// picks them up, so there is no per-connection buffer to reuse; each worker
+// owns a RequestArena instead and the command, response and log line of a
+// request are std::pmr strings carved from it. Nothing is freed one by one:
+// the arena is rewound when the response has been sent. A request that does
+// not fit the initial block spills to the heap and the spill is returned
+// with the rewind.
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+class RequestArena {
+public:
+    explicit RequestArena(size_t bytes = 16 * 1024)
+        : storage(new std::byte[bytes]),
+          resource(storage.get(), bytes, std::pmr::new_delete_resource()) {}
+
+    RequestArena(const RequestArena&) = delete;
+    RequestArena& operator=(const RequestArena&) = delete;
+
+    std::pmr::memory_resource* get() { return &resource; }
+
+    // Every string carved from the arena must be gone by now
+    void reset() { resource.release(); }
+
+    // Rewinds the arena when the request's scope ends. Declare it before the
+    // strings that use the arena so they are destroyed first.
+    class Scope {
+    public:
+        explicit Scope(RequestArena& arena) : arena(arena) {}
+        ~Scope() { arena.reset(); }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        RequestArena& arena;
+    };
+
+private:
+    std::unique_ptr<std::byte[]> storage;
+    std::pmr::monotonic_buffer_resource resource;
+};
+
+// The arena of the calling thread
+inline RequestArena& thread_request_arena() {
+    thread_local RequestArena arena;
+    return arena;
+}
@@ -0,0 +1,242 @@
+// Counts heap allocations on the request path.
+//
+// A connection of the reactor (reactor.h) is fed requests over a socketpair
+// and answered with the same process_input/flush_output calls the servers
+// use, once per protocol. After a warm-up the buffers of the connection have
+// their final capacity and a steady-state request should not allocate at all.
+//
+// The server2 worker path is then run under sustained load from several
+// threads, once with heap strings as it was before RequestArena (arena.h)
+// and once with the arena, each in its own process so the RSS figures do not
+// mix.
+//
+//   g++ -std=c++17 -O2 -o bench_alloc bench_alloc.cpp -levdev -pthread
+//   ./bench_alloc [requests=100000] [threads=4]
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <new>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "arena.h"
+#include "command_modules.h"
+#include "log_ring.h"
+#include "metrics.h"
+#include "mouse_inventory.h"
+#include "reactor.h"
+
+// Only allocations made by the benchmark thread while measuring are counted;
+// the samplers and the inventory watcher run on their own threads.
+thread_local bool counting = false;
+thread_local uint64_t allocations = 0;
+
+void* operator new(size_t size) {
+    if (counting) allocations++;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+// Out of line, or GCC sees free() inlined next to operator new and warns
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+// std::pmr::new_delete_resource() asks for aligned blocks
+void* operator new(size_t size, std::align_val_t align) {
+    if (counting) allocations++;
+    size_t alignment = std::max(size_t(align), sizeof(void*));
+    if (void* p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)) return p;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t align) noexcept { operator delete(p, align); }
+
+struct Result {
+    uint64_t allocations;
+    double ns_per_request;
+};
+
+// Sends one request per round and reads the whole response back
+Result run(Connection& conn, int peer, const std::string& request, int rounds) {
+    char buf[4096];
+    auto start = std::chrono::steady_clock::now();
+    counting = true;
+    allocations = 0;
+    for (int i = 0; i < rounds; ++i) {
+        ssize_t ignored = write(peer, request.data(), request.size());
+        (void)ignored;
+        if (!handle_readable(conn)) {
+            std::cerr << "connection dropped" << std::endl;
+            std::exit(1);
+        }
+        while (recv(peer, buf, sizeof(buf), MSG_DONTWAIT) > 0) {}
+    }
+    counting = false;
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return {allocations, elapsed.count() / rounds};
+}
+
+// serve_frame() of server2 before RequestArena: every request builds its
+// response, frame and log line in fresh heap strings
+void serve_heap(const CommandRegistry& commands, const Frame& frame, int sink) {
+    bool close_connection = false;
+    ResponseBuffer response;
+    commands.dispatch_to(response, frame.payload, 1, close_connection);
+    std::string out;
+    append_frame(out, frame.request_id, response);
+    ssize_t ignored = write(sink, out.data(), out.size());
+    (void)ignored;
+    std::string line = "Received command:";
+    line += response;
+}
+
+// serve_frame() of server2 as it is now
+void serve_arena(const CommandRegistry& commands, const Frame& frame, int sink) {
+    RequestArena& arena = thread_request_arena();
+    RequestArena::Scope scope(arena);
+    bool close_connection = false;
+    ResponseBuffer out(arena.get());
+    size_t start = begin_frame(out);
+    commands.dispatch_to(out, frame.payload, 1, close_connection);
+    end_frame(out, start, frame.request_id);
+    ssize_t ignored = write(sink, out.data(), out.size());
+    (void)ignored;
+    std::pmr::string line("Received command:", arena.get());
+    line += std::string_view(out).substr(FRAME_HEADER_SIZE);
+}
+
+size_t rss_kb() {
+    std::ifstream status("/proc/self/status");
+    std::string key;
+    size_t value = 0;
+    while (status >> key) {
+        if (key == "VmRSS:") {
+            status >> value;
+            break;
+        }
+        status.ignore(4096, '\n');
+    }
+    return value;
+}
+
+// Runs the worker path from several threads in a child process
+void run_workers(const char* label, void (*serve)(const CommandRegistry&, const Frame&, int),
+                 const CommandRegistry& commands, int rounds, int threads) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+
+    int sink = open("/dev/null", O_WRONLY);
+    const char* names[] = {"MEMORY", "THREAD_COUNT", "UNKNOWN"};
+    std::atomic<uint64_t> total{0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            Frame frame;
+            frame.request_id = t;
+            for (int i = 0; i < 1000; ++i) {
+                frame.payload = names[i % 3];
+                serve(commands, frame, sink);
+            }
+            counting = true;
+            allocations = 0;
+            for (int i = 0; i < rounds; ++i) {
+                frame.payload = names[i % 3];
+                serve(commands, frame, sink);
+            }
+            counting = false;
+            total += allocations;
+        });
+    }
+    for (auto& worker : workers) worker.join();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << label << ": " << double(total) / (double(rounds) * threads) << " allocations/request, "
+              << elapsed.count() / (double(rounds) * threads) << " ns/request, RSS " << rss_kb() << " kB"
+              << std::endl;
+    std::_Exit(0);
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = argc > 1 ? std::atoi(argv[1]) : 100000;
+    int threads = argc > 2 ? std::atoi(argv[2]) : 4;
+
+    MetricsRegistry metrics("bench");
+    LogConsumer log_consumer;
+    if (!log_consumer.open_private()) return 1;
+    LogProducer producer(log_consumer.ring());
+
+    // An empty input tree keeps MOUSE_KEYS independent of the host
+    std::string input_dir = "/tmp/bench_alloc_" + std::to_string(getpid()) + "/";
+    mkdir(input_dir.c_str(), 0755);
+    MouseInventory inventory(input_dir);
+    inventory.start();
+    PeriodicSampler<size_t> memory_sampler(get_free_memory, 500);
+    memory_sampler.start();
+    PeriodicSampler<int> thread_sampler(count_system_threads, 500);
+    thread_sampler.start();
+
+    CommandRegistry commands(&metrics);
+    commands.set_logger([&producer](std::string_view event_type, std::string_view data, uint32_t client_id) {
+        producer.publish(event_type, data, client_id);
+    });
+    register_memory_module(commands, memory_sampler);
+    register_thread_module(commands, thread_sampler);
+    register_mouse_module(commands, inventory);
+    register_control_commands(commands, metrics, SERVER1_TEXTS);
+
+    const char* names[] = {"MEMORY", "THREAD_COUNT", "MOUSE_KEYS", "UNKNOWN"};
+    bool clean = true;
+    for (bool framed : {false, true}) {
+        for (const char* name : names) {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) return 1;
+            Connection conn;
+            conn.fd = fds[0];
+            conn.id = 1;
+            conn.commands = &commands;
+
+            std::string request;
+            if (framed) {
+                // The magic byte is sent once per connection
+                char magic = char(FRAME_MAGIC);
+                ssize_t ignored = write(fds[1], &magic, 1);
+                (void)ignored;
+                append_frame(request, 7, name);
+            } else {
+                request = name;
+            }
+
+            run(conn, fds[1], request, 1000);
+            Result result = run(conn, fds[1], request, rounds);
+            double per_request = double(result.allocations) / rounds;
+            std::cout << (framed ? "framed " : "legacy ") << name << ": " << per_request
+                      << " allocations/request, " << result.ns_per_request << " ns/request" << std::endl;
+            if (per_request > 0) clean = false;
+
+            close(fds[0]);
+            close(fds[1]);
+        }
+    }
+
+    std::cout << "server2 worker path, " << threads << " threads:" << std::endl;
+    run_workers("  heap strings ", serve_heap, commands, rounds, threads);
+    run_workers("  RequestArena ", serve_arena, commands, rounds, threads);
+
+    thread_sampler.stop();
+    memory_sampler.stop();
+    inventory.stop();
+    rmdir(input_dir.c_str());
+    return clean ? 0 : 1;
+}
@@ -0,0 +1,243 @@
+// Compares the epoll and io_uring reactors (reactor.h, uring_reactor.h)
+// and TCP loopback against the unix socket for local clients
+// (local_socket.h).
+//
+// For each backend and transport a server process with one reactor
+// answering MEMORY is forked and loaded by closed-loop client threads, each
+// keeping `depth` framed requests in flight on its connection. The first
+// run measures throughput. The second repeats it with the server under
+// ptrace and counts the system calls it makes while the clients are in
+// their measured phase (tracing slows it down, so only the count is used).
+//
+//   g++ -std=c++17 -O2 -o bench_io bench_io.cpp -pthread
+//   ./bench_io [connections=32] [requests=20000] [depth=4]
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/ptrace.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "command_modules.h"
+#include "local_socket.h"
+#include "uring_reactor.h"
+
+// Each run gets its own port: the listener of a killed io_uring server
+// lingers until the kernel has torn its ring down, and would take
+// connections meant for the next server. The unix socket is named after
+// the port for the same reason.
+const int BASE_PORT = 18090;
+int port = BASE_PORT;
+
+std::string local_name() { return "@bench_io." + std::to_string(port); }
+
+// Server process: one reactor of the given backend, MEMORY from a sampler
+[[noreturn]] void serve(bool uring, bool traced) {
+    if (traced) {
+        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        raise(SIGSTOP);
+    }
+    PeriodicSampler<size_t> memory_sampler(get_free_memory, 1000);
+    memory_sampler.start();
+    MetricsRegistry metrics("bench_io");
+    CommandRegistry commands(&metrics);
+    register_memory_module(commands, memory_sampler);
+
+    ReactorContext context;
+    int fd = create_listen_socket(port, SOMAXCONN);
+    int local_fd = create_local_listen_socket(local_name(), SOMAXCONN);
+    if (fd < 0 || local_fd < 0) std::_Exit(1);
+    std::vector<ReactorListener> listeners = {{fd, &commands}, {local_fd, &commands, true}};
+    if (uring) {
+        uring_reactor_loop(context, listeners);
+    } else {
+        reactor_loop(context, listeners);
+    }
+    std::_Exit(0);
+}
+
+int connect_server(bool local) {
+    for (int attempt = 0; attempt < 200; ++attempt) {
+        if (local) {
+            int sock = connect_local(local_name());
+            if (sock >= 0) return sock;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(sock, (sockaddr*)&addr, sizeof(addr)) == 0) {
+            int one = 1;
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return sock;
+        }
+        close(sock);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return -1;
+}
+
+struct Load {
+    bool local;
+    int connections;
+    int requests;       // per connection, after the warm-up
+    int depth;
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<int> finished{0};
+};
+
+// Reads until `responses` frames have arrived
+bool read_responses(int sock, std::string& buf, int responses) {
+    static_assert(16384 >= LOCAL_MAX_MESSAGE, "a recv must take a whole message");
+    char chunk[16384];
+    while (responses > 0) {
+        while (buf.size() >= FRAME_HEADER_SIZE) {
+            size_t length = load_be32(buf.data());
+            if (buf.size() < FRAME_HEADER_SIZE + length) break;
+            buf.erase(0, FRAME_HEADER_SIZE + length);
+            responses--;
+        }
+        if (responses == 0) break;
+        ssize_t n = recv(sock, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buf.append(chunk, n);
+    }
+    return true;
+}
+
+void client(Load& load) {
+    int sock = connect_server(load.local);
+    if (sock < 0) {
+        std::cerr << "cannot connect" << std::endl;
+        std::exit(1);
+    }
+    std::string batch(1, char(FRAME_MAGIC));
+    for (int i = 0; i < load.depth; ++i) append_frame(batch, uint32_t(i), "MEMORY");
+    std::string first = batch;
+    batch.erase(0, 1);
+    std::string buf;
+
+    auto round = [&](const std::string& request) {
+        if (send(sock, request.data(), request.size(), MSG_NOSIGNAL) != ssize_t(request.size()) ||
+            !read_responses(sock, buf, load.depth)) {
+            std::cerr << "connection lost" << std::endl;
+            std::exit(1);
+        }
+    };
+    round(first);
+    for (int i = 0; i < 100; ++i) round(batch);
+
+    load.ready++;
+    while (!load.go) std::this_thread::yield();
+    for (int i = 0; i < load.requests / load.depth; ++i) round(batch);
+    load.finished++;
+    close(sock);
+}
+
+// Runs the clients; on_start/on_stop bracket the measured phase
+template <typename Start, typename Stop>
+double run_clients(Load& load, Start on_start, Stop on_stop) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < load.connections; ++i) threads.emplace_back(client, std::ref(load));
+    while (load.ready < load.connections) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    on_start();
+    auto start = std::chrono::steady_clock::now();
+    load.go = true;
+    for (auto& t : threads) t.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    on_stop();
+    return elapsed.count();
+}
+
+double measure_throughput(bool uring, bool local, int connections, int requests, int depth) {
+    pid_t server = fork();
+    if (server == 0) serve(uring, false);
+    Load load{local, connections, requests, depth};
+    double seconds = run_clients(load, [] {}, [] {});
+    kill(server, SIGKILL);
+    waitpid(server, nullptr, 0);
+    return double(connections) * (requests / depth * depth) / seconds;
+}
+
+// Syscall stops of every server thread while the clients are measuring.
+// The tracer has to be the thread that forked, so the clients run on a
+// helper thread.
+uint64_t count_syscalls(bool uring, bool local, int connections, int requests, int depth) {
+    pid_t server = fork();
+    if (server == 0) serve(uring, true);
+
+    int status;
+    waitpid(server, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, server, nullptr,
+           (void*)(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL));
+    ptrace(PTRACE_SYSCALL, server, nullptr, nullptr);
+
+    std::atomic<bool> counting{false};
+    Load load{local, connections, requests, depth};
+    std::thread driver([&] {
+        run_clients(load, [&] { counting = true; }, [&] { counting = false; });
+        kill(server, SIGKILL);
+    });
+
+    uint64_t stops = 0;
+    while (true) {
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid < 0) break;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (tid == server) break;
+            continue;
+        }
+        int signal = 0;
+        if (WIFSTOPPED(status)) {
+            int stop = WSTOPSIG(status);
+            if (stop == (SIGTRAP | 0x80)) {
+                if (counting) stops++;
+            } else if (stop != SIGTRAP && stop != SIGSTOP) {
+                signal = stop;
+            }
+        }
+        ptrace(PTRACE_SYSCALL, tid, nullptr, (void*)(long)signal);
+    }
+    driver.join();
+    // Every syscall stops twice, on entry and on exit
+    return stops / 2;
+}
+
+int main(int argc, char* argv[]) {
+    int connections = argc > 1 ? std::atoi(argv[1]) : 32;
+    int requests = argc > 2 ? std::atoi(argv[2]) : 20000;
+    int depth = argc > 3 ? std::max(1, std::atoi(argv[3])) : 4;
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::cout << connections << " connections, " << requests << " requests each, " << depth
+              << " in flight per connection" << std::endl;
+    for (bool uring : {false, true}) {
+        if (uring && !uring_available()) {
+            std::cout << "io_uring: not supported by this kernel" << std::endl;
+            continue;
+        }
+        for (bool local : {false, true}) {
+            double rps = measure_throughput(uring, local, connections, requests, depth);
+            port++;
+            uint64_t syscalls = count_syscalls(uring, local, connections, requests, depth);
+            port++;
+            double total = double(connections) * (requests / depth * depth);
+            std::cout << (uring ? "io_uring" : "epoll   ") << (local ? " unix" : " tcp ") << ": " << uint64_t(rps)
+                      << " requests/s, " << syscalls / total << " syscalls/request" << std::endl;
+        }
+    }
+    return 0;
+}
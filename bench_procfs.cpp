@@ -0,0 +1,115 @@
+// Micro-benchmark for THREAD_COUNT: the original ifstream/istringstream scan
+// against ProcThreadCounter (procfs.h), serial and with a worker pool, all
+// run on a synthetic proc tree.
+//
+//   g++ -std=c++17 -O2 -o bench_procfs bench_procfs.cpp -pthread
+//   ./bench_procfs [processes=20000] [rounds=20] [workers=cores]
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "procfs.h"
+
+// count_system_threads() as it was before ProcThreadCounter
+int count_threads_legacy(const std::string& proc_root) {
+    int total_threads = 0;
+    DIR* proc_dir = opendir(proc_root.c_str());
+    if (!proc_dir) return -1;
+
+    struct dirent* entry;
+    while ((entry = readdir(proc_dir)) != nullptr) {
+        if (entry->d_type != DT_DIR || !is_numeric(entry->d_name)) {
+            continue;
+        }
+
+        std::string status_path = proc_root + "/" + entry->d_name + "/status";
+        std::ifstream status_file(status_path);
+        if (!status_file) continue;
+
+        std::string line;
+        while (std::getline(status_file, line)) {
+            if (line.find("Threads:") == 0) {
+                int thread_count = 0;
+                std::istringstream iss(line.substr(9));
+                iss >> thread_count;
+                total_threads += thread_count;
+                break;
+            }
+        }
+    }
+
+    closedir(proc_dir);
+    return total_threads;
+}
+
+// Fills root with <pid>/status files shaped like the real thing
+void build_tree(const std::string& root, int processes) {
+    std::ifstream self("/proc/self/status");
+    std::stringstream template_text;
+    template_text << self.rdbuf();
+    std::string status = template_text.str();
+    size_t threads_pos = status.find("Threads:");
+    size_t threads_end = status.find('\n', threads_pos);
+
+    mkdir(root.c_str(), 0755);
+    for (int pid = 1; pid <= processes; ++pid) {
+        std::string dir = root + "/" + std::to_string(pid);
+        mkdir(dir.c_str(), 0755);
+        std::string text = status;
+        text.replace(threads_pos, threads_end - threads_pos, "Threads:\t" + std::to_string(pid % 7 + 1));
+        std::ofstream(dir + "/status") << text;
+    }
+    // Non-numeric entries the scanners have to skip
+    mkdir((root + "/self").c_str(), 0755);
+    std::ofstream(root + "/meminfo") << "MemFree: 1 kB\n";
+}
+
+template <typename F>
+double time_ms(int rounds, F&& run, int& result) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) result = run();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / rounds;
+}
+
+int main(int argc, char* argv[]) {
+    int processes = argc > 1 ? std::atoi(argv[1]) : 20000;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 20;
+    unsigned workers = argc > 3 ? std::atoi(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+    std::string root = "/tmp/bench_proc_" + std::to_string(getpid());
+
+    std::cout << "Building synthetic /proc with " << processes << " processes in " << root << std::endl;
+    build_tree(root, processes);
+
+    ProcThreadCounter counter(root.c_str());
+    int legacy_total = 0, fast_total = 0;
+    count_threads_legacy(root);   // warm the dentry cache for both
+    double legacy_ms = time_ms(rounds, [&] { return count_threads_legacy(root); }, legacy_total);
+    double fast_ms = time_ms(rounds, [&] { return counter.count(); }, fast_total);
+
+    std::cout << "legacy ifstream scan:   " << legacy_ms << " ms/scan (threads=" << legacy_total << ")" << std::endl;
+    std::cout << "ProcThreadCounter:      " << fast_ms << " ms/scan (threads=" << fast_total << ")" << std::endl;
+    std::cout << "speedup:                " << legacy_ms / fast_ms << "x" << std::endl;
+
+    ProcThreadCounter parallel_counter(root.c_str(), workers);
+    int parallel_total = 0;
+    double parallel_ms = time_ms(rounds, [&] { return parallel_counter.count(); }, parallel_total);
+    std::cout << "ProcThreadCounter x" << workers << ":   " << parallel_ms << " ms/scan (threads="
+              << parallel_total << ", " << legacy_ms / parallel_ms << "x)" << std::endl;
+
+    // Same comparison on the live /proc of this host
+    ProcThreadCounter live_counter;
+    int live_legacy = 0, live_fast = 0;
+    double live_legacy_ms = time_ms(rounds, [&] { return count_threads_legacy("/proc"); }, live_legacy);
+    double live_fast_ms = time_ms(rounds, [&] { return live_counter.count(); }, live_fast);
+    std::cout << "live /proc: legacy " << live_legacy_ms << " ms, ProcThreadCounter "
+              << live_fast_ms << " ms (" << live_legacy_ms / live_fast_ms << "x)" << std::endl;
+
+    std::string cleanup = "rm -rf '" + root + "'";
+    return std::system(cleanup.c_str()) == 0 && legacy_total == fast_total && fast_total == parallel_total ? 0 : 1;
+}
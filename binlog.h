@@ -0,0 +1,196 @@
+#pragma once
+
+// Compact binary log format written by log_server (LOG_FORMAT=binary|both)
+// and read by logquery.
+//
+// logs/<source>.blog starts with a 16 byte file header followed by records:
+//   BinlogRecord (16 bytes, little-endian host layout) + payload bytes
+// logs/<source>.bidx is a sparse time index: BinlogIndexEntry values
+// appended whenever a new second of log time starts or every
+// BINLOG_INDEX_RECORDS records, each pointing at the first record written
+// after it. Timestamps in the index never decrease, so a reader can binary
+// search it and only touch the part of the log that covers a time range.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log_ring.h"
+
+const char BINLOG_MAGIC[8] = {'B', 'L', 'O', 'G', '0', '0', '0', '1'};
+const uint32_t BINLOG_INDEX_RECORDS = 4096;
+
+enum class EventType : uint8_t {
+    Other = 0,
+    ServerStart,
+    ServerStop,
+    ServerError,
+    ClientConnect,
+    Command,
+    Exit,
+    LogDropped,
+};
+
+struct BinlogFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct BinlogRecord {
+    uint64_t timestamp_ns;
+    uint32_t client_id;
+    uint16_t payload_len;
+    uint8_t server_id;
+    uint8_t event_type;
+};
+
+struct BinlogIndexEntry {
+    uint64_t timestamp_ns;
+    uint64_t offset;
+};
+
+static_assert(sizeof(BinlogFileHeader) == 16, "binlog header layout changed");
+static_assert(sizeof(BinlogRecord) == 16, "binlog record layout changed");
+static_assert(sizeof(BinlogIndexEntry) == 16, "binlog index layout changed");
+
+inline EventType event_type_from_name(const std::string& name) {
+    if (name == "COMMAND") return EventType::Command;
+    if (name == "CLIENT_CONNECT") return EventType::ClientConnect;
+    if (name == "EXIT") return EventType::Exit;
+    if (name == "SERVER_START") return EventType::ServerStart;
+    if (name == "SERVER_STOP") return EventType::ServerStop;
+    if (name == "SERVER_ERROR") return EventType::ServerError;
+    if (name == "LOG_DROPPED") return EventType::LogDropped;
+    return EventType::Other;
+}
+
+inline const char* event_type_name(EventType type) {
+    switch (type) {
+        case EventType::ServerStart: return "SERVER_START";
+        case EventType::ServerStop: return "SERVER_STOP";
+        case EventType::ServerError: return "SERVER_ERROR";
+        case EventType::ClientConnect: return "CLIENT_CONNECT";
+        case EventType::Command: return "COMMAND";
+        case EventType::Exit: return "EXIT";
+        case EventType::LogDropped: return "LOG_DROPPED";
+        default: return "OTHER";
+    }
+}
+
+// "server2" -> 2, sources without a trailing number map to 0
+inline uint8_t source_server_id(const std::string& source) {
+    size_t pos = source.find_last_not_of("0123456789");
+    pos = (pos == std::string::npos) ? 0 : pos + 1;
+    if (pos >= source.size()) return 0;
+    return uint8_t(std::atoi(source.c_str() + pos));
+}
+
+// Append-only writer for one .blog/.bidx pair; records are buffered and
+// written out by flush().
+class BinlogSink {
+public:
+    ~BinlogSink() { close_files(); }
+
+    bool open(const std::string& base_path) {
+        log_fd = ::open((base_path + ".blog").c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        index_fd = ::open((base_path + ".bidx").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (log_fd == -1 || index_fd == -1) {
+            close_files();
+            return false;
+        }
+
+        struct stat st;
+        fstat(log_fd, &st);
+        file_size = st.st_size;
+        if (file_size == 0) {
+            BinlogFileHeader header{};
+            std::memcpy(header.magic, BINLOG_MAGIC, sizeof(header.magic));
+            header.version = 1;
+            buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        }
+        return true;
+    }
+
+    void append(uint8_t server_id, const LogRecord& record) {
+        uint64_t second = record.timestamp_ns / 1000000000ULL;
+        if (second != indexed_second || records_since_index >= BINLOG_INDEX_RECORDS) {
+            // Producers stamp events slightly out of order; the index must not
+            // go backwards or binary search would skip records.
+            BinlogIndexEntry entry{record.timestamp_ns, file_size + buffer.size()};
+            if (entry.timestamp_ns < last_index_ts) entry.timestamp_ns = last_index_ts;
+            index_buffer.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+            last_index_ts = entry.timestamp_ns;
+            indexed_second = second;
+            records_since_index = 0;
+        }
+
+        // Payload keeps the event name for OTHER events so nothing is lost
+        std::string extra;
+        EventType type = event_type_from_name(record.event_type);
+        if (type == EventType::Other) extra = record.event_type + "|";
+
+        BinlogRecord header{};
+        header.timestamp_ns = record.timestamp_ns;
+        header.client_id = record.client_id;
+        size_t payload_len = extra.size() + record.data.size();
+        header.payload_len = uint16_t(payload_len > 0xffff ? 0xffff : payload_len);
+        header.server_id = server_id;
+        header.event_type = uint8_t(type);
+
+        buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        buffer += extra;
+        buffer.append(record.data, 0, header.payload_len - extra.size());
+        records_since_index++;
+    }
+
+    size_t buffered() const { return buffer.size(); }
+
+    // Data goes out before the index so an index entry never points past
+    // the end of the log.
+    size_t flush() {
+        size_t written = write_all(log_fd, buffer);
+        file_size += written;
+        buffer.clear();
+        write_all(index_fd, index_buffer);
+        index_buffer.clear();
+        return written;
+    }
+
+    void sync() {
+        if (log_fd != -1) fdatasync(log_fd);
+        if (index_fd != -1) fdatasync(index_fd);
+    }
+
+private:
+    static size_t write_all(int fd, const std::string& data) {
+        size_t offset = 0;
+        while (fd != -1 && offset < data.size()) {
+            ssize_t n = write(fd, data.data() + offset, data.size() - offset);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            offset += n;
+        }
+        return offset;
+    }
+
+    void close_files() {
+        if (log_fd != -1) ::close(log_fd);
+        if (index_fd != -1) ::close(index_fd);
+        log_fd = index_fd = -1;
+    }
+
+    int log_fd = -1;
+    int index_fd = -1;
+    uint64_t file_size = 0;
+    std::string buffer;
+    std::string index_buffer;
+    uint64_t indexed_second = UINT64_MAX;
+    uint64_t last_index_ts = 0;
+    uint32_t records_since_index = 0;
+};
@@ -9,11 +9,21 @@
 #include <vector>
 #include <cstring>
 #include <poll.h>
+#include <netdb.h>
+#include <fstream>
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include "local_socket.h"
+#include "protocol.h"
 
 struct ServerConnection {
     int socket = -1;
     bool connected = false;
     int port = 0;
+    bool local = false;     // unix-сокет: каждый ответ - одно сообщение
 };
 
 void set_nonblock(int fd, bool nonblock) {
@@ -25,7 +35,355 @@ void set_nonblock(int fd, bool nonblock) {
     }
 }
 
-int main() {
+// К серверу на этой же машине клиент подключается через его unix-сокет
+// (local_socket.h), а если сервер его не слушает - по TCP.
+// CLIENT_TRANSPORT=tcp - всегда TCP.
+bool use_local_socket(const std::string& host) {
+    const char* transport = std::getenv("CLIENT_TRANSPORT");
+    return is_local_host(host) && !(transport && std::string(transport) == "tcp");
+}
+
+// ===== Пакетный режим =====
+//
+// ./client --batch script.jsonl [--host=127.0.0.1] [--timeout=5000]
+//
+// Каждая строка сценария - JSON-объект с полем "request" и адресом сервера:
+// "target": "host:port" или "server": 1|2 (порты 8080/8081 на --host),
+// 0 - объединённый сервер (порт 8082, все команды в одном соединении).
+// Необязательное поле "id" переносится в ответ. На каждую цель открывается
+// одно постоянное соединение, все её запросы отправляются конвейером в
+// кадровом протоколе, а все цели обслуживаются одним циклом poll.
+// Результаты печатаются в stdout в формате JSONL в порядке сценария.
+
+struct BatchRequest {
+    std::string id;
+    std::string request;
+    size_t target = 0;
+    size_t end_offset = 0;      // конец кадра в выходном буфере цели
+    std::chrono::steady_clock::time_point sent_at;
+    std::chrono::steady_clock::time_point done_at;
+    bool sent = false;
+    bool done = false;
+    std::string response;
+    std::string error;
+};
+
+struct BatchTarget {
+    std::string host;
+    int port = 0;
+    int fd = -1;
+    bool connected = false;
+    bool local = false;         // unix-сокет: отправка сообщениями
+    std::string out;
+    size_t out_offset = 0;
+    RingBuffer in;
+    std::vector<size_t> requests;   // индексы запросов по порядку отправки
+    size_t first_unsent = 0;
+    size_t outstanding = 0;
+    std::string error;
+};
+
+// Достаёт значение поля из плоского JSON-объекта (строку или число)
+bool json_field(const std::string& line, const std::string& key, std::string& value) {
+    size_t pos = line.find("\"" + key + "\"");
+    if (pos == std::string::npos) return false;
+    pos = line.find(':', pos + key.size() + 2);
+    if (pos == std::string::npos) return false;
+    pos = line.find_first_not_of(" \t", pos + 1);
+    if (pos == std::string::npos) return false;
+
+    value.clear();
+    if (line[pos] != '"') {
+        size_t end = line.find_first_of(",} \t", pos);
+        value = line.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        return !value.empty();
+    }
+    for (size_t i = pos + 1; i < line.size(); ++i) {
+        char c = line[i];
+        if (c == '"') return true;
+        if (c == '\\' && i + 1 < line.size()) {
+            c = line[++i];
+            if (c == 'n') c = '\n';
+            else if (c == 't') c = '\t';
+        }
+        value += c;
+    }
+    return false;
+}
+
+std::string json_escape(const std::string& text) {
+    std::string out;
+    for (unsigned char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += char(c);
+                }
+        }
+    }
+    return out;
+}
+
+bool start_connect(BatchTarget& target) {
+    if (use_local_socket(target.host)) {
+        target.fd = connect_local(local_socket_for_port(target.port), true);
+        if (target.fd >= 0) {
+            target.connected = target.local = true;
+            return true;
+        }
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    int rc = getaddrinfo(target.host.c_str(), std::to_string(target.port).c_str(), &hints, &result);
+    if (rc != 0 || !result) {
+        target.error = gai_strerror(rc);
+        return false;
+    }
+
+    target.fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (target.fd < 0) {
+        target.error = strerror(errno);
+        freeaddrinfo(result);
+        return false;
+    }
+    set_nonblock(target.fd, true);
+
+    int conn_result = connect(target.fd, result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+    if (conn_result == 0) {
+        target.connected = true;
+    } else if (errno != EINPROGRESS) {
+        target.error = strerror(errno);
+        close(target.fd);
+        target.fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void fail_target(BatchTarget& target, std::vector<BatchRequest>& requests, const std::string& error) {
+    for (size_t idx : target.requests) {
+        if (!requests[idx].done) {
+            requests[idx].done = true;
+            requests[idx].error = error;
+        }
+    }
+    target.outstanding = 0;
+    if (target.fd >= 0) close(target.fd);
+    target.fd = -1;
+}
+
+int run_batch(const std::string& script_path, const std::string& default_host, int timeout_ms) {
+    using Clock = std::chrono::steady_clock;
+
+    std::ifstream script_file;
+    std::istream* script = &std::cin;
+    if (script_path != "-") {
+        script_file.open(script_path);
+        if (!script_file) {
+            std::cerr << "🚫 Не удалось открыть сценарий: " << script_path << std::endl;
+            return 1;
+        }
+        script = &script_file;
+    }
+
+    std::vector<BatchRequest> requests;
+    std::vector<BatchTarget> targets;
+    std::map<std::string, size_t> target_index;
+
+    std::string line;
+    size_t line_no = 0;
+    while (std::getline(*script, line)) {
+        line_no++;
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+        BatchRequest req;
+        std::string target_name, server;
+        if (!json_field(line, "request", req.request)) {
+            std::cerr << "⚠️ Строка " << line_no << ": нет поля \"request\"" << std::endl;
+            continue;
+        }
+        if (!json_field(line, "id", req.id)) req.id = std::to_string(line_no);
+        if (!json_field(line, "target", target_name)) {
+            json_field(line, "server", server);
+            target_name = default_host + ":" + (server == "0" ? "8082" : server == "2" ? "8081" : "8080");
+        }
+
+        size_t colon = target_name.rfind(':');
+        if (colon == std::string::npos) {
+            std::cerr << "⚠️ Строка " << line_no << ": адрес должен быть host:port" << std::endl;
+            continue;
+        }
+
+        auto it = target_index.find(target_name);
+        if (it == target_index.end()) {
+            BatchTarget target;
+            target.host = target_name.substr(0, colon);
+            target.port = std::atoi(target_name.c_str() + colon + 1);
+            target.out.push_back(char(FRAME_MAGIC));
+            it = target_index.emplace(target_name, targets.size()).first;
+            targets.push_back(std::move(target));
+        }
+
+        BatchTarget& target = targets[it->second];
+        req.target = it->second;
+        // Номер запроса в сценарии служит идентификатором кадра
+        append_frame(target.out, uint32_t(requests.size()), req.request);
+        req.end_offset = target.out.size();
+        target.requests.push_back(requests.size());
+        target.outstanding++;
+        requests.push_back(std::move(req));
+    }
+
+    for (auto& target : targets) {
+        if (!start_connect(target)) fail_target(target, requests, target.error);
+    }
+
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    std::vector<pollfd> pfds;
+    std::vector<size_t> pfd_target;
+
+    while (true) {
+        pfds.clear();
+        pfd_target.clear();
+        for (size_t i = 0; i < targets.size(); ++i) {
+            BatchTarget& target = targets[i];
+            if (target.fd < 0 || target.outstanding == 0) continue;
+            short events = 0;
+            if (!target.connected || target.out_offset < target.out.size()) events |= POLLOUT;
+            if (target.connected) events |= POLLIN;
+            pfds.push_back({target.fd, events, 0});
+            pfd_target.push_back(i);
+        }
+        if (pfds.empty()) break;
+
+        int wait_ms = int(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count());
+        if (wait_ms <= 0) break;
+
+        int poll_res = poll(pfds.data(), pfds.size(), wait_ms);
+        if (poll_res < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "🚫 Ошибка poll: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        for (size_t p = 0; p < pfds.size(); ++p) {
+            BatchTarget& target = targets[pfd_target[p]];
+            short revents = pfds[p].revents;
+            if (!revents) continue;
+
+            if (!target.connected) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(target.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err) {
+                    fail_target(target, requests, strerror(err));
+                    continue;
+                }
+                target.connected = true;
+            }
+
+            if (revents & POLLOUT) {
+                while (target.out_offset < target.out.size()) {
+                    size_t len = target.out.size() - target.out_offset;
+                    if (target.local) len = std::min(len, LOCAL_MAX_MESSAGE);
+                    ssize_t sent = send(target.fd, target.out.data() + target.out_offset, len, MSG_NOSIGNAL);
+                    if (sent <= 0) break;
+                    target.out_offset += sent;
+                }
+                Clock::time_point now = Clock::now();
+                while (target.first_unsent < target.requests.size() &&
+                       requests[target.requests[target.first_unsent]].end_offset <= target.out_offset) {
+                    BatchRequest& req = requests[target.requests[target.first_unsent++]];
+                    req.sent = true;
+                    req.sent_at = now;
+                }
+            }
+
+            if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                bool closed = false;
+                while (true) {
+                    ssize_t bytes;
+                    if (target.local) {
+                        bytes = recv_message(target.fd, target.in, MSG_DONTWAIT);
+                    } else {
+                        auto area = target.in.write_area(4096);
+                        bytes = recv(target.fd, area.first, area.second, MSG_DONTWAIT);
+                        if (bytes > 0) target.in.commit(bytes);
+                    }
+                    if (bytes > 0) continue;
+                    closed = bytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+                    break;
+                }
+
+                Clock::time_point now = Clock::now();
+                Frame frame;
+                while (next_frame(target.in, frame) == FrameStatus::Ready) {
+                    if (frame.request_id >= requests.size()) continue;
+                    BatchRequest& req = requests[frame.request_id];
+                    if (req.done || req.target != pfd_target[p]) continue;
+                    req.done = true;
+                    req.done_at = now;
+                    req.response = frame.payload;
+                    target.outstanding--;
+                }
+                if (closed) fail_target(target, requests, "соединение закрыто сервером");
+            }
+        }
+    }
+
+    for (auto& target : targets) {
+        fail_target(target, requests, "таймаут ожидания ответа");
+    }
+
+    for (const auto& req : requests) {
+        const BatchTarget& target = targets[req.target];
+        std::cout << "{\"id\": \"" << json_escape(req.id) << "\", \"target\": \""
+                  << json_escape(target.host) << ":" << target.port << "\", \"request\": \""
+                  << json_escape(req.request) << "\", ";
+        if (req.error.empty()) {
+            double latency_ms = std::chrono::duration<double, std::milli>(req.done_at - req.sent_at).count();
+            std::cout << "\"status\": \"ok\", \"latency_ms\": " << latency_ms
+                      << ", \"response\": \"" << json_escape(req.response) << "\"}";
+        } else {
+            std::cout << "\"status\": \"error\", \"error\": \"" << json_escape(req.error) << "\"}";
+        }
+        std::cout << "\n";
+    }
+    std::cout.flush();
+
+    for (const auto& req : requests) {
+        if (!req.error.empty()) return 2;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::string batch_script;
+    std::string batch_host = "127.0.0.1";
+    int batch_timeout_ms = 5000;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--batch" && i + 1 < argc) batch_script = argv[++i];
+        else if (arg.rfind("--host=", 0) == 0) batch_host = arg.substr(7);
+        else if (arg.rfind("--timeout=", 0) == 0) batch_timeout_ms = std::atoi(arg.c_str() + 10);
+    }
+    if (!batch_script.empty()) {
+        return run_batch(batch_script, batch_host, batch_timeout_ms);
+    }
+
     std::vector<ServerConnection> servers = {
         {-1, false, 8080},
         {-1, false, 8081}
@@ -60,6 +418,19 @@ int main() {
                 return;
             }
 
+            if(use_local_socket(server_ip)) {
+                std::string name = local_socket_for_port(servers[server_idx].port);
+                int sock = connect_local(name);
+                if(sock >= 0) {
+                    servers[server_idx].socket = sock;
+                    servers[server_idx].connected = true;
+                    servers[server_idx].local = true;
+                    std::cout << "✅ Успешное подключение к Серверу " << server_idx+1
+                              << " (unix-сокет " << name << ")!" << std::endl;
+                    return;
+                }
+            }
+
             int sock = socket(AF_INET, SOCK_STREAM, 0);
             if (sock < 0) {
                 std::cout << "🚫 Ошибка создания сокета: " << strerror(errno) << std::endl;
@@ -125,6 +496,7 @@ int main() {
             close(servers[server_idx].socket);
             servers[server_idx].socket = -1;
             servers[server_idx].connected = false;
+            servers[server_idx].local = false;
             std::cout << "🔌 Отключено от Сервера " << server_idx+1 << std::endl;
         };
 
@@ -174,10 +546,18 @@ int main() {
                 int poll_res = poll(&pfd, 1, 5000);
                 if(poll_res > 0) {
                     if(pfd.revents & POLLIN) {
-                        ssize_t bytes = recv(current_socket, buffer, sizeof(buffer), 0);
+                        // По unix-сокету ответ приходит одним сообщением любой длины
+                        std::string response;
+                        ssize_t bytes;
+                        if(servers[server_choice-1].local) {
+                            bytes = recv_whole_message(current_socket, response);
+                        } else {
+                            bytes = recv(current_socket, buffer, sizeof(buffer), 0);
+                            if(bytes > 0) response.assign(buffer, bytes);
+                        }
                         if(bytes > 0) {
                             std::cout << "📨 Ответ сервера " << server_choice << ":\n" 
-                                      << std::string(buffer, bytes) << std::endl;
+                                      << response << std::endl;
                         }
                         else {
                             std::cout << "🚫 Соединение закрыто сервером" << std::endl;
@@ -0,0 +1,77 @@
+#pragma once
+
+// The command handlers of server1 and server2 as registry modules.
+//
+// Each module only needs the service it answers from, so any server can
+// host any combination of them. Modules whose service pulls in a system
+// library live next to that service (MOUSE_KEYS in mouse_inventory.h,
+// MOVE_WINDOW in window_mover.h). Response texts are unchanged from the
+// original servers, which keeps existing clients working whichever
+// process answers.
+
+#include <string>
+#include "command_registry.h"
+#include "procfs.h"
+
+// MEMORY [FRESH]
+inline void register_memory_module(CommandRegistry& commands, PeriodicSampler<size_t>& free_memory) {
+    commands.add("MEMORY", [&free_memory](CommandRequest& request, ResponseBuffer& out) {
+        if (!request.args.empty() && request.args != "FRESH") return false;
+        size_t free_mem = request.args.empty() ? free_memory.get() : free_memory.fresh();
+        out += request.timestamp;
+        out += "Free memory: ";
+        append_number(out, uint64_t(free_mem));
+        out += " bytes\n";
+        request.log_line("COMMAND", "Received command: ");
+        return true;
+    });
+}
+
+// THREAD_COUNT [FRESH]. The source is a PeriodicSampler<int> or a
+// ProcEventCounter (proc_events.h), anything with get() and fresh().
+template <typename ThreadSource>
+inline void register_thread_module(CommandRegistry& commands, ThreadSource& thread_count) {
+    commands.add("THREAD_COUNT", [&thread_count](CommandRequest& request, ResponseBuffer& out) {
+        if (!request.args.empty() && request.args != "FRESH") return false;
+        int total_threads = request.args.empty() ? thread_count.get() : thread_count.fresh();
+        out += request.timestamp;
+        out += "Всего потоков в системе: ";
+        append_number(out, int64_t(total_threads));
+        request.log_line("COMMAND", "Received command: ");
+        return true;
+    });
+}
+
+// STATS, EXIT and the reply to unknown commands; only the wording differs
+// between the servers.
+struct ControlTexts {
+    const char* stats_header;
+    const char* exit_reply;
+    const char* unknown_reply;
+};
+
+const ControlTexts SERVER1_TEXTS = {"Statistics:\n", "Connection closed", "Invalid command\n"};
+const ControlTexts SERVER2_TEXTS = {"Статистика:\n", " Соединение закрыто", "ERROR Неизвестная команда"};
+
+inline void register_control_commands(CommandRegistry& commands, MetricsRegistry& metrics, const ControlTexts& texts) {
+    commands.add("STATS", [&metrics, &texts](CommandRequest& request, ResponseBuffer& out) {
+        if (!request.args.empty()) return false;
+        out += request.timestamp;
+        out += texts.stats_header;
+        out += metrics.stats_text();
+        return true;
+    });
+    commands.add("EXIT", [&texts](CommandRequest& request, ResponseBuffer& out) {
+        if (!request.args.empty()) return false;
+        out += request.timestamp;
+        out += texts.exit_reply;
+        request.log_line("EXIT", "Received command: ");
+        request.close_connection = true;
+        return true;
+    });
+    commands.set_fallback([&texts](CommandRequest& request, ResponseBuffer& out) {
+        out += request.timestamp;
+        out += texts.unknown_reply;
+        return true;
+    });
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+// Command dispatch shared by the servers.
+//
+// Handlers are registered under the first word of the command; the rest of
+// the line is passed to them as arguments. A handler that does not accept
+// its arguments returns false and the request is answered by the fallback
+// handler, the same way an unknown command is. Each listener of a server
+// can be bound to its own registry, which is how the unified server keeps
+// the legacy ports answering with exactly the old command sets.
+//
+// A handler whose answer comes from another thread (MOVE_WINDOW waits for
+// the X11 owner thread) calls request.defer() and returns at once; the
+// DeferredReply it gets is completed from that thread and the connection
+// sends the response then. Callers that cannot take a late reply pass no
+// ReplyTarget, defer() returns null and the handler answers in place.
+//
+// Handlers append their response to the caller's output buffer. The reactor
+// passes the connection's reusable buffer, server2's workers one carved from
+// their RequestArena (arena.h). The timestamp prefix is formatted once per
+// second per thread and numbers are written with to_chars, so a steady-state
+// MEMORY, THREAD_COUNT or MOUSE_KEYS request allocates nothing (bench_alloc
+// checks this).
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "metrics.h"
+
+class PushTarget;   // subscriptions.h
+
+// The rest of a request answered after its handler returned. complete() is
+// called once, from any thread.
+class DeferredReply {
+public:
+    virtual ~DeferredReply() = default;
+    virtual void complete(std::string_view response) = 0;
+};
+
+// Implemented by connections that can send a reply after the handler
+// returned; defer_reply() is called on the connection's own thread.
+class ReplyTarget {
+public:
+    virtual std::shared_ptr<DeferredReply> defer_reply() = 0;
+
+protected:
+    ~ReplyTarget() = default;
+};
+
+using CommandLogger = std::function<void(std::string_view event_type, std::string_view data, uint32_t client_id)>;
+
+struct CommandRequest {
+    std::string_view line;          // the whole command as received
+    std::string_view args;          // text after the command name
+    uint32_t client_id;
+    std::string_view timestamp;     // "[YYYY-mm-dd HH:MM:SS] "
+    const CommandLogger& log;
+    PushTarget* push;               // null if the connection cannot take pushes
+    ReplyTarget* later;             // null if the response is needed on return
+    bool close_connection = false;
+    bool deferred = false;
+
+    // Hands the response over to the returned object; whatever the handler
+    // appends to out is dropped. Null if the caller cannot wait for it.
+    std::shared_ptr<DeferredReply> defer() {
+        if (!later) return nullptr;
+        deferred = true;
+        return later->defer_reply();
+    }
+
+    // Logs "<prefix><line>" without building a temporary string
+    void log_line(std::string_view event_type, std::string_view prefix) const {
+        if (!log) return;
+        char buf[256];
+        size_t n = std::min(prefix.size(), sizeof(buf));
+        std::memcpy(buf, prefix.data(), n);
+        size_t rest = std::min(line.size(), sizeof(buf) - n);
+        std::memcpy(buf + n, line.data(), rest);
+        log(event_type, std::string_view(buf, n + rest), client_id);
+    }
+};
+
+// Responses are written into a pmr string so a caller without a reusable
+// buffer can hand in one backed by a RequestArena (arena.h)
+using ResponseBuffer = std::pmr::string;
+
+// Appends the response to out; returns false when the arguments are not
+// understood (anything appended is then discarded)
+using CommandHandler = std::function<bool(CommandRequest& request, ResponseBuffer& out)>;
+
+// "[YYYY-mm-dd HH:MM:SS] " for the current second, formatted once per second
+// per thread. The view stays valid until the thread's next call.
+inline std::string_view timestamp_prefix() {
+    thread_local std::time_t cached_second = -1;
+    thread_local char text[32];
+    thread_local size_t length = 0;
+
+    std::time_t now = std::time(nullptr);
+    if (now != cached_second) {
+        std::tm tm_buf;
+        localtime_r(&now, &tm_buf);
+        length = std::strftime(text, sizeof(text), "[%Y-%m-%d %H:%M:%S] ", &tm_buf);
+        cached_second = now;
+    }
+    return std::string_view(text, length);
+}
+
+inline void append_number(ResponseBuffer& out, uint64_t value) {
+    char buf[24];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, result.ptr - buf);
+}
+
+inline void append_number(ResponseBuffer& out, int64_t value) {
+    char buf[24];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, result.ptr - buf);
+}
+
+class CommandRegistry {
+public:
+    explicit CommandRegistry(MetricsRegistry* metrics = nullptr) : metrics(metrics) {}
+
+    void add(const std::string& name, CommandHandler handler) {
+        for (auto& entry : handlers) {
+            if (entry.first == name) {
+                entry.second = std::move(handler);
+                return;
+            }
+        }
+        handlers.emplace_back(name, std::move(handler));
+    }
+
+    void set_fallback(CommandHandler handler) { fallback = std::move(handler); }
+
+    void set_logger(CommandLogger logger) { log = std::move(logger); }
+
+    // Copies every handler of another registry (later ones win)
+    void merge(const CommandRegistry& other) {
+        for (const auto& entry : other.handlers) add(entry.first, entry.second);
+    }
+
+    bool contains(std::string_view name) const { return find(name) != nullptr; }
+
+    // Appends the response for line to out. Returns false if the handler
+    // deferred it (nothing appended); later then receives it.
+    bool dispatch_to(ResponseBuffer& out, std::string_view line, uint32_t client_id, bool& close_connection,
+                     PushTarget* push = nullptr, ReplyTarget* later = nullptr) const {
+        uint64_t started = metrics_ticks();
+        size_t space = line.find(' ');
+        std::string_view name = line.substr(0, space);
+
+        CommandRequest request{line, space == std::string_view::npos ? std::string_view() : line.substr(space + 1),
+                               client_id, timestamp_prefix(), log, push, later};
+        if (log) log("CLIENT_CONNECT", "New client connected", client_id);
+
+        size_t mark = out.size();
+        const CommandHandler* handler = find(name);
+        if (!handler || !(*handler)(request, out)) {
+            out.resize(mark);
+            request.deferred = false;
+            if (fallback) fallback(request, out);
+        }
+        if (request.deferred) out.resize(mark);
+        close_connection = request.close_connection;
+
+        if (metrics) metrics->record_request(classify_command(line), started);
+        return !request.deferred;
+    }
+
+private:
+    // A handful of commands: a linear scan over string_views beats hashing
+    // a temporary key
+    const CommandHandler* find(std::string_view name) const {
+        for (const auto& entry : handlers) {
+            if (entry.first == name) return &entry.second;
+        }
+        return nullptr;
+    }
+
+    MetricsRegistry* metrics;
+    std::vector<std::pair<std::string, CommandHandler>> handlers;
+    CommandHandler fallback;
+    CommandLogger log;
+};
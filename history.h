@@ -0,0 +1,210 @@
+#pragma once
+
+// In-memory history of a sampled value for HISTORY.
+//
+// A recorder thread reads the value once a second (from its sampler, like
+// SUBSCRIBE) and adds it to two rollup rings: 1 s buckets for the last hour
+// and 1 min buckets for the last day. Each ring is a structure of arrays
+// (bucket number, sum, count) indexed by bucket number modulo its size, so
+// recording is a few stores, a query walks contiguous arrays and the whole
+// history takes about 100 KB whatever the uptime. A slot whose bucket
+// number is not the expected one holds nothing for that time (the server
+// was not running or the slot has been reused).
+//
+//   HISTORY <topic> <seconds> [step]       the last <seconds>
+//   HISTORY <topic> <from>-<to> [step]     unix time range
+//
+// The answer is one header line "HISTORY <topic> <first> <step> <count>"
+// and one line of <count> averages, oldest first, "-" for a gap. The finer
+// ring is used while the range is within the last hour and the step below
+// a minute; a larger step averages several buckets.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "command_registry.h"
+
+class HistoryRing {
+public:
+    HistoryRing(int resolution_s, size_t slots)
+        : resolution(resolution_s), bucket(slots, -1), sum(slots, 0.0), count(slots, 0) {}
+
+    int resolution_s() const { return resolution; }
+    int64_t retention_s() const { return int64_t(resolution) * int64_t(bucket.size()); }
+
+    void add(int64_t now_s, double value) {
+        int64_t number = now_s / resolution;
+        size_t slot = size_t(number % int64_t(bucket.size()));
+        if (bucket[slot] != number) {
+            bucket[slot] = number;
+            sum[slot] = 0.0;
+            count[slot] = 0;
+        }
+        sum[slot] += value;
+        count[slot]++;
+    }
+
+    // Adds up the buckets covering [from_s, to_s)
+    void collect(int64_t from_s, int64_t to_s, double& total, uint64_t& samples) const {
+        for (int64_t number = from_s / resolution; number * resolution < to_s; ++number) {
+            size_t slot = size_t(number % int64_t(bucket.size()));
+            if (bucket[slot] != number) continue;
+            total += sum[slot];
+            samples += count[slot];
+        }
+    }
+
+private:
+    int resolution;
+    std::vector<int64_t> bucket;
+    std::vector<double> sum;
+    std::vector<uint32_t> count;
+};
+
+class MetricHistory {
+public:
+    explicit MetricHistory(std::string topic) : topic_name(std::move(topic)) {}
+
+    ~MetricHistory() { stop(); }
+
+    const std::string& topic() const { return topic_name; }
+
+    // Records read() once a second until stop()
+    void start(std::function<double()> read) {
+        reader = std::move(read);
+        worker = std::thread(&MetricHistory::run, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+
+    void record(int64_t now_s, double value) {
+        std::lock_guard<std::mutex> lock(mtx);
+        seconds.add(now_s, value);
+        minutes.add(now_s, value);
+    }
+
+    // Appends the answer for [from_s, to_s] at the given step (0: the
+    // resolution of the ring used)
+    void query(int64_t from_s, int64_t to_s, int step_s, int64_t now_s, ResponseBuffer& out) const {
+        const HistoryRing& ring =
+            from_s > now_s - seconds.retention_s() && step_s < minutes.resolution_s() ? seconds : minutes;
+        int64_t oldest = now_s - ring.retention_s() + 1;
+        from_s = std::max(from_s, oldest);
+        to_s = std::min(to_s, now_s);
+        // One point never spans more than the ring holds
+        int64_t step = std::min<int64_t>(std::max<int64_t>(step_s, ring.resolution_s()), ring.retention_s());
+        step = (step + ring.resolution_s() - 1) / ring.resolution_s() * ring.resolution_s();
+        int64_t first = from_s / step * step;
+        uint64_t points = to_s >= first ? uint64_t((to_s - first) / step + 1) : 0;
+
+        out += "HISTORY ";
+        out += topic_name;
+        out += ' ';
+        append_number(out, int64_t(first));
+        out += ' ';
+        append_number(out, int64_t(step));
+        out += ' ';
+        append_number(out, points);
+        out += '\n';
+
+        std::lock_guard<std::mutex> lock(mtx);
+        for (uint64_t i = 0; i < points; ++i) {
+            if (i) out += ' ';
+            double total = 0.0;
+            uint64_t samples = 0;
+            int64_t start = first + int64_t(i) * step;
+            // The first point may start before the retained window
+            ring.collect(std::max(start, oldest), start + step, total, samples);
+            if (samples) {
+                append_number(out, uint64_t(total / double(samples) + 0.5));
+            } else {
+                out += '-';
+            }
+        }
+        out += '\n';
+    }
+
+private:
+    // Samples on a fixed 1 s schedule, so the time spent in reader() does
+    // not push later samples back and leave empty slots in the 1 s ring
+    void run() {
+        auto next = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!stopping) {
+            lock.unlock();
+            double value = reader();
+            record(int64_t(std::time(nullptr)), value);
+            lock.lock();
+            next += std::chrono::seconds(1);
+            // After a stall (suspend, overloaded host) resume from now
+            // instead of catching up with a burst of samples
+            auto now = std::chrono::steady_clock::now();
+            if (next < now) next = now;
+            cv.wait_until(lock, next, [this] { return stopping; });
+        }
+    }
+
+    std::string topic_name;
+    HistoryRing seconds{1, 3600};
+    HistoryRing minutes{60, 1440};
+    std::function<double()> reader;
+
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    std::thread worker;
+    bool stopping = false;
+};
+
+// HISTORY <topic> <seconds>|<from>-<to> [step]
+inline void register_history_module(CommandRegistry& commands, std::vector<const MetricHistory*> histories) {
+    commands.add("HISTORY", [histories](CommandRequest& request, ResponseBuffer& out) {
+        std::istringstream iss{std::string(request.args)};
+        std::string topic, range;
+        int step = 0;
+        out += request.timestamp;
+        if (!(iss >> topic >> range) || (iss >> step && step < 0)) {
+            out += "ERROR usage: HISTORY <topic> <seconds>|<from>-<to> [step]\n";
+            return true;
+        }
+
+        int64_t now = int64_t(std::time(nullptr));
+        int64_t from = 0, to = now;
+        char dash = 0;
+        std::istringstream range_stream(range);
+        if (range.find('-') == std::string::npos) {
+            int64_t seconds = 0;
+            if (!(range_stream >> seconds) || seconds <= 0) from = -1;
+            else from = now - seconds + 1;
+        } else if (!(range_stream >> from >> dash >> to) || dash != '-' || to < from) {
+            from = -1;
+        }
+        if (from < 0) {
+            out += "ERROR usage: HISTORY <topic> <seconds>|<from>-<to> [step]\n";
+            return true;
+        }
+
+        for (const MetricHistory* history : histories) {
+            if (history->topic() != topic) continue;
+            history->query(from, to, step, now, out);
+            request.log_line("COMMAND", "Received command: ");
+            return true;
+        }
+        out += "ERROR unknown topic " + topic + "\n";
+        return true;
+    });
+}
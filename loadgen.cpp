@@ -0,0 +1,408 @@
+// Open-loop load generator for server1/server2.
+//
+// Opens N framed-protocol connections to each server the request mix needs,
+// issues requests on a fixed schedule (target rate) regardless of how fast
+// responses come back, and measures every latency from the request's
+// intended send time, so a stalled server shows up in the tail instead of
+// silently lowering the offered load (coordinated omission). Results are
+// printed as JSON.
+//
+//   g++ -std=c++17 -O2 -o loadgen loadgen.cpp
+//   ./loadgen --connections=64 --rate=20000 --duration=10
+//             --mix=MEMORY=50,MOUSE_KEYS=10,THREAD_COUNT=30,MOVE_WINDOW=10
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cmath>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "protocol.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Log-linear histogram in the spirit of HdrHistogram: 64 linear
+// sub-buckets per power of two, i.e. under 1.6% relative error, fixed
+// memory and O(1) recording.
+class LatencyHistogram {
+public:
+    LatencyHistogram() : counts(BUCKETS, 0) {}
+
+    void record(uint64_t value_ns) {
+        size_t idx = index_of(value_ns);
+        if (idx >= BUCKETS) idx = BUCKETS - 1;
+        counts[idx]++;
+        total++;
+        sum += value_ns;
+        if (value_ns > max_value) max_value = value_ns;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return max_value; }
+    double mean() const { return total ? double(sum) / total : 0; }
+
+    uint64_t percentile(double p) const {
+        if (total == 0) return 0;
+        uint64_t rank = uint64_t(std::ceil(p / 100.0 * total));
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank) return std::min(value_at(i), max_value);
+        }
+        return max_value;
+    }
+
+private:
+    static const int SUB_BITS = 7;
+    static const uint64_t SUB_COUNT = 1 << SUB_BITS;
+    static const uint64_t HALF = SUB_COUNT / 2;
+    static const size_t BUCKETS = 64 * HALF + SUB_COUNT;
+
+    static size_t index_of(uint64_t v) {
+        if (v < SUB_COUNT) return v;
+        int magnitude = 63 - __builtin_clzll(v);
+        int shift = magnitude - (SUB_BITS - 1);
+        return size_t(shift) * HALF + (v >> shift);
+    }
+
+    // Upper edge of the bucket, so percentiles never under-report
+    static uint64_t value_at(size_t idx) {
+        if (idx < SUB_COUNT) return idx;
+        int shift = int(idx / HALF) - 1;
+        uint64_t sub = idx - uint64_t(shift) * HALF;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t max_value = 0;
+};
+
+struct CommandSpec {
+    std::string name;
+    std::string payload;
+    int server;     // 0 - server1, 1 - server2
+    int weight;
+};
+
+struct Pending {
+    Clock::time_point intended;
+    size_t command;
+};
+
+struct Connection {
+    int fd = -1;
+    int server = 0;
+    std::string out;
+    size_t out_offset = 0;
+    RingBuffer in;
+    std::unordered_map<uint32_t, Pending> in_flight;
+    bool want_write = false;
+};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int ports[2] = {8080, 8081};
+    int connections = 16;
+    double rate = 1000;
+    double duration = 10;
+    std::string mix = "MEMORY=50,MOUSE_KEYS=10,THREAD_COUNT=30,MOVE_WINDOW=10";
+};
+
+bool parse_options(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string key = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (key == "--host") options.host = value;
+        else if (key == "--server1-port") options.ports[0] = std::atoi(value.c_str());
+        else if (key == "--server2-port") options.ports[1] = std::atoi(value.c_str());
+        else if (key == "--connections") options.connections = std::atoi(value.c_str());
+        else if (key == "--rate") options.rate = std::atof(value.c_str());
+        else if (key == "--duration") options.duration = std::atof(value.c_str());
+        else if (key == "--mix") options.mix = value;
+        else return false;
+    }
+    return options.connections > 0 && options.rate > 0 && options.duration > 0;
+}
+
+bool parse_mix(const std::string& mix, std::vector<CommandSpec>& commands) {
+    std::stringstream ss(mix);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t eq = item.find('=');
+        std::string name = item.substr(0, eq);
+        int weight = eq == std::string::npos ? 1 : std::atoi(item.c_str() + eq + 1);
+        if (weight <= 0) continue;
+
+        if (name == "MEMORY" || name == "MOUSE_KEYS") {
+            commands.push_back({name, name, 0, weight});
+        } else if (name == "THREAD_COUNT") {
+            commands.push_back({name, name, 1, weight});
+        } else if (name == "MOVE_WINDOW") {
+            commands.push_back({name, "MOVE_WINDOW 100 100", 1, weight});
+        } else {
+            std::cerr << "Unknown command in mix: " << name << std::endl;
+            return false;
+        }
+    }
+    return !commands.empty();
+}
+
+int connect_to(const std::string& host, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    // Negotiate the framed protocol before the first request
+    char magic = char(FRAME_MAGIC);
+    if (send(fd, &magic, 1, MSG_NOSIGNAL) != 1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool flush_connection(Connection& conn) {
+    while (conn.out_offset < conn.out.size()) {
+        ssize_t sent = send(conn.fd, conn.out.data() + conn.out_offset,
+                            conn.out.size() - conn.out_offset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            return false;
+        }
+        conn.out_offset += sent;
+    }
+    conn.out.clear();
+    conn.out_offset = 0;
+    return true;
+}
+
+std::string json_latency(const LatencyHistogram& h) {
+    std::ostringstream out;
+    out << "{\"count\": " << h.count()
+        << ", \"mean\": " << h.mean() / 1000.0
+        << ", \"p50\": " << h.percentile(50) / 1000.0
+        << ", \"p90\": " << h.percentile(90) / 1000.0
+        << ", \"p99\": " << h.percentile(99) / 1000.0
+        << ", \"p999\": " << h.percentile(99.9) / 1000.0
+        << ", \"max\": " << h.max() / 1000.0 << "}";
+    return out.str();
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    std::vector<CommandSpec> commands;
+    if (!parse_options(argc, argv, options) || !parse_mix(options.mix, commands)) {
+        std::cerr << "Usage: " << argv[0] << " [--host=127.0.0.1] [--server1-port=8080] [--server2-port=8081]\n"
+                  << "       [--connections=16] [--rate=1000] [--duration=10]\n"
+                  << "       [--mix=MEMORY=50,MOUSE_KEYS=10,THREAD_COUNT=30,MOVE_WINDOW=10]" << std::endl;
+        return 1;
+    }
+
+    bool needs_server[2] = {false, false};
+    int total_weight = 0;
+    for (const auto& c : commands) {
+        needs_server[c.server] = true;
+        total_weight += c.weight;
+    }
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<Connection> connections;
+    std::vector<size_t> by_server[2];
+    for (int server = 0; server < 2; ++server) {
+        if (!needs_server[server]) continue;
+        for (int i = 0; i < options.connections; ++i) {
+            int fd = connect_to(options.host, options.ports[server]);
+            if (fd < 0) {
+                std::cerr << "Cannot connect to " << options.host << ":" << options.ports[server]
+                          << ": " << strerror(errno) << std::endl;
+                return 1;
+            }
+            Connection conn;
+            conn.fd = fd;
+            conn.server = server;
+            by_server[server].push_back(connections.size());
+            connections.push_back(std::move(conn));
+        }
+    }
+    for (size_t i = 0; i < connections.size(); ++i) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connections[i].fd, &ev);
+    }
+
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int> pick(0, total_weight - 1);
+    size_t round_robin[2] = {0, 0};
+
+    LatencyHistogram overall;
+    std::vector<LatencyHistogram> per_command(commands.size());
+    uint64_t sent = 0, completed = 0, errors = 0;
+    uint32_t next_id = 1;
+
+    const auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / options.rate));
+    const uint64_t planned = uint64_t(options.rate * options.duration);
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point drain_deadline = start + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.duration + 5.0));
+
+    epoll_event events[256];
+    while (true) {
+        Clock::time_point now = Clock::now();
+
+        // Issue everything whose intended send time has passed
+        while (sent < planned && start + interval * sent <= now) {
+            int roll = pick(rng);
+            size_t cmd = 0;
+            while (roll >= commands[cmd].weight) roll -= commands[cmd++].weight;
+
+            // Round robin over the connections still open; with none left the
+            // request fails right away instead of waiting out the drain
+            int server = commands[cmd].server;
+            const auto& pool = by_server[server];
+            Connection* conn = nullptr;
+            for (size_t tries = 0; tries < pool.size() && !conn; ++tries) {
+                Connection& candidate = connections[pool[round_robin[server]++ % pool.size()]];
+                if (candidate.fd >= 0) conn = &candidate;
+            }
+            sent++;
+            if (!conn) {
+                errors++;
+                continue;
+            }
+            uint32_t id = next_id++;
+            append_frame(conn->out, id, commands[cmd].payload);
+            conn->in_flight[id] = Pending{start + interval * (sent - 1), cmd};
+        }
+
+        for (size_t i = 0; i < connections.size(); ++i) {
+            Connection& conn = connections[i];
+            if (conn.fd < 0 || conn.out.empty()) continue;
+            if (!flush_connection(conn)) {
+                errors += conn.in_flight.size();
+                conn.in_flight.clear();
+                conn.out.clear();
+                close(conn.fd);
+                conn.fd = -1;
+                continue;
+            }
+            bool want_write = !conn.out.empty();
+            if (want_write != conn.want_write) {
+                epoll_event ev{};
+                ev.events = EPOLLIN | (want_write ? uint32_t(EPOLLOUT) : 0u);
+                ev.data.u64 = i;
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+                conn.want_write = want_write;
+            }
+        }
+
+        uint64_t outstanding = sent - completed - errors;
+        if (sent >= planned && outstanding == 0) break;
+        if (now >= drain_deadline) break;
+
+        int timeout_ms = 10;
+        if (sent < planned) {
+            // Rounded up: a wait of 0 with less than 1 ms to go would spin
+            auto until_next = start + interval * sent - Clock::now();
+            timeout_ms = int(std::chrono::ceil<std::chrono::milliseconds>(until_next).count());
+            if (timeout_ms < 0) timeout_ms = 0;
+        }
+
+        int n = epoll_wait(epoll_fd, events, 256, timeout_ms);
+        Clock::time_point received = Clock::now();
+        for (int e = 0; e < n; ++e) {
+            Connection& conn = connections[events[e].data.u64];
+            if (conn.fd < 0 || !(events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) continue;
+
+            bool closed = false;
+            while (true) {
+                auto area = conn.in.write_area(16384);
+                ssize_t got = recv(conn.fd, area.first, area.second, 0);
+                if (got > 0) {
+                    conn.in.commit(got);
+                    continue;
+                }
+                if (got < 0 && errno == EINTR) continue;
+                closed = got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+                break;
+            }
+
+            Frame frame;
+            while (next_frame(conn.in, frame) == FrameStatus::Ready) {
+                auto it = conn.in_flight.find(frame.request_id);
+                if (it == conn.in_flight.end()) continue;
+                uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    received - it->second.intended).count();
+                overall.record(latency);
+                per_command[it->second.command].record(latency);
+                conn.in_flight.erase(it);
+                completed++;
+            }
+
+            if (closed) {
+                errors += conn.in_flight.size();
+                conn.in_flight.clear();
+                conn.out.clear();
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn.fd, nullptr);
+                close(conn.fd);
+                conn.fd = -1;
+            }
+        }
+    }
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    uint64_t timeouts = sent - completed - errors;
+
+    std::cout << "{\n"
+              << "  \"target_rate\": " << options.rate << ",\n"
+              << "  \"duration_s\": " << elapsed << ",\n"
+              << "  \"connections_per_server\": " << options.connections << ",\n"
+              << "  \"sent\": " << sent << ",\n"
+              << "  \"completed\": " << completed << ",\n"
+              << "  \"errors\": " << errors << ",\n"
+              << "  \"timeouts\": " << timeouts << ",\n"
+              << "  \"throughput_rps\": " << completed / elapsed << ",\n"
+              << "  \"latency_us\": " << json_latency(overall) << ",\n"
+              << "  \"per_command_latency_us\": {";
+    for (size_t i = 0; i < commands.size(); ++i) {
+        std::cout << (i ? ",\n" : "\n") << "    \"" << commands[i].name << "\": " << json_latency(per_command[i]);
+    }
+    std::cout << "\n  }\n}" << std::endl;
+
+    for (auto& conn : connections) {
+        if (conn.fd >= 0) close(conn.fd);
+    }
+    close(epoll_fd);
+    return 0;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+// Unix domain sockets for clients on the same host.
+//
+// Next to its TCP port every server listens on an AF_UNIX SOCK_SEQPACKET
+// socket, which skips the loopback TCP stack. A name starting with '@' is in
+// the abstract namespace (nothing on disk, gone with the process), any other
+// name is a filesystem path. The client switches to the socket on its own
+// when the target is this host (local_socket_for_port()).
+//
+// SEQPACKET keeps message boundaries, so a legacy command is exactly one
+// message however the requests are queued, instead of whatever one recv
+// happened to return, and so is a legacy reply: a reader cannot tell where
+// a text reply ends, so it is never split. The server raises the send
+// buffer of a legacy connection (allow_large_messages()) so that replies up
+// to LOCAL_MAX_REPLY fit one message; the client reads them with
+// recv_whole_message(). Framed data is a byte stream split into messages of
+// at most LOCAL_MAX_MESSAGE (a frame may span several), so a framed reader
+// with a buffer that size never truncates.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "protocol.h"
+
+const size_t LOCAL_MAX_MESSAGE = 4096;
+const size_t LOCAL_MAX_REPLY = 1 << 20;
+
+const char* const SERVER_SOCKET = "@server";
+const char* const SERVER1_SOCKET = "@server1";
+const char* const SERVER2_SOCKET = "@server2";
+const char* const LOG_SERVER_SOCKET = "@log_server";
+
+// The socket name from an environment knob, the default if unset; an empty
+// value disables the socket
+inline std::string local_socket_name(const char* env_name, const char* default_name) {
+    const char* value = std::getenv(env_name);
+    return value ? std::string(value) : std::string(default_name);
+}
+
+// Where the server on a well-known port also listens, "" if nowhere. The
+// servers' knobs are honoured, so a client started with the same
+// environment finds a moved socket.
+inline std::string local_socket_for_port(int port) {
+    switch (port) {
+    case 8080: return local_socket_name("SERVER1_SOCKET", SERVER1_SOCKET);
+    case 8081: return local_socket_name("SERVER2_SOCKET", SERVER2_SOCKET);
+    case 8082: return local_socket_name("SERVER_SOCKET", SERVER_SOCKET);
+    default: return "";
+    }
+}
+
+inline bool is_local_host(const std::string& host) {
+    return host == "127.0.0.1" || host == "localhost" || host == "::1";
+}
+
+inline bool local_address(const std::string& name, sockaddr_un& addr, socklen_t& len) {
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    if (name.empty() || name.size() >= sizeof(addr.sun_path)) return false;
+    std::memcpy(addr.sun_path, name.data(), name.size());
+    // Abstract names start with a NUL byte and are not terminated
+    if (name[0] == '@') addr.sun_path[0] = '\0';
+    len = socklen_t(offsetof(sockaddr_un, sun_path) + name.size() + (name[0] == '@' ? 0 : 1));
+    return true;
+}
+
+inline int create_local_listen_socket(const std::string& name, int backlog) {
+    sockaddr_un addr;
+    socklen_t len;
+    if (!local_address(name, addr, len)) {
+        std::cerr << "Bad unix socket name: " << name << std::endl;
+        return -1;
+    }
+
+    int server_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_socket < 0) {
+        std::cerr << "Socket creation error: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    // A socket file left behind by a previous run would fail the bind
+    struct stat st;
+    if (name[0] != '@' && stat(name.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) unlink(name.c_str());
+
+    if (bind(server_socket, (sockaddr*)&addr, len) < 0) {
+        std::cerr << "Bind error on " << name << ": " << strerror(errno) << std::endl;
+        close(server_socket);
+        return -1;
+    }
+    if (listen(server_socket, backlog) < 0) {
+        std::cerr << "Listen error: " << strerror(errno) << std::endl;
+        close(server_socket);
+        return -1;
+    }
+    return server_socket;
+}
+
+// Connects to a local socket; -1 with errno set if no server is there
+inline int connect_local(const std::string& name, bool nonblock = false) {
+    sockaddr_un addr;
+    socklen_t len;
+    if (!local_address(name, addr, len)) {
+        errno = EINVAL;
+        return -1;
+    }
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | (nonblock ? SOCK_NONBLOCK : 0), 0);
+    if (sock < 0) return -1;
+    if (connect(sock, (sockaddr*)&addr, len) < 0) {
+        int err = errno;
+        close(sock);
+        errno = err;
+        return -1;
+    }
+    return sock;
+}
+
+// Raises the send buffer of a connected seqpacket socket for legacy
+// replies and returns the largest message it takes now. That is below
+// LOCAL_MAX_REPLY where net.core.wmem_max is smaller; only a reply larger
+// still is cut into several messages.
+inline size_t allow_large_messages(int fd) {
+    int bytes = int(LOCAL_MAX_REPLY);
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+    int actual = 0;
+    socklen_t len = sizeof(actual);
+    if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &actual, &len) != 0) return LOCAL_MAX_MESSAGE;
+    // The kernel refuses a message within 32 bytes of the buffer size
+    return std::max(LOCAL_MAX_MESSAGE, size_t(actual) - 1024);
+}
+
+// Reads one message of any size into out (a legacy reply). Returns its
+// size, 0 at end of stream, -1 with errno set.
+inline ssize_t recv_whole_message(int fd, std::string& out, int flags = 0) {
+    ssize_t size = recv(fd, nullptr, 0, flags | MSG_PEEK | MSG_TRUNC);
+    if (size <= 0) return size;
+    out.resize(size_t(size));
+    return recv(fd, &out[0], out.size(), flags);
+}
+
+// Reads one message into in. Returns its size, 0 at end of stream, -1 with
+// errno set (EMSGSIZE for a message over LOCAL_MAX_MESSAGE, which is lost).
+inline ssize_t recv_message(int fd, RingBuffer& in, int flags = 0) {
+    char message[LOCAL_MAX_MESSAGE];
+    ssize_t n = recv(fd, message, sizeof(message), flags | MSG_TRUNC);
+    if (n > ssize_t(sizeof(message))) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (n > 0) in.append(message, size_t(n));
+    return n;
+}
@@ -0,0 +1,419 @@
+#pragma once
+
+// Network side of log_server: receives the batches of log_net.h from any
+// number of producers and hands them to the sharded writer.
+//
+// One epoll loop serves every transport: TCP connections, a UDP socket
+// (recvmmsg, many datagrams per call) and a unix SEQPACKET socket for
+// producers on this host. TCP and UDP listen on 127.0.0.1 unless log_server
+// is given another address: nothing authenticates a producer. Records are
+// collected per source while a round of events is handled and submitted to
+// the writer once per round, one batch per source.
+//
+// Every stream (one producer run, see log_net.h) of a source is checked
+// against its own sequence numbers, so several instances may share a
+// source name. A batch from before the expected number (UDP reordering or
+// duplicates) is still written and counted as late. A gap is only
+// reported as a LOG_LOST record in the source's log once it has stayed
+// open for the reorder window; late batches arriving before that fill it
+// instead. Streams idle for LOG_STREAM_IDLE_S are forgotten.
+//
+// Source names come from the producers (LOG_SOURCE of a server) and name
+// the log files. They get a "remote-" prefix, so no producer can write
+// into the logs of the local rings (server1, server2), and characters
+// other than letters, digits, '.', '_' and '-' are replaced.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <arpa/inet.h>
+#include <map>
+#include <netinet/in.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "local_socket.h"
+#include "log_net.h"
+#include "log_writer.h"
+#include "protocol.h"
+
+const int LOG_UDP_BATCH = 32;   // datagrams per recvmmsg
+const size_t LOG_MAX_GAPS = 1024;       // open gaps per stream, older ones are reported early
+const int LOG_STREAM_IDLE_S = 600;
+
+class LogCollector {
+public:
+    // reorder_ms - how long a gap may still be filled by late batches
+    LogCollector(ShardedLogWriter& writer, int reorder_ms)
+        : writer(writer), reorder_window(std::max(0, reorder_ms)), epoll_fd(epoll_create1(EPOLL_CLOEXEC)),
+          message(LOG_BATCH_MAX + 4) {}
+
+    ~LogCollector() {
+        for (auto& entry : connections) close(entry.first);
+        for (int fd : {tcp_fd, udp_fd, local_fd}) {
+            if (fd >= 0) close(fd);
+        }
+        close(epoll_fd);
+    }
+
+    LogCollector(const LogCollector&) = delete;
+    LogCollector& operator=(const LogCollector&) = delete;
+
+    bool listen_tcp(const std::string& address, int port, int backlog) {
+        tcp_fd = bind_inet(SOCK_STREAM, address, port);
+        if (tcp_fd < 0) return false;
+        if (listen(tcp_fd, backlog) < 0) {
+            std::cerr << "Listen error: " << strerror(errno) << std::endl;
+            return false;
+        }
+        return watch(tcp_fd);
+    }
+
+    bool listen_udp(const std::string& address, int port) {
+        udp_fd = bind_inet(SOCK_DGRAM, address, port);
+        if (udp_fd < 0) return false;
+        // Bursts from many producers wait here while a round is written out
+        int bytes = 4 << 20;
+        setsockopt(udp_fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+        datagrams.assign(LOG_UDP_BATCH * (LOG_BATCH_MAX + 4), 0);
+        return watch(udp_fd);
+    }
+
+    bool listen_local(const std::string& name, int backlog) {
+        local_fd = create_local_listen_socket(name, backlog);
+        return local_fd >= 0 && watch(local_fd);
+    }
+
+    // Serves producers until running is cleared
+    void run(const std::atomic<bool>& running, int stats_interval_s) {
+        epoll_event events[64];
+        auto stats_start = std::chrono::steady_clock::now();
+        while (running) {
+            int n = epoll_wait(epoll_fd, events, 64, 100);
+            if (n < 0 && errno != EINTR) {
+                std::cerr << "epoll_wait error: " << strerror(errno) << std::endl;
+                break;
+            }
+            round_time = Clock::now();
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == tcp_fd || fd == local_fd) {
+                    accept_all(fd);
+                } else if (fd == udp_fd) {
+                    read_datagrams();
+                } else {
+                    read_connection(fd);
+                }
+            }
+            expire_gaps(round_time, false);
+            submit_pending();
+
+            auto now = round_time;
+            if (stats_interval_s > 0 && now - stats_start >= std::chrono::seconds(stats_interval_s)) {
+                if (batches > 0) report_stats(std::chrono::duration<double>(now - stats_start).count());
+                stats_start = now;
+            }
+        }
+        // Whatever is still missing at shutdown is not coming any more
+        expire_gaps(Clock::now(), true);
+        submit_pending();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Connection {
+        bool seqpacket = false;
+        RingBuffer in;
+    };
+
+    // Sequence numbers [start, end) not received yet
+    struct Gap {
+        uint64_t end;
+        Clock::time_point since;
+    };
+
+    struct Stream {
+        uint64_t next_sequence = 0;
+        std::map<uint64_t, Gap> gaps;   // by start
+        Clock::time_point last_seen;
+    };
+
+    struct Source {
+        std::string file;               // what the writer names the logs after
+        std::unordered_map<uint32_t, Stream> streams;
+        std::vector<LogRecord> pending;
+    };
+
+    int bind_inet(int type, const std::string& address, int port) {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+            std::cerr << "Bad listen address: " << address << std::endl;
+            return -1;
+        }
+        int fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            std::cerr << "Socket creation error: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            std::cerr << "Bind error on " << address << ":" << port << ": " << strerror(errno) << std::endl;
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    bool watch(int fd) {
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = fd;
+        return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+
+    void accept_all(int listener) {
+        while (true) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    std::cerr << "Accept error: " << strerror(errno) << std::endl;
+                }
+                return;
+            }
+            if (!watch(fd)) {
+                close(fd);
+                continue;
+            }
+            connections[fd].seqpacket = listener == local_fd;
+        }
+    }
+
+    void drop(int fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections.erase(fd);
+    }
+
+    // Drains a stream or seqpacket connection and takes the complete batches
+    void read_connection(int fd) {
+        auto it = connections.find(fd);
+        if (it == connections.end()) return;
+        Connection& conn = it->second;
+
+        bool keep = true;
+        while (true) {
+            ssize_t n;
+            if (conn.seqpacket) {
+                n = recv(fd, message.data(), message.size(), MSG_TRUNC);
+                if (n > ssize_t(message.size())) {
+                    bad_batches++;
+                    continue;
+                }
+                if (n > 0) conn.in.append(message.data(), size_t(n));
+            } else {
+                auto area = conn.in.write_area(16384);
+                n = recv(fd, area.first, area.second, 0);
+                if (n > 0) conn.in.commit(size_t(n));
+            }
+            if (n > 0) continue;
+            if (n < 0 && errno == EINTR) continue;
+            keep = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+            break;
+        }
+
+        while (conn.in.size() >= 4) {
+            char prefix[4];
+            conn.in.copy_out(0, prefix, 4);
+            size_t length = load_be32(prefix);
+            if (length > LOG_BATCH_MAX) {
+                // Out of step with the stream, nothing after this can be trusted
+                bad_batches++;
+                keep = false;
+                break;
+            }
+            if (conn.in.size() < 4 + length) break;
+            conn.in.copy_out(4, message.data(), length);
+            conn.in.consume(4 + length);
+            take_batch(message.data(), length);
+        }
+        if (!keep) drop(fd);
+    }
+
+    void read_datagrams() {
+        mmsghdr headers[LOG_UDP_BATCH];
+        iovec iov[LOG_UDP_BATCH];
+        while (true) {
+            for (int i = 0; i < LOG_UDP_BATCH; ++i) {
+                iov[i].iov_base = &datagrams[size_t(i) * (LOG_BATCH_MAX + 4)];
+                iov[i].iov_len = LOG_BATCH_MAX + 4;
+                headers[i] = {};
+                headers[i].msg_hdr.msg_iov = &iov[i];
+                headers[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = recvmmsg(udp_fd, headers, LOG_UDP_BATCH, MSG_DONTWAIT, nullptr);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            for (int i = 0; i < n; ++i) {
+                const char* data = static_cast<const char*>(iov[i].iov_base);
+                size_t len = headers[i].msg_len;
+                if (len < 4 || load_be32(data) != len - 4 || (headers[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+                    bad_batches++;
+                    continue;
+                }
+                take_batch(data + 4, len - 4);
+            }
+            if (n < LOG_UDP_BATCH) return;
+        }
+    }
+
+    static std::string source_file_name(std::string_view name) {
+        std::string file = "remote-";
+        file += name.empty() ? "unknown" : name;
+        for (char& c : file) {
+            bool allowed = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                           c == '.' || c == '_' || c == '-';
+            if (!allowed) c = '_';
+        }
+        return file;
+    }
+
+    void take_batch(const char* data, size_t len) {
+        LogBatchHeader header;
+        if (!parse_log_batch(data, len, header)) {
+            bad_batches++;
+            return;
+        }
+        source_key.assign(header.source.data(), header.source.size());
+        auto it = sources.find(source_key);
+        if (it == sources.end()) {
+            it = sources.emplace(source_key, Source()).first;
+            it->second.file = source_file_name(header.source);
+        }
+        Source& source = it->second;
+
+        if (!parse_log_records(header, source.pending)) {
+            bad_batches++;
+            return;
+        }
+        batches++;
+        records += header.count;
+
+        auto found = source.streams.try_emplace(header.stream);
+        Stream& stream = found.first->second;
+        if (found.second) stream.next_sequence = header.sequence;
+        stream.last_seen = round_time;
+
+        uint64_t end = header.sequence + header.count;
+        if (header.sequence > stream.next_sequence) {
+            stream.gaps.emplace(stream.next_sequence, Gap{header.sequence, round_time});
+            if (stream.gaps.size() > LOG_MAX_GAPS) {
+                report_gap(source, stream.gaps.begin()->first, stream.gaps.begin()->second.end);
+                stream.gaps.erase(stream.gaps.begin());
+            }
+        } else if (header.sequence < stream.next_sequence) {
+            late_batches++;
+            fill_gaps(stream, header.sequence, std::min(end, stream.next_sequence));
+        }
+        stream.next_sequence = std::max(stream.next_sequence, end);
+    }
+
+    // Removes [first, last) from the open gaps of the stream
+    static void fill_gaps(Stream& stream, uint64_t first, uint64_t last) {
+        auto it = stream.gaps.upper_bound(first);
+        if (it != stream.gaps.begin()) --it;
+        while (it != stream.gaps.end() && it->first < last) {
+            uint64_t start = it->first;
+            Gap gap = it->second;
+            if (gap.end <= first) {
+                ++it;
+                continue;
+            }
+            it = stream.gaps.erase(it);
+            if (start < first) stream.gaps.emplace(start, Gap{first, gap.since});
+            if (gap.end > last) {
+                stream.gaps.emplace(last, Gap{gap.end, gap.since});
+                break;
+            }
+        }
+    }
+
+    void report_gap(Source& source, uint64_t start, uint64_t end) {
+        lost_records += end - start;
+        LogRecord lost;
+        lost.timestamp_ns = realtime_ns();
+        lost.event_type = "LOG_LOST";
+        lost.data = std::to_string(end - start) + " records lost before sequence " + std::to_string(end);
+        source.pending.push_back(std::move(lost));
+    }
+
+    // Reports the gaps older than the reorder window (all of them if
+    // everything) and forgets idle streams
+    void expire_gaps(Clock::time_point now, bool everything) {
+        for (auto& entry : sources) {
+            Source& source = entry.second;
+            for (auto it = source.streams.begin(); it != source.streams.end();) {
+                Stream& stream = it->second;
+                for (auto gap = stream.gaps.begin(); gap != stream.gaps.end();) {
+                    if (!everything && now - gap->second.since < reorder_window) {
+                        ++gap;
+                        continue;
+                    }
+                    report_gap(source, gap->first, gap->second.end);
+                    gap = stream.gaps.erase(gap);
+                }
+                if (stream.gaps.empty() && now - stream.last_seen >= std::chrono::seconds(LOG_STREAM_IDLE_S)) {
+                    it = source.streams.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+
+    void submit_pending() {
+        for (auto& entry : sources) {
+            if (entry.second.pending.empty()) continue;
+            writer.submit(entry.second.file, entry.second.pending);
+        }
+    }
+
+    void report_stats(double seconds) {
+        std::cout << "Log collector: " << sources.size() << " sources, " << connections.size()
+                  << " connections, " << uint64_t(batches / seconds) << " batches/s, "
+                  << uint64_t(records / seconds) << " records/s, " << lost_records << " lost, " << late_batches
+                  << " late batches, " << bad_batches << " bad" << std::endl;
+        batches = records = 0;
+    }
+
+    ShardedLogWriter& writer;
+    std::chrono::milliseconds reorder_window;
+    Clock::time_point round_time = Clock::now();
+    int epoll_fd;
+    int tcp_fd = -1;
+    int udp_fd = -1;
+    int local_fd = -1;
+    std::unordered_map<int, Connection> connections;
+    std::unordered_map<std::string, Source> sources;
+    std::string source_key;
+    std::vector<char> message;      // one batch taken out of a connection
+    std::vector<char> datagrams;    // LOG_UDP_BATCH receive buffers
+
+    uint64_t batches = 0;
+    uint64_t records = 0;
+    uint64_t lost_records = 0;
+    uint64_t late_batches = 0;
+    uint64_t bad_batches = 0;
+};
@@ -0,0 +1,305 @@
+#pragma once
+
+// Log records over the network, for producers that do not share memory with
+// log_server: other hosts, or more server instances than it has rings for.
+//
+// A producer sends its records in batches:
+//   u32 length         bytes after this field
+//   u32 magic          LOG_BATCH_MAGIC
+//   u32 stream         random per producer run
+//   u16 source length
+//   u16 record count
+//   u64 sequence       number of the first record within the stream
+//   source name
+//   records            u64 timestamp_ns, u32 client_id, u16 event length,
+//                      u16 data length, event type, data
+// all big-endian like protocol.h. On TCP the batches follow each other on
+// the stream; a UDP datagram or a unix SEQPACKET message is exactly one
+// batch. Every record of a stream has the next sequence number, so the
+// collector (log_collector.h) sees a gap wherever records were lost on the
+// way, including those a producer could not send while disconnected. Each
+// stream is numbered on its own, so a restarted producer, or several
+// instances sending under one source name, do not look like lost records.
+//
+// LogShipping runs the producer side in a server: send_log() publishes into
+// a private ring (log_ring.h) and a thread ships it in batches.
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "local_socket.h"
+#include "log_ring.h"
+#include "protocol.h"
+
+const uint32_t LOG_BATCH_MAGIC = 0x4c4f4742;    // "LOGB"
+const size_t LOG_BATCH_HEADER = 24;             // up to the source name
+const size_t LOG_RECORD_HEADER = 16;
+const size_t LOG_BATCH_MAX = 60000;             // fits a UDP datagram
+
+inline void store_be16(char* p, uint16_t v) {
+    p[0] = char(v >> 8);
+    p[1] = char(v);
+}
+
+inline uint16_t load_be16(const char* p) {
+    return uint16_t(uint8_t(p[0]) << 8 | uint8_t(p[1]));
+}
+
+inline void store_be64(char* p, uint64_t v) {
+    store_be32(p, uint32_t(v >> 32));
+    store_be32(p + 4, uint32_t(v));
+}
+
+inline uint64_t load_be64(const char* p) { return uint64_t(load_be32(p)) << 32 | load_be32(p + 4); }
+
+struct LogBatchHeader {
+    uint32_t stream = 0;
+    uint64_t sequence = 0;
+    uint16_t count = 0;
+    std::string_view source;
+    const char* records = nullptr;
+    size_t records_len = 0;
+};
+
+// Checks the header of one batch (the length field already stripped)
+inline bool parse_log_batch(const char* data, size_t len, LogBatchHeader& header) {
+    if (len < LOG_BATCH_HEADER - 4 || load_be32(data) != LOG_BATCH_MAGIC) return false;
+    header.stream = load_be32(data + 4);
+    uint16_t source_len = load_be16(data + 8);
+    header.count = load_be16(data + 10);
+    header.sequence = load_be64(data + 12);
+    if (len < LOG_BATCH_HEADER - 4 + source_len) return false;
+    header.source = std::string_view(data + LOG_BATCH_HEADER - 4, source_len);
+    header.records = header.source.data() + source_len;
+    header.records_len = len - (LOG_BATCH_HEADER - 4) - source_len;
+    return true;
+}
+
+// Appends the records of a batch to out; on a malformed batch out is left
+// as it was and false is returned
+inline bool parse_log_records(const LogBatchHeader& header, std::vector<LogRecord>& out) {
+    size_t first = out.size();
+    const char* p = header.records;
+    const char* end = header.records + header.records_len;
+    for (uint16_t i = 0; i < header.count; ++i) {
+        if (size_t(end - p) < LOG_RECORD_HEADER) break;
+        uint16_t event_len = load_be16(p + 12);
+        uint16_t data_len = load_be16(p + 14);
+        if (size_t(end - p) < LOG_RECORD_HEADER + event_len + data_len) break;
+        out.emplace_back();
+        LogRecord& record = out.back();
+        record.timestamp_ns = load_be64(p);
+        record.client_id = load_be32(p + 8);
+        record.event_type.assign(p + LOG_RECORD_HEADER, event_len);
+        record.data.assign(p + LOG_RECORD_HEADER + event_len, data_len);
+        p += LOG_RECORD_HEADER + event_len + data_len;
+    }
+    if (out.size() - first == header.count && p == end) return true;
+    out.resize(first);
+    return false;
+}
+
+// Producer side: sends records to a collector at
+//   tcp:<host>:<port>, udp:<host>:<port> or unix:<name> (local_socket.h)
+// A failed connection is retried at most once a second; records submitted
+// meanwhile are counted as unsent and show up as a gap at the collector.
+class LogShipper {
+public:
+    LogShipper() {
+        std::random_device random;
+        stream = random() | 1;
+    }
+
+    ~LogShipper() {
+        if (fd >= 0) close(fd);
+    }
+
+    LogShipper(const LogShipper&) = delete;
+    LogShipper& operator=(const LogShipper&) = delete;
+
+    bool open(const std::string& target) {
+        size_t colon = target.find(':');
+        if (colon == std::string::npos) return false;
+        std::string scheme = target.substr(0, colon);
+        std::string rest = target.substr(colon + 1);
+
+        if (scheme == "unix") {
+            sockaddr_un local;
+            if (!local_address(rest, local, address_len)) return false;
+            std::memcpy(&address, &local, address_len);
+            type = SOCK_SEQPACKET;
+        } else if (scheme == "tcp" || scheme == "udp") {
+            size_t port_colon = rest.rfind(':');
+            if (port_colon == std::string::npos) return false;
+            type = scheme == "tcp" ? SOCK_STREAM : SOCK_DGRAM;
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = type;
+            addrinfo* result = nullptr;
+            if (getaddrinfo(rest.substr(0, port_colon).c_str(), rest.c_str() + port_colon + 1, &hints, &result) != 0 ||
+                !result) {
+                return false;
+            }
+            std::memcpy(&address, result->ai_addr, result->ai_addrlen);
+            address_len = result->ai_addrlen;
+            freeaddrinfo(result);
+        } else {
+            return false;
+        }
+        connect_target();
+        return true;
+    }
+
+    // Takes the records (the vector is left empty) and sends them in
+    // batches of at most LOG_BATCH_MAX bytes
+    void submit(const std::string& source, std::vector<LogRecord>& records) {
+        uint64_t& sequence = sequences[source];
+        size_t first = 0;
+        size_t batch_bytes = LOG_BATCH_HEADER + source.size();
+        for (size_t i = 0; i < records.size(); ++i) {
+            size_t record_bytes = record_size(records[i]);
+            if (i > first && (batch_bytes + record_bytes > LOG_BATCH_MAX || i - first == UINT16_MAX)) {
+                send_batch(source, sequence, records, first, i);
+                sequence += i - first;
+                first = i;
+                batch_bytes = LOG_BATCH_HEADER + source.size();
+            }
+            batch_bytes += record_bytes;
+        }
+        if (first < records.size()) {
+            send_batch(source, sequence, records, first, records.size());
+            sequence += records.size() - first;
+        }
+        records.clear();
+    }
+
+    uint64_t unsent() const { return unsent_records.load(std::memory_order_relaxed); }
+
+private:
+    static size_t record_size(const LogRecord& record) {
+        return LOG_RECORD_HEADER + std::min<size_t>(record.event_type.size(), UINT16_MAX) +
+               std::min<size_t>(record.data.size(), UINT16_MAX);
+    }
+
+    bool connect_target() {
+        auto now = std::chrono::steady_clock::now();
+        if (now < next_attempt) return false;
+        next_attempt = now + std::chrono::seconds(1);
+
+        fd = socket(address.ss_family, type | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+        // A stalled collector must not hold the ring's reader for long
+        timeval timeout{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (type == SOCK_STREAM) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        if (connect(fd, (sockaddr*)&address, address_len) < 0) {
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    void send_batch(const std::string& source, uint64_t sequence, const std::vector<LogRecord>& records,
+                    size_t first, size_t last) {
+        if (fd < 0 && !connect_target()) {
+            unsent_records.fetch_add(last - first, std::memory_order_relaxed);
+            return;
+        }
+
+        buffer.resize(LOG_BATCH_HEADER);
+        store_be32(&buffer[4], LOG_BATCH_MAGIC);
+        store_be32(&buffer[8], stream);
+        store_be16(&buffer[12], uint16_t(source.size()));
+        store_be16(&buffer[14], uint16_t(last - first));
+        store_be64(&buffer[16], sequence);
+        buffer += source;
+        for (size_t i = first; i < last; ++i) {
+            const LogRecord& record = records[i];
+            size_t event_len = std::min<size_t>(record.event_type.size(), UINT16_MAX);
+            size_t data_len = std::min<size_t>(record.data.size(), UINT16_MAX);
+            size_t at = buffer.size();
+            buffer.resize(at + LOG_RECORD_HEADER);
+            store_be64(&buffer[at], record.timestamp_ns);
+            store_be32(&buffer[at + 8], record.client_id);
+            store_be16(&buffer[at + 12], uint16_t(event_len));
+            store_be16(&buffer[at + 14], uint16_t(data_len));
+            buffer.append(record.event_type, 0, event_len);
+            buffer.append(record.data, 0, data_len);
+        }
+        store_be32(&buffer[0], uint32_t(buffer.size() - 4));
+
+        size_t offset = 0;
+        while (offset < buffer.size()) {
+            ssize_t sent = send(fd, buffer.data() + offset, buffer.size() - offset, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent < 0 && type == SOCK_DGRAM) {
+                // Nobody listening yet; the datagram is lost either way
+                unsent_records.fetch_add(last - first, std::memory_order_relaxed);
+                return;
+            }
+            if (sent <= 0) {
+                // Part of a batch on a stream cannot be resumed, start over
+                close(fd);
+                fd = -1;
+                unsent_records.fetch_add(last - first, std::memory_order_relaxed);
+                return;
+            }
+            offset += size_t(sent);
+        }
+    }
+
+    uint32_t stream;
+    int type = SOCK_STREAM;
+    sockaddr_storage address{};
+    socklen_t address_len = 0;
+    int fd = -1;
+    std::chrono::steady_clock::time_point next_attempt;
+    std::map<std::string, uint64_t> sequences;
+    std::string buffer;
+    std::atomic<uint64_t> unsent_records{0};
+};
+
+// Ships what a server publishes through its LogProducer to a collector
+// instead of the local log_server's shared ring.
+class LogShipping {
+public:
+    ~LogShipping() { stop(); }
+
+    bool start(const std::string& target, const std::string& source, LogProducer& producer) {
+        if (!shipper.open(target) || !ring.open_private()) return false;
+        producer.redirect(ring.ring());
+        worker = std::thread([this, source] { pump_log_ring(ring, source, shipper, running); });
+        return true;
+    }
+
+    void stop() {
+        if (!worker.joinable()) return;
+        running = false;
+        worker.join();
+    }
+
+private:
+    LogConsumer ring;
+    LogShipper shipper;
+    std::atomic<bool> running{true};
+    std::thread worker;
+};
@@ -0,0 +1,354 @@
+#pragma once
+
+// Shared-memory log transport between the servers and log_server.
+//
+// Each server owns one POSIX shared memory ring ("/server1_log", ...)
+// created by log_server. The ring is a bounded multi-producer queue of
+// fixed-size slots (per-slot sequence numbers, no locks): producers claim a
+// slot with one CAS and publish it with a release store, so logging costs
+// no system calls unless the consumer is asleep. A full ring drops the
+// record and bumps a counter instead of blocking the request path.
+//
+// The consumer sleeps on a futex word inside the mapping; producers only
+// call futex(FUTEX_WAKE) when that word says the consumer is waiting.
+//
+// A producer that dies (or is stopped) between claiming a slot and
+// publishing it holds up every record behind it. The slot cannot be taken
+// back: a producer that resumes would write into it while the next lap
+// uses it. A slot that stays claimed for LOG_STALE_SLOT_MS is counted as
+// stalled instead, so the stall shows up in LOG_DROPPED and the metrics.
+//
+// A process that writes its own logs (the unified server) or ships them to
+// a remote log_server (log_net.h) uses the same ring in private anonymous
+// memory instead of a shared memory object.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+const char* const SERVER1_LOG_RING = "/server1_log";
+const char* const SERVER2_LOG_RING = "/server2_log";
+
+const uint64_t LOG_RING_MAGIC = 0x4c4f4752494e4733ULL;  // "LOGRING3"
+const uint32_t LOG_RING_SLOTS = 4096;                    // power of two
+const size_t LOG_SLOT_TEXT = 232;
+const int LOG_STALE_SLOT_MS = 1000;
+
+struct LogSlot {
+    std::atomic<uint64_t> sequence;
+    uint64_t timestamp_ns;
+    uint32_t client_id;         // connection the event belongs to, 0 - none
+    uint16_t event_len;
+    uint16_t data_len;
+    char text[LOG_SLOT_TEXT];   // event type immediately followed by data
+};
+
+static_assert(sizeof(LogSlot) == 256, "log slot layout changed");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared atomics must be lock-free");
+
+struct LogRingHeader {
+    std::atomic<uint64_t> magic;
+    uint32_t slots;
+    alignas(64) std::atomic<uint64_t> enqueue_pos;
+    alignas(64) std::atomic<uint64_t> dequeue_pos;
+    alignas(64) std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> truncated;
+    std::atomic<uint64_t> stale;            // slots left claimed for LOG_STALE_SLOT_MS
+    alignas(64) std::atomic<uint32_t> consumer_waiting;   // futex word
+    alignas(64) LogSlot ring[LOG_RING_SLOTS];
+};
+
+struct LogRecord {
+    uint64_t timestamp_ns = 0;
+    uint32_t client_id = 0;
+    std::string event_type;
+    std::string data;
+};
+
+inline uint64_t realtime_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+inline LogRingHeader* map_log_ring(const char* name, bool create) {
+    int fd = shm_open(name, create ? (O_CREAT | O_RDWR) : O_RDWR, 0666);
+    if (fd == -1) return nullptr;
+    if (create && ftruncate(fd, sizeof(LogRingHeader)) == -1) {
+        close(fd);
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || size_t(st.st_size) < sizeof(LogRingHeader)) {
+        close(fd);
+        return nullptr;
+    }
+
+    void* mem = mmap(nullptr, sizeof(LogRingHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) return nullptr;
+    return static_cast<LogRingHeader*>(mem);
+}
+
+// Producer side, used by the servers. Attaches lazily (log_server may start
+// later) and retries at most once per second while the ring is missing.
+class LogProducer {
+public:
+    explicit LogProducer(const char* name) : name(name) {}
+
+    // Already attached to an in-process ring (LogConsumer::open_private)
+    explicit LogProducer(LogRingHeader* ring) : name(nullptr), mapped(ring) {}
+
+    bool publish(const char* event_type, size_t event_len, const char* data, size_t data_len,
+                 uint32_t client_id = 0) {
+        LogRingHeader* header = attach();
+        if (!header) return false;
+
+        if (event_len > LOG_SLOT_TEXT) event_len = LOG_SLOT_TEXT;
+        if (data_len > LOG_SLOT_TEXT - event_len) {
+            data_len = LOG_SLOT_TEXT - event_len;
+            header->truncated.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        const uint64_t mask = header->slots - 1;
+        uint64_t pos = header->enqueue_pos.load(std::memory_order_relaxed);
+        LogSlot* slot;
+        while (true) {
+            slot = &header->ring[pos & mask];
+            uint64_t seq = slot->sequence.load(std::memory_order_acquire);
+            int64_t diff = int64_t(seq) - int64_t(pos);
+            if (diff == 0) {
+                if (header->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                header->dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = header->enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->timestamp_ns = realtime_ns();
+        slot->client_id = client_id;
+        slot->event_len = uint16_t(event_len);
+        slot->data_len = uint16_t(data_len);
+        std::memcpy(slot->text, event_type, event_len);
+        std::memcpy(slot->text + event_len, data, data_len);
+        slot->sequence.store(pos + 1, std::memory_order_seq_cst);
+
+        if (header->consumer_waiting.load(std::memory_order_seq_cst)) {
+            header->consumer_waiting.store(0, std::memory_order_relaxed);
+            syscall(SYS_futex, &header->consumer_waiting, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+        }
+        return true;
+    }
+
+    bool publish(std::string_view event_type, std::string_view data, uint32_t client_id = 0) {
+        return publish(event_type.data(), event_type.size(), data.data(), data.size(), client_id);
+    }
+
+    // Publishes into ring from now on instead of the named one (a ring the
+    // process drains itself, see LogShipping in log_net.h)
+    void redirect(LogRingHeader* ring) { mapped.store(ring, std::memory_order_release); }
+
+private:
+    LogRingHeader* attach() {
+        LogRingHeader* header = mapped.load(std::memory_order_acquire);
+        if (header) return header;
+
+        int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+        int64_t next = next_attempt.load(std::memory_order_relaxed);
+        if (now < next) return nullptr;
+
+        std::lock_guard<std::mutex> lock(attach_mtx);
+        header = mapped.load(std::memory_order_acquire);
+        if (header) return header;
+        next_attempt.store(now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                               std::chrono::seconds(1)).count(), std::memory_order_relaxed);
+
+        if (!name) return nullptr;
+        header = map_log_ring(name, false);
+        if (!header) return nullptr;
+        if (header->magic.load(std::memory_order_acquire) != LOG_RING_MAGIC ||
+            header->slots != LOG_RING_SLOTS) {
+            munmap(header, sizeof(LogRingHeader));
+            return nullptr;
+        }
+        mapped.store(header, std::memory_order_release);
+        return header;
+    }
+
+    const char* name;
+    std::atomic<LogRingHeader*> mapped{nullptr};
+    std::atomic<int64_t> next_attempt{0};
+    std::mutex attach_mtx;
+};
+
+// Consumer side, used by log_server (one consumer per ring). The shared
+// memory object is kept across restarts so attached servers keep logging;
+// an existing ring with a matching layout is reused as is.
+class LogConsumer {
+public:
+    bool open(const char* name) {
+        header = map_log_ring(name, true);
+        if (!header) return false;
+
+        if (header->magic.load(std::memory_order_acquire) != LOG_RING_MAGIC ||
+            header->slots != LOG_RING_SLOTS) {
+            reset();
+        }
+        return true;
+    }
+
+    // A ring visible to this process only; producers attach with ring().
+    // The consumer must outlive them.
+    bool open_private() {
+        void* mem = mmap(nullptr, sizeof(LogRingHeader), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) return false;
+        header = static_cast<LogRingHeader*>(mem);
+        reset();
+        return true;
+    }
+
+    LogRingHeader* ring() const { return header; }
+
+    ~LogConsumer() {
+        if (header) munmap(header, sizeof(LogRingHeader));
+    }
+
+    bool pop(LogRecord& record) {
+        uint64_t pos = header->dequeue_pos.load(std::memory_order_relaxed);
+        LogSlot* slot = &header->ring[pos & (header->slots - 1)];
+        if (slot->sequence.load(std::memory_order_acquire) != pos + 1) {
+            note_stall(pos, *slot);
+            return false;
+        }
+        stalled_pos = UINT64_MAX;
+
+        record.timestamp_ns = slot->timestamp_ns;
+        record.client_id = slot->client_id;
+        record.event_type.assign(slot->text, slot->event_len);
+        record.data.assign(slot->text + slot->event_len, slot->data_len);
+
+        slot->sequence.store(pos + header->slots, std::memory_order_release);
+        header->dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Sleeps until a producer publishes or the timeout expires.
+    void wait(int timeout_ms) {
+        header->consumer_waiting.store(1, std::memory_order_seq_cst);
+        uint64_t pos = header->dequeue_pos.load(std::memory_order_relaxed);
+        if (header->ring[pos & (header->slots - 1)].sequence.load(std::memory_order_seq_cst) == pos + 1) {
+            header->consumer_waiting.store(0, std::memory_order_relaxed);
+            return;
+        }
+        timespec timeout{timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+        syscall(SYS_futex, &header->consumer_waiting, FUTEX_WAIT, 1, &timeout, nullptr, 0);
+        header->consumer_waiting.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t dropped() const { return header->dropped.load(std::memory_order_relaxed); }
+    uint64_t truncated() const { return header->truncated.load(std::memory_order_relaxed); }
+    uint64_t stale() const { return header->stale.load(std::memory_order_relaxed); }
+
+private:
+    // Called while the slot at pos is not published. Counts it once when
+    // it has been claimed but unpublished for LOG_STALE_SLOT_MS.
+    void note_stall(uint64_t pos, const LogSlot& slot) {
+        if (slot.sequence.load(std::memory_order_relaxed) != pos ||
+            header->enqueue_pos.load(std::memory_order_relaxed) <= pos) {
+            return;     // nothing claimed there yet
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (pos != stalled_pos) {
+            stalled_pos = pos;
+            stalled_since = now;
+            stall_counted = false;
+            return;
+        }
+        if (!stall_counted && now - stalled_since >= std::chrono::milliseconds(LOG_STALE_SLOT_MS)) {
+            header->stale.fetch_add(1, std::memory_order_relaxed);
+            stall_counted = true;
+        }
+    }
+
+    void reset() {
+        header->slots = LOG_RING_SLOTS;
+        header->enqueue_pos.store(0);
+        header->dequeue_pos.store(0);
+        header->dropped.store(0);
+        header->truncated.store(0);
+        header->stale.store(0);
+        header->consumer_waiting.store(0);
+        for (uint32_t i = 0; i < LOG_RING_SLOTS; ++i) {
+            header->ring[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        header->magic.store(LOG_RING_MAGIC, std::memory_order_release);
+    }
+
+    LogRingHeader* header = nullptr;
+    uint64_t stalled_pos = UINT64_MAX;      // unpublished slot the consumer waits on
+    std::chrono::steady_clock::time_point stalled_since;
+    bool stall_counted = false;
+};
+
+const size_t MAX_LOG_BATCH = 4096;
+
+// Moves records from a log ring to a sink (LogWriter, LogShipper) in
+// batches until running is cleared. Records the ring had to drop or cut
+// short and slots a stalled producer holds are reported as one LOG_DROPPED
+// event per batch.
+template <typename Sink>
+void pump_log_ring(LogConsumer& consumer, const std::string& source, Sink& writer,
+                   const std::atomic<bool>& running) {
+    std::vector<LogRecord> batch;
+    LogRecord record;
+    uint64_t reported_drops = consumer.dropped();
+    uint64_t reported_truncated = consumer.truncated();
+    uint64_t reported_stale = consumer.stale();
+    while (running) {
+        while (batch.size() < MAX_LOG_BATCH && consumer.pop(record)) {
+            batch.push_back(std::move(record));
+        }
+
+        uint64_t drops = consumer.dropped();
+        uint64_t truncated = consumer.truncated();
+        uint64_t stale = consumer.stale();
+        if (drops != reported_drops || truncated != reported_truncated || stale != reported_stale) {
+            LogRecord dropped;
+            dropped.timestamp_ns = realtime_ns();
+            dropped.event_type = "LOG_DROPPED";
+            dropped.data = std::to_string(drops - reported_drops) + " records dropped, ring full, " +
+                           std::to_string(truncated - reported_truncated) + " truncated, " +
+                           std::to_string(stale - reported_stale) + " slots stalled by a producer";
+            batch.push_back(std::move(dropped));
+            reported_drops = drops;
+            reported_truncated = truncated;
+            reported_stale = stale;
+        }
+
+        if (batch.empty()) {
+            consumer.wait(100);
+            continue;
+        }
+        writer.submit(source, batch);
+    }
+
+    // Whatever was published before the stop still goes to disk
+    while (consumer.pop(record)) batch.push_back(std::move(record));
+    writer.submit(source, batch);
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+// Background stage for rotated log segments.
+//
+// When LogWriter rotates a log it only renames the file and opens a new one;
+// the closed segment is queued here. A separate low-priority thread gzips
+// text segments (zlib, configurable level) into <segment>.log.gz, removes
+// the plain file and appends one line per segment to
+// logs/<source>.segments:
+//   <first_ns> <last_ns> <records> <file name>
+// so a shipper or a query tool can pick the files covering a time range
+// without opening them. first_ns is 0 for a segment that continued a log
+// left by an earlier run. Binary segments are indexed but left uncompressed,
+// logquery maps them directly. The writer never waits for this thread.
+//
+// Programs that include this (through log_writer.h) link with -lz.
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <zlib.h>
+
+struct LogSegment {
+    std::string source;
+    std::string path;           // renamed segment file
+    uint64_t first_ns = 0;      // time range of its records (0: unknown start)
+    uint64_t last_ns = 0;
+    uint64_t records = 0;
+    bool compress = true;
+};
+
+class LogCompressor {
+public:
+    // level: 0 keeps segments as they are, 1..9 is the gzip level
+    LogCompressor(std::string directory, int level)
+        : directory(std::move(directory)), level(level < 0 ? 0 : level > 9 ? 9 : level) {
+        worker = std::thread(&LogCompressor::run, this);
+    }
+
+    ~LogCompressor() { stop(); }
+
+    void submit(LogSegment segment) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            queue.push_back(std::move(segment));
+        }
+        cv.notify_one();
+    }
+
+    // Finishes the queued segments
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (stopping) return;
+            stopping = true;
+        }
+        cv.notify_one();
+        worker.join();
+    }
+
+private:
+    void run() {
+        // Compression must not compete with the writer and the servers
+        setpriority(PRIO_PROCESS, pid_t(syscall(SYS_gettid)), 10);
+
+        while (true) {
+            LogSegment segment;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this] { return !queue.empty() || stopping; });
+                if (queue.empty()) return;
+                segment = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            std::string path = segment.path;
+            if (segment.compress && level > 0) {
+                std::string compressed = path + ".gz";
+                if (gzip_file(path, compressed)) {
+                    unlink(path.c_str());
+                    path = compressed;
+                }
+            }
+            append_index(segment, path);
+        }
+    }
+
+    // Writes path.gz.tmp and renames it, so a .gz file is always complete
+    bool gzip_file(const std::string& path, const std::string& compressed) {
+        int in = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in == -1) {
+            std::cerr << "Error opening log segment " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        std::string temp = compressed + ".tmp";
+        char mode[] = {'w', 'b', char('0' + level), '\0'};
+        gzFile out = gzopen(temp.c_str(), mode);
+        if (!out) {
+            std::cerr << "Error creating " << temp << std::endl;
+            close(in);
+            return false;
+        }
+
+        bool ok = true;
+        char buf[1 << 16];
+        ssize_t n;
+        while ((n = read(in, buf, sizeof(buf))) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                ok = false;
+                break;
+            }
+            if (gzwrite(out, buf, unsigned(n)) != int(n)) {
+                ok = false;
+                break;
+            }
+        }
+        close(in);
+        if (gzclose(out) != Z_OK) ok = false;
+        if (!ok || rename(temp.c_str(), compressed.c_str()) != 0) {
+            std::cerr << "Error compressing log segment " << path << std::endl;
+            unlink(temp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void append_index(const LogSegment& segment, const std::string& path) {
+        std::string index_path = directory + "/" + segment.source + ".segments";
+        int fd = open(index_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            std::cerr << "Error opening " << index_path << ": " << strerror(errno) << std::endl;
+            return;
+        }
+        size_t slash = path.find_last_of('/');
+        std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+        char line[512];
+        int len = std::snprintf(line, sizeof(line), "%llu %llu %llu %s\n",
+                                (unsigned long long)segment.first_ns, (unsigned long long)segment.last_ns,
+                                (unsigned long long)segment.records, name.c_str());
+        // One write per line, so a reader never sees half of one
+        ssize_t ignored = write(fd, line, size_t(len) < sizeof(line) ? size_t(len) : sizeof(line) - 1);
+        (void)ignored;
+        close(fd);
+    }
+
+    std::string directory;
+    int level;
+    std::thread worker;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<LogSegment> queue;
+    bool stopping = false;
+};
@@ -1,67 +1,43 @@
+// Log server: drains the shared memory rings of server1 and server2
+// (log_ring.h) and the batches of remote producers (log_collector.h) into
+// logs/, rotating and compressing old segments (log_rotation.h).
+//
+//   g++ -std=c++17 -O2 -o log_server log_server.cpp -lz -pthread
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <ctime>
 #include <cstring>
+#include <cstdlib>
 #include <thread>
-#include <mutex>
+#include <vector>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <csignal>
+#include <atomic>
+#include <algorithm>
+#include "log_collector.h"
+#include "log_ring.h"
+#include "log_writer.h"
 
-std::mutex log_mutex;
-const char* SERVER1_FIFO = "/tmp/server1_log.fifo";
-const char* SERVER2_FIFO = "/tmp/server2_log.fifo";
-volatile sig_atomic_t running = 1;
+std::atomic<bool> running{true};
 
-void create_fifo(const char* path) {
-    if (mkfifo(path, 0666) == -1 && errno != EEXIST) {
-        std::cerr << "Error creating FIFO: " << strerror(errno) << std::endl;
-        exit(EXIT_FAILURE);
-    }
+int env_int(const char* name, int default_value) {
+    const char* value = std::getenv(name);
+    if (!value || !*value) return default_value;
+    return std::atoi(value);
 }
 
-void log_event(const std::string& server_id, const std::string& event_type, const std::string& data) {
-    std::lock_guard<std::mutex> lock(log_mutex);
-    std::ofstream log_file("logs/" + server_id + ".log", std::ios::app);
-    if (!log_file) {
-        std::cerr << "Error opening log file for " << server_id << std::endl;
+void handle_ring(const char* ring_name, const std::string& server_id, ShardedLogWriter& writer) {
+    LogConsumer consumer;
+    if (!consumer.open(ring_name)) {
+        std::cerr << "Error opening log ring " << ring_name << ": " << strerror(errno) << std::endl;
         return;
     }
-    std::time_t now = std::time(nullptr);
-    char timestamp[20];
-    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
-    log_file << "[" << timestamp << "] [" << event_type << "] " << data << std::endl;
-}
-
-void handle_fifo(const char* fifo_path, const std::string& server_id) {
-    char buffer[1024];
-    
-    while (running) {
-        int fd = open(fifo_path, O_RDONLY);
-        if (fd == -1) {
-            if (running) std::cerr << "Error opening FIFO: " << strerror(errno) << std::endl;
-            sleep(1);
-            continue;
-        }
-
-        ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
-        if (bytes_read > 0) {
-            std::string message(buffer, bytes_read);
-            size_t delim = message.find('|');
-            if (delim != std::string::npos) {
-                std::string event_type = message.substr(0, delim);
-                std::string data = message.substr(delim + 1);
-                log_event(server_id, event_type, data);
-            }
-        }
-        close(fd);
-    }
+    pump_log_ring(consumer, server_id, writer, running);
 }
 
 void sig_handler(int) {
-    running = 0;
+    running = false;
 }
 
 int main() {
@@ -69,18 +45,67 @@ int main() {
     std::signal(SIGTERM, sig_handler);
     
     mkdir("logs", 0777);
-    create_fifo(SERVER1_FIFO);
-    create_fifo(SERVER2_FIFO);
 
-    std::thread server1_thread(handle_fifo, SERVER1_FIFO, "server1");
-    std::thread server2_thread(handle_fifo, SERVER2_FIFO, "server2");
+    // LOG_FLUSH_BYTES / LOG_FLUSH_MS - group commit thresholds,
+    // LOG_FSYNC=never|interval|always, LOG_FORMAT=text|binary|both,
+    // LOG_STATS_S - report period (0 - off),
+    // LOG_ROTATE_MB / LOG_ROTATE_S - rotate a log at this size / age (0 - off),
+    // LOG_COMPRESS - gzip level of rotated logs (0 - keep plain),
+    // LOG_MAX_PENDING - records queued per writer before the rings and the
+    // collector are held back
+    LogWriterOptions options;
+    options.flush_bytes = env_int("LOG_FLUSH_BYTES", options.flush_bytes);
+    options.flush_interval_ms = env_int("LOG_FLUSH_MS", options.flush_interval_ms);
+    options.fsync = parse_fsync_policy(std::getenv("LOG_FSYNC"));
+    options.format = parse_log_format(std::getenv("LOG_FORMAT"));
+    options.fsync_interval_ms = env_int("LOG_FSYNC_MS", options.fsync_interval_ms);
+    options.stats_interval_s = env_int("LOG_STATS_S", options.stats_interval_s);
+    options.rotate_bytes = uint64_t(env_int("LOG_ROTATE_MB", int(options.rotate_bytes >> 20))) << 20;
+    options.rotate_interval_s = env_int("LOG_ROTATE_S", options.rotate_interval_s);
+    options.compress_level = env_int("LOG_COMPRESS", options.compress_level);
+    options.max_pending = size_t(std::max(1, env_int("LOG_MAX_PENDING", int(options.max_pending))));
+
+    // LOG_SHARDS - writer threads, the sources are spread over them
+    int shards = env_int("LOG_SHARDS", int(std::max(1u, std::thread::hardware_concurrency())));
+    ShardedLogWriter writer(options, size_t(std::max(1, shards)));
+
+    // Local servers publish into shared memory rings
+    std::thread server1_thread(handle_ring, SERVER1_LOG_RING, "server1", std::ref(writer));
+    std::thread server2_thread(handle_ring, SERVER2_LOG_RING, "server2", std::ref(writer));
+
+    // Remote and additional producers (LOG_COLLECTOR of a server) send batches:
+    // LOG_TCP_PORT / LOG_UDP_PORT - 0 disables,
+    // LOG_BIND - address they listen on, loopback only by default (producers
+    //   are not authenticated, widen it only on a trusted network),
+    // LOG_SOCKET - unix socket ("@name" abstract, "" disables),
+    // LOG_REORDER_MS - how long a sequence gap waits for late batches
+    //   before it is logged as LOG_LOST
+    int tcp_port = env_int("LOG_TCP_PORT", 9200);
+    int udp_port = env_int("LOG_UDP_PORT", 9200);
+    const char* bind_env = std::getenv("LOG_BIND");
+    std::string bind_address = bind_env && *bind_env ? bind_env : "127.0.0.1";
+    std::string local_socket = local_socket_name("LOG_SOCKET", LOG_SERVER_SOCKET);
+    LogCollector collector(writer, env_int("LOG_REORDER_MS", 2000));
+    bool listening = (tcp_port <= 0 || collector.listen_tcp(bind_address, tcp_port, SOMAXCONN)) &&
+                     (udp_port <= 0 || collector.listen_udp(bind_address, udp_port)) &&
+                     (local_socket.empty() || collector.listen_local(local_socket, SOMAXCONN));
+    if (!listening) {
+        running = false;
+        server1_thread.join();
+        server2_thread.join();
+        writer.stop();
+        return 1;
+    }
+
+    std::cout << "Log server started (Ctrl+C to exit), " << writer.size() << " writer shards, TCP "
+              << bind_address << ":" << tcp_port << ", UDP " << bind_address << ":" << udp_port << ", "
+              << (local_socket.empty() ? "no unix socket" : local_socket) << std::endl;
+
+    collector.run(running, options.stats_interval_s);
 
-    std::cout << "Log server started (Ctrl+C to exit)" << std::endl;
-    
     server1_thread.join();
     server2_thread.join();
+    writer.stop();
 
-    unlink(SERVER1_FIFO);
-    unlink(SERVER2_FIFO);
     return 0;
 }
@@ -0,0 +1,438 @@
+#pragma once
+
+// Batched log writer used by log_server and the unified server.
+//
+// Producers hand over whole batches of records; a single writer thread
+// formats them into per-file buffers, keeps the log files open and writes
+// a buffer out once it reaches flush_bytes or flush_interval_ms has passed
+// since the last flush (group commit). fdatasync is issued according to
+// the fsync policy. Records go to the text log, the binary log (binlog.h)
+// or both, depending on the configured format.
+//
+// A log is rotated once it reaches rotate_bytes or has been written for
+// rotate_interval_s: the writer renames the files to
+// <source>.<YYYYmmdd-HHMMSS>.<n> (time of the first record) and opens new
+// ones, which takes a couple of metadata operations between two flushes.
+// Compression and the segment index are left to LogCompressor
+// (log_rotation.h), so records keep flowing while a segment is packed.
+//
+// At most max_pending records wait for the writer thread; submit() blocks
+// above that. A disk slower than the producers then stalls the ring
+// consumer (pump_log_ring) or the collector instead of growing the heap,
+// and the ring's drop counter or the network producers' sequence gaps
+// account for what is lost.
+//
+// log_server runs several writers (ShardedLogWriter), each owning the
+// files of some of the sources.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include "log_ring.h"
+#include "log_rotation.h"
+#include "binlog.h"
+
+enum class FsyncPolicy { Never, Interval, Always };
+
+enum class LogFormat { Text, Binary, Both };
+
+struct LogWriterOptions {
+    std::string name = "Log writer";    // in throughput reports
+    std::string directory = "logs";
+    size_t flush_bytes = 1 << 20;
+    int flush_interval_ms = 200;
+    FsyncPolicy fsync = FsyncPolicy::Never;
+    LogFormat format = LogFormat::Text;
+    int fsync_interval_ms = 1000;   // used by FsyncPolicy::Interval
+    int stats_interval_s = 10;      // 0 disables throughput reports
+    uint64_t rotate_bytes = 64ULL << 20;    // 0 disables size based rotation
+    int rotate_interval_s = 0;              // 0 disables time based rotation
+    int compress_level = 6;                 // gzip level of rotated text logs, 0 - keep plain
+    size_t max_pending = 65536;             // records queued for the writer thread before submit() blocks
+};
+
+inline FsyncPolicy parse_fsync_policy(const char* value) {
+    if (!value) return FsyncPolicy::Never;
+    if (std::strcmp(value, "always") == 0) return FsyncPolicy::Always;
+    if (std::strcmp(value, "interval") == 0) return FsyncPolicy::Interval;
+    return FsyncPolicy::Never;
+}
+
+inline LogFormat parse_log_format(const char* value) {
+    if (!value) return LogFormat::Text;
+    if (std::strcmp(value, "binary") == 0) return LogFormat::Binary;
+    if (std::strcmp(value, "both") == 0) return LogFormat::Both;
+    return LogFormat::Text;
+}
+
+class LogWriter {
+public:
+    explicit LogWriter(LogWriterOptions options)
+        : options(std::move(options)), compressor(this->options.directory, this->options.compress_level) {
+        writer = std::thread(&LogWriter::run, this);
+    }
+
+    ~LogWriter() { stop(); }
+
+    // Takes ownership of the records; the vector is left empty. Waits while
+    // max_pending records are already queued.
+    void submit(const std::string& source, std::vector<LogRecord>& records) {
+        if (records.empty()) return;
+        size_t count = records.size();
+        {
+            std::unique_lock<std::mutex> lock(queue_mtx);
+            space_cv.wait(lock, [this] { return pending_records < options.max_pending || stopping; });
+            Batch& batch = pending[source];
+            if (batch.empty()) {
+                batch.swap(records);
+            } else {
+                for (auto& record : records) batch.push_back(std::move(record));
+            }
+            pending_records += count;
+        }
+        records.clear();
+        queue_cv.notify_one();
+    }
+
+    // Writes everything submitted so far and closes the files.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mtx);
+            if (stopping) return;
+            stopping = true;
+        }
+        queue_cv.notify_one();
+        space_cv.notify_all();
+        writer.join();
+        compressor.stop();
+    }
+
+private:
+    using Batch = std::vector<LogRecord>;
+    using Clock = std::chrono::steady_clock;
+
+    struct OpenFile {
+        bool opened = false;
+        std::string source;
+        int fd = -1;
+        std::string buffer;
+        std::unique_ptr<BinlogSink> binlog;
+        uint8_t server_id = 0;
+        Clock::time_point last_flush = Clock::now();
+        Clock::time_point last_sync = Clock::now();
+
+        // Current segment
+        uint64_t segment_bytes = 0;
+        Clock::time_point segment_start = Clock::now();
+        uint64_t first_ns = 0;
+        uint64_t last_ns = 0;
+        uint64_t segment_records = 0;
+        unsigned segment_number = 0;
+        bool inherited = false;     // continues a log of an earlier run, first_ns unknown
+    };
+
+    OpenFile& file_for(const std::string& source) {
+        OpenFile& file = files[source];
+        if (file.opened) return file;
+        file.opened = true;
+        file.source = source;
+        file.server_id = source_server_id(source);
+        if (options.format != LogFormat::Binary) file.buffer.reserve(options.flush_bytes + 4096);
+        open_files(file);
+        return file;
+    }
+
+    void open_files(OpenFile& file) {
+        std::string base_path = options.directory + "/" + file.source;
+        struct stat st;
+        if (options.format != LogFormat::Binary) {
+            file.fd = open((base_path + ".log").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (file.fd == -1) {
+                std::cerr << "Error opening log file for " << file.source << ": " << strerror(errno) << std::endl;
+            } else if (fstat(file.fd, &st) == 0) {
+                file.segment_bytes += st.st_size;
+            }
+        }
+        if (options.format != LogFormat::Text) {
+            file.binlog.reset(new BinlogSink());
+            if (!file.binlog->open(base_path)) {
+                std::cerr << "Error opening binary log for " << file.source << ": " << strerror(errno) << std::endl;
+                file.binlog.reset();
+            } else if (stat((base_path + ".blog").c_str(), &st) == 0) {
+                file.segment_bytes += st.st_size;
+            }
+        }
+        file.segment_start = Clock::now();
+        file.inherited = file.segment_bytes > 0;
+    }
+
+    bool rotation_due(const OpenFile& file, Clock::time_point now) const {
+        if (file.segment_records == 0) return false;
+        if (options.rotate_bytes > 0 && file.segment_bytes >= options.rotate_bytes) return true;
+        return options.rotate_interval_s > 0 &&
+               now - file.segment_start >= std::chrono::seconds(options.rotate_interval_s);
+    }
+
+    // Called right after a flush, so nothing of the segment is left in the buffers
+    void rotate(OpenFile& file) {
+        std::time_t first_second = std::time_t((file.inherited ? file.last_ns : file.first_ns) / 1000000000ULL);
+        std::tm tm_buf;
+        localtime_r(&first_second, &tm_buf);
+        char stamp[32];
+        std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm_buf);
+
+        std::string base_path = options.directory + "/" + file.source;
+        std::string segment_path;
+        struct stat st;
+        do {
+            segment_path = base_path + "." + stamp + "." + std::to_string(++file.segment_number);
+        } while (stat((segment_path + ".log").c_str(), &st) == 0 ||
+                 stat((segment_path + ".log.gz").c_str(), &st) == 0 ||
+                 stat((segment_path + ".blog").c_str(), &st) == 0);
+
+        LogSegment segment;
+        segment.source = file.source;
+        segment.first_ns = file.first_ns;
+        segment.last_ns = file.last_ns;
+        segment.records = file.segment_records;
+
+        if (file.fd != -1) {
+            close(file.fd);
+            file.fd = -1;
+            if (rename((base_path + ".log").c_str(), (segment_path + ".log").c_str()) == 0) {
+                segment.path = segment_path + ".log";
+                compressor.submit(segment);
+            }
+        }
+        if (file.binlog) {
+            file.binlog.reset();
+            if (rename((base_path + ".blog").c_str(), (segment_path + ".blog").c_str()) == 0) {
+                rename((base_path + ".bidx").c_str(), (segment_path + ".bidx").c_str());
+                segment.path = segment_path + ".blog";
+                segment.compress = false;
+                compressor.submit(segment);
+            }
+        }
+
+        file.segment_bytes = 0;
+        file.first_ns = file.last_ns = 0;
+        file.segment_records = 0;
+        open_files(file);
+        segments_rotated++;
+    }
+
+    // "[YYYY-mm-dd HH:MM:SS] ", formatted once per second of log time
+    const std::string& timestamp_prefix(uint64_t timestamp_ns) {
+        std::time_t seconds = std::time_t(timestamp_ns / 1000000000ULL);
+        if (seconds != cached_second) {
+            char buf[32];
+            std::tm tm_buf;
+            localtime_r(&seconds, &tm_buf);
+            size_t n = std::strftime(buf, sizeof(buf), "[%Y-%m-%d %H:%M:%S] ", &tm_buf);
+            cached_prefix.assign(buf, n);
+            cached_second = seconds;
+        }
+        return cached_prefix;
+    }
+
+    size_t buffered(const OpenFile& file) const {
+        return file.buffer.size() + (file.binlog ? file.binlog->buffered() : 0);
+    }
+
+    void append_record(OpenFile& file, const LogRecord& record, uint64_t now_ns) {
+        if (file.fd != -1) {
+            file.buffer += timestamp_prefix(record.timestamp_ns);
+            file.buffer += '[';
+            file.buffer += record.event_type;
+            file.buffer += "] ";
+            file.buffer += record.data;
+            file.buffer += '\n';
+        }
+        if (file.binlog) file.binlog->append(file.server_id, record);
+
+        if (!file.inherited && (file.segment_records == 0 || record.timestamp_ns < file.first_ns)) {
+            file.first_ns = record.timestamp_ns;
+        }
+        if (record.timestamp_ns > file.last_ns) file.last_ns = record.timestamp_ns;
+        file.segment_records++;
+
+        if (now_ns > record.timestamp_ns) {
+            uint64_t latency = now_ns - record.timestamp_ns;
+            latency_sum_ns += latency;
+            if (latency > latency_max_ns) latency_max_ns = latency;
+        }
+        lines_written++;
+    }
+
+    void flush(OpenFile& file, bool force_sync) {
+        Clock::time_point now = Clock::now();
+        bool sync = options.fsync != FsyncPolicy::Never &&
+            (force_sync || options.fsync == FsyncPolicy::Always ||
+             now - file.last_sync >= std::chrono::milliseconds(options.fsync_interval_ms));
+
+        if (file.binlog) {
+            size_t written = file.binlog->flush();
+            bytes_written += written;
+            file.segment_bytes += written;
+            if (sync) file.binlog->sync();
+        }
+        if (file.fd != -1) {
+            size_t offset = 0;
+            while (offset < file.buffer.size()) {
+                ssize_t n = write(file.fd, file.buffer.data() + offset, file.buffer.size() - offset);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    std::cerr << "Error writing log file: " << strerror(errno) << std::endl;
+                    break;
+                }
+                offset += n;
+            }
+            bytes_written += offset;
+            file.segment_bytes += offset;
+            if (sync) fdatasync(file.fd);
+        }
+        if (sync) file.last_sync = now;
+        file.buffer.clear();
+        file.last_flush = now;
+
+        if (rotation_due(file, now)) rotate(file);
+    }
+
+    void report_stats(Clock::time_point now) {
+        double seconds = std::chrono::duration<double>(now - stats_start).count();
+        if (seconds <= 0) return;
+        std::cout << options.name << ": " << uint64_t(lines_written / seconds) << " lines/s, "
+                  << uint64_t(bytes_written / seconds / 1024) << " KiB/s, latency avg "
+                  << (lines_written ? latency_sum_ns / lines_written / 1000 : 0) << " us, max "
+                  << latency_max_ns / 1000 << " us";
+        if (segments_rotated > 0) std::cout << ", " << segments_rotated << " segments rotated";
+        std::cout << std::endl;
+        lines_written = bytes_written = latency_sum_ns = latency_max_ns = segments_rotated = 0;
+        stats_start = now;
+    }
+
+    void run() {
+        std::map<std::string, Batch> batches;
+        stats_start = Clock::now();
+        auto interval = std::chrono::milliseconds(options.flush_interval_ms);
+
+        while (true) {
+            bool done;
+            {
+                std::unique_lock<std::mutex> lock(queue_mtx);
+                queue_cv.wait_for(lock, interval, [this] { return pending_records > 0 || stopping; });
+                batches.swap(pending);
+                pending_records = 0;
+                done = stopping;
+            }
+            space_cv.notify_all();
+
+            uint64_t now_ns = realtime_ns();
+            for (auto& entry : batches) {
+                if (entry.second.empty()) continue;
+                OpenFile& file = file_for(entry.first);
+                for (const auto& record : entry.second) {
+                    append_record(file, record, now_ns);
+                    if (buffered(file) >= options.flush_bytes) flush(file, false);
+                }
+                entry.second.clear();
+            }
+
+            Clock::time_point now = Clock::now();
+            for (auto& entry : files) {
+                OpenFile& file = entry.second;
+                if (buffered(file) > 0 && (done || now - file.last_flush >= interval)) {
+                    flush(file, done);
+                }
+            }
+
+            if (options.stats_interval_s > 0 &&
+                now - stats_start >= std::chrono::seconds(options.stats_interval_s) && lines_written > 0) {
+                report_stats(now);
+            }
+
+            if (done) break;
+        }
+
+        for (auto& entry : files) {
+            if (entry.second.fd != -1) close(entry.second.fd);
+        }
+    }
+
+    LogWriterOptions options;
+    LogCompressor compressor;
+    std::thread writer;
+
+    std::mutex queue_mtx;
+    std::condition_variable queue_cv;
+    std::condition_variable space_cv;   // submit() waits here while pending is full
+    std::map<std::string, Batch> pending;
+    size_t pending_records = 0;
+    bool stopping = false;
+
+    // Writer thread only
+    std::map<std::string, OpenFile> files;
+    std::time_t cached_second = -1;
+    std::string cached_prefix;
+    Clock::time_point stats_start;
+    uint64_t lines_written = 0;
+    uint64_t bytes_written = 0;
+    uint64_t latency_sum_ns = 0;
+    uint64_t latency_max_ns = 0;
+    uint64_t segments_rotated = 0;
+};
+
+// Several LogWriters side by side. A source is given to a shard the first
+// time it shows up and stays there, so its records keep their order and no
+// file is shared between writer threads; formatting and writing spread
+// over the shards as sources are added.
+class ShardedLogWriter {
+public:
+    ShardedLogWriter(const LogWriterOptions& options, size_t count) {
+        if (count == 0) count = 1;
+        for (size_t i = 0; i < count; ++i) {
+            LogWriterOptions shard_options = options;
+            if (count > 1) shard_options.name += " " + std::to_string(i);
+            shards.emplace_back(new LogWriter(shard_options));
+        }
+    }
+
+    size_t size() const { return shards.size(); }
+
+    // Same contract as LogWriter::submit, including the wait for space in
+    // the source's shard
+    void submit(const std::string& source, std::vector<LogRecord>& records) {
+        if (records.empty()) return;
+        shard_for(source).submit(source, records);
+    }
+
+    void stop() {
+        for (auto& shard : shards) shard->stop();
+    }
+
+private:
+    LogWriter& shard_for(const std::string& source) {
+        std::lock_guard<std::mutex> lock(assign_mtx);
+        auto it = assigned.find(source);
+        if (it == assigned.end()) it = assigned.emplace(source, assigned.size() % shards.size()).first;
+        return *shards[it->second];
+    }
+
+    std::vector<std::unique_ptr<LogWriter>> shards;
+    std::mutex assign_mtx;
+    std::map<std::string, size_t> assigned;
+};
@@ -0,0 +1,189 @@
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <string>
+#include <cstring>
+#include <ctime>
+#include <cstdlib>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "binlog.h"
+
+// Records are stamped by several producers, so they are only approximately
+// ordered by time; scanning this far past the edges of the range is enough
+// not to miss any of them.
+const uint64_t ORDER_SLACK_NS = 1000000000ULL;
+
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    bool map(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return false;
+        struct stat st;
+        if (fstat(fd, &st) == -1 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void* mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED) return false;
+        data = static_cast<const char*>(mem);
+        size = st.st_size;
+        return true;
+    }
+
+    ~MappedFile() {
+        if (data) munmap(const_cast<char*>(data), size);
+    }
+};
+
+// Accepts "YYYY-mm-dd HH:MM[:SS]" in local time or seconds since the epoch
+bool parse_time(const char* text, uint64_t& timestamp_ns) {
+    std::tm tm_value{};
+    const char* end = strptime(text, "%Y-%m-%d %H:%M:%S", &tm_value);
+    if (!end || *end) {
+        tm_value = std::tm{};
+        end = strptime(text, "%Y-%m-%d %H:%M", &tm_value);
+    }
+    if (end && !*end) {
+        tm_value.tm_isdst = -1;
+        std::time_t seconds = mktime(&tm_value);
+        if (seconds == -1) return false;
+        timestamp_ns = uint64_t(seconds) * 1000000000ULL;
+        return true;
+    }
+
+    char* num_end = nullptr;
+    unsigned long long seconds = std::strtoull(text, &num_end, 10);
+    if (num_end == text || *num_end) return false;
+    timestamp_ns = seconds * 1000000000ULL;
+    return true;
+}
+
+// Offset of the first record that can be at or after from_ns
+uint64_t start_offset(const MappedFile& index, uint64_t from_ns) {
+    uint64_t offset = sizeof(BinlogFileHeader);
+    if (!index.data) return offset;
+
+    const BinlogIndexEntry* entries = reinterpret_cast<const BinlogIndexEntry*>(index.data);
+    size_t count = index.size / sizeof(BinlogIndexEntry);
+    uint64_t target = from_ns > ORDER_SLACK_NS ? from_ns - ORDER_SLACK_NS : 0;
+
+    const BinlogIndexEntry* it = std::upper_bound(entries, entries + count, target,
+        [](uint64_t ts, const BinlogIndexEntry& entry) { return ts < entry.timestamp_ns; });
+    if (it != entries) offset = (it - 1)->offset;
+    return offset;
+}
+
+struct QueryCounts {
+    std::map<uint64_t, uint64_t> per_minute;
+    uint64_t total = 0;
+    uint64_t scanned = 0;
+};
+
+// Counts the matching records of one binary log (a live .blog or a rotated
+// segment) using its .bidx next to it if there is one
+bool scan_log(const std::string& log_path, uint64_t from_ns, uint64_t to_ns, bool all_events, EventType wanted,
+              QueryCounts& counts) {
+    MappedFile log_file;
+    if (!log_file.map(log_path)) {
+        std::cerr << "Error opening " << log_path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (log_file.size < sizeof(BinlogFileHeader) ||
+        std::memcmp(log_file.data, BINLOG_MAGIC, sizeof(BINLOG_MAGIC)) != 0) {
+        std::cerr << log_path << " is not a binary log" << std::endl;
+        return false;
+    }
+
+    MappedFile index_file;
+    std::string index_path = log_path;
+    if (index_path.size() > 5 && index_path.compare(index_path.size() - 5, 5, ".blog") == 0) {
+        index_path.replace(index_path.size() - 5, 5, ".bidx");
+        index_file.map(index_path);
+    }
+
+    uint64_t offset = start_offset(index_file, from_ns);
+    while (offset + sizeof(BinlogRecord) <= log_file.size) {
+        BinlogRecord record;
+        std::memcpy(&record, log_file.data + offset, sizeof(record));
+        if (offset + sizeof(record) + record.payload_len > log_file.size) break;
+        offset += sizeof(record) + record.payload_len;
+        counts.scanned++;
+
+        if (record.timestamp_ns > to_ns + ORDER_SLACK_NS) break;
+        if (record.timestamp_ns < from_ns || record.timestamp_ns >= to_ns) continue;
+        if (!all_events && record.event_type != uint8_t(wanted)) continue;
+
+        counts.per_minute[record.timestamp_ns / 60000000000ULL]++;
+        counts.total++;
+    }
+    return true;
+}
+
+// Rotated binary segments of the log at log_path that can hold records in
+// [from_ns, to_ns), oldest first, from <source>.segments (log_rotation.h)
+std::vector<std::string> rotated_segments(const std::string& log_path, uint64_t from_ns, uint64_t to_ns) {
+    std::vector<std::string> segments;
+    if (log_path.size() <= 5 || log_path.compare(log_path.size() - 5, 5, ".blog") != 0) return segments;
+    std::string base = log_path.substr(0, log_path.size() - 5);
+    size_t slash = base.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "" : base.substr(0, slash + 1);
+
+    std::ifstream index(base + ".segments");
+    uint64_t first_ns, last_ns, records;
+    std::string name;
+    while (index >> first_ns >> last_ns >> records >> name) {
+        // Text segments of the same log are listed there too
+        if (name.size() <= 5 || name.compare(name.size() - 5, 5, ".blog") != 0) continue;
+        // first_ns is 0 when the segment continued an older log
+        if (first_ns > to_ns + ORDER_SLACK_NS || last_ns + ORDER_SLACK_NS < from_ns) continue;
+        segments.push_back(directory + name);
+    }
+    return segments;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <logs/serverN.blog> <from> <to> [EVENT_TYPE]\n"
+                  << "  from/to: \"YYYY-mm-dd HH:MM[:SS]\" (local time) or epoch seconds\n"
+                  << "  EVENT_TYPE: COMMAND (default), CLIENT_CONNECT, EXIT, ... or ALL\n"
+                  << "  Rotated segments listed in logs/serverN.segments are searched too" << std::endl;
+        return 1;
+    }
+
+    std::string log_path = argv[1];
+    uint64_t from_ns, to_ns;
+    if (!parse_time(argv[2], from_ns) || !parse_time(argv[3], to_ns)) {
+        std::cerr << "Invalid time range" << std::endl;
+        return 1;
+    }
+    std::string event_name = argc > 4 ? argv[4] : "COMMAND";
+    bool all_events = event_name == "ALL";
+    EventType wanted = event_type_from_name(event_name);
+
+    QueryCounts counts;
+    std::vector<std::string> segments = rotated_segments(log_path, from_ns, to_ns);
+    for (const auto& segment : segments) {
+        // A segment that was deleted or is unreadable does not hide the rest
+        scan_log(segment, from_ns, to_ns, all_events, wanted, counts);
+    }
+    // Right after a rotation the live log may not have been written yet
+    if (!scan_log(log_path, from_ns, to_ns, all_events, wanted, counts) && segments.empty()) return 1;
+
+    for (const auto& entry : counts.per_minute) {
+        std::time_t minute = std::time_t(entry.first * 60);
+        char buf[32];
+        std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", std::localtime(&minute));
+        std::cout << buf << " " << entry.second << std::endl;
+    }
+    std::cout << "Total " << event_name << ": " << counts.total << " (" << counts.scanned << " records scanned)"
+              << std::endl;
+    return 0;
+}
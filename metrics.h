@@ -0,0 +1,421 @@
+#pragma once
+
+// Runtime metrics for the command servers.
+//
+// Every thread that records gets its own shard, registered once on first
+// use. A shard has exactly one writer, so recording is a plain relaxed
+// load/store of the thread's own counters (no locked instructions, no
+// sharing of cache lines between threads); readers sum the shards. Latency
+// is kept in power-of-two microsecond buckets that map directly onto a
+// Prometheus histogram.
+//
+// Request timestamps are raw TSC reads on x86-64 when the kernel itself
+// keeps time with the TSC (so it is invariant and synchronised across
+// cores), otherwise steady_clock nanoseconds. The registry calibrates the
+// TSC against steady_clock once and converts a latency with one multiply.
+// bench_metrics.cpp measures the per-request cost.
+//
+// The numbers are exposed through the STATS command (text summary) and a
+// Prometheus text endpoint served on a separate port.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <string_view>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+enum class MetricCommand { Memory, MouseKeys, ThreadCount, MoveWindow, Stats, Other, Count };
+
+inline const char* metric_command_name(MetricCommand command) {
+    switch (command) {
+        case MetricCommand::Memory: return "MEMORY";
+        case MetricCommand::MouseKeys: return "MOUSE_KEYS";
+        case MetricCommand::ThreadCount: return "THREAD_COUNT";
+        case MetricCommand::MoveWindow: return "MOVE_WINDOW";
+        case MetricCommand::Stats: return "STATS";
+        default: return "OTHER";
+    }
+}
+
+inline MetricCommand classify_command(std::string_view request) {
+    if (request.substr(0, 6) == "MEMORY") return MetricCommand::Memory;
+    if (request.substr(0, 10) == "MOUSE_KEYS") return MetricCommand::MouseKeys;
+    if (request.substr(0, 12) == "THREAD_COUNT") return MetricCommand::ThreadCount;
+    if (request.substr(0, 11) == "MOVE_WINDOW") return MetricCommand::MoveWindow;
+    if (request == "STATS") return MetricCommand::Stats;
+    return MetricCommand::Other;
+}
+
+inline uint64_t steady_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// True if the kernel's clocksource is the TSC. Read once per process.
+inline bool metrics_use_tsc() {
+#if defined(__x86_64__)
+    static const bool use_tsc = [] {
+        std::ifstream source("/sys/devices/system/clocksource/clocksource0/current_clocksource");
+        std::string name;
+        return source >> name && name == "tsc";
+    }();
+    return use_tsc;
+#else
+    return false;
+#endif
+}
+
+// Start of a request, in the units MetricsRegistry::record_request expects
+inline uint64_t metrics_ticks() {
+#if defined(__x86_64__)
+    if (metrics_use_tsc()) return __rdtsc();
+#endif
+    return steady_now_ns();
+}
+
+const size_t METRIC_COMMANDS = size_t(MetricCommand::Count);
+// Bucket i counts samples below 2^i microseconds; the last one is +Inf
+const size_t LATENCY_BUCKETS = 26;
+
+struct alignas(64) MetricsShard {
+    std::atomic<uint64_t> requests[METRIC_COMMANDS] = {};
+    std::atomic<uint64_t> latency_sum_ns[METRIC_COMMANDS] = {};
+    std::atomic<uint64_t> latency[METRIC_COMMANDS][LATENCY_BUCKETS] = {};
+    std::atomic<uint64_t> connections_accepted{0};
+};
+
+// Single-writer increment: the owning thread is the only one storing
+inline void bump(std::atomic<uint64_t>& counter, uint64_t delta = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+inline size_t latency_bucket(uint64_t latency_ns) {
+    uint64_t micros = latency_ns >> 10;     // ~microseconds, a shift instead of a divide
+    size_t bucket = micros ? 64 - __builtin_clzll(micros) : 0;
+    return bucket < LATENCY_BUCKETS - 1 ? bucket : LATENCY_BUCKETS - 1;
+}
+
+class MetricsRegistry {
+public:
+    explicit MetricsRegistry(std::string server_name)
+        : server_name(std::move(server_name)), id(next_registry_id()), ns_per_tick(calibrate_ticks()) {}
+
+    // started comes from metrics_ticks()
+    void record_request(MetricCommand command, uint64_t started) {
+        uint64_t latency_ns = uint64_t((unsigned __int128)(metrics_ticks() - started) * ns_per_tick >> 32);
+        MetricsShard& s = shard();
+        size_t c = size_t(command);
+        bump(s.requests[c]);
+        bump(s.latency_sum_ns[c], latency_ns);
+        bump(s.latency[c][latency_bucket(latency_ns)]);
+    }
+
+    void record_connection() { bump(shard().connections_accepted); }
+
+    void add_gauge(const std::string& name, const std::string& help, std::function<double()> read) {
+        std::lock_guard<std::mutex> lock(mtx);
+        gauges.push_back({name, help, std::move(read)});
+    }
+
+    // Human-readable summary for the STATS command
+    std::string stats_text() {
+        Totals t = collect();
+        std::string out = "connections_accepted " + std::to_string(t.connections_accepted) + "\n";
+        for (const auto& gauge : gauge_values()) {
+            out += gauge.name + " " + format_number(gauge.value) + "\n";
+        }
+        for (size_t c = 0; c < METRIC_COMMANDS; ++c) {
+            if (t.requests[c] == 0) continue;
+            out += std::string(metric_command_name(MetricCommand(c))) +
+                   " count=" + std::to_string(t.requests[c]) +
+                   " avg_us=" + std::to_string(t.latency_sum_ns[c] / t.requests[c] / 1000) +
+                   " p50_us<=" + bucket_bound_text(t, c, 500) +
+                   " p99_us<=" + bucket_bound_text(t, c, 990) +
+                   " p999_us<=" + bucket_bound_text(t, c, 999) + "\n";
+        }
+        return out;
+    }
+
+    std::string prometheus_text() {
+        Totals t = collect();
+        std::string label = "server=\"" + server_name + "\"";
+        std::string out;
+
+        out += "# HELP server_connections_accepted_total Connections accepted.\n"
+               "# TYPE server_connections_accepted_total counter\n"
+               "server_connections_accepted_total{" + label + "} " +
+               std::to_string(t.connections_accepted) + "\n";
+
+        for (const auto& gauge : gauge_values()) {
+            out += "# HELP " + gauge.name + " " + gauge.help + "\n"
+                   "# TYPE " + gauge.name + " gauge\n" +
+                   gauge.name + "{" + label + "} " + format_number(gauge.value) + "\n";
+        }
+
+        out += "# HELP server_requests_total Requests handled, by command.\n"
+               "# TYPE server_requests_total counter\n";
+        for (size_t c = 0; c < METRIC_COMMANDS; ++c) {
+            out += "server_requests_total{" + label + ",command=\"" +
+                   metric_command_name(MetricCommand(c)) + "\"} " + std::to_string(t.requests[c]) + "\n";
+        }
+
+        out += "# HELP server_request_duration_seconds Request handling time, by command.\n"
+               "# TYPE server_request_duration_seconds histogram\n";
+        for (size_t c = 0; c < METRIC_COMMANDS; ++c) {
+            std::string labels = label + ",command=\"" + metric_command_name(MetricCommand(c)) + "\"";
+            uint64_t cumulative = 0;
+            for (size_t b = 0; b < LATENCY_BUCKETS; ++b) {
+                cumulative += t.latency[c][b];
+                std::string le = b == LATENCY_BUCKETS - 1 ? "+Inf" : format_number(bucket_upper_seconds(b));
+                out += "server_request_duration_seconds_bucket{" + labels + ",le=\"" + le + "\"} " +
+                       std::to_string(cumulative) + "\n";
+            }
+            out += "server_request_duration_seconds_sum{" + labels + "} " +
+                   format_number(t.latency_sum_ns[c] / 1e9) + "\n";
+            out += "server_request_duration_seconds_count{" + labels + "} " +
+                   std::to_string(t.requests[c]) + "\n";
+        }
+        return out;
+    }
+
+    // Minimal HTTP server answering every request with prometheus_text(),
+    // on address (127.0.0.1 unless the caller widens it). One thread polls
+    // all scrapers, so a client that connects and sends nothing only holds
+    // its own connection, until PROMETHEUS_TIMEOUT_MS drops it. Returns
+    // false if the address cannot be bound.
+    bool serve_prometheus(int port, const std::string& address = "127.0.0.1") {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+            errno = EINVAL;
+            return false;
+        }
+
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return false;
+        }
+
+        std::thread([this, fd] { run_prometheus(fd); }).detach();
+        return true;
+    }
+
+private:
+    struct Totals {
+        uint64_t requests[METRIC_COMMANDS] = {};
+        uint64_t latency_sum_ns[METRIC_COMMANDS] = {};
+        uint64_t latency[METRIC_COMMANDS][LATENCY_BUCKETS] = {};
+        uint64_t connections_accepted = 0;
+    };
+
+    struct Gauge {
+        std::string name;
+        std::string help;
+        std::function<double()> read;
+    };
+
+    struct Scraper {
+        int fd;
+        std::string request;
+        std::string response;       // empty until the request is complete
+        size_t sent = 0;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    static const int PROMETHEUS_TIMEOUT_MS = 2000;
+    static const size_t PROMETHEUS_MAX_SCRAPERS = 64;
+    static const size_t PROMETHEUS_MAX_REQUEST = 8192;
+
+    void run_prometheus(int listen_fd) {
+        std::vector<Scraper> scrapers;
+        std::vector<pollfd> fds;
+        while (true) {
+            fds.clear();
+            fds.push_back({listen_fd, short(scrapers.size() < PROMETHEUS_MAX_SCRAPERS ? POLLIN : 0), 0});
+            for (const auto& scraper : scrapers) {
+                fds.push_back({scraper.fd, short(scraper.response.empty() ? POLLIN : POLLOUT), 0});
+            }
+            int timeout = scrapers.empty() ? -1 : 100;
+            if (poll(fds.data(), fds.size(), timeout) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < scrapers.size(); ++i) {
+                // A wakeup for another descriptor leaves this one as it is
+                bool open = fds[i + 1].revents == 0 || serve_scraper(scrapers[i]);
+                if (open && now < scrapers[i].deadline) continue;
+                close(scrapers[i].fd);
+                scrapers[i].fd = -1;
+            }
+            scrapers.erase(std::remove_if(scrapers.begin(), scrapers.end(),
+                                          [](const Scraper& scraper) { return scraper.fd < 0; }),
+                           scrapers.end());
+
+            while (fds[0].revents & POLLIN && scrapers.size() < PROMETHEUS_MAX_SCRAPERS) {
+                int client = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (client < 0) break;
+                Scraper scraper;
+                scraper.fd = client;
+                scraper.deadline = now + std::chrono::milliseconds(PROMETHEUS_TIMEOUT_MS);
+                scrapers.push_back(std::move(scraper));
+            }
+        }
+        for (const auto& scraper : scrapers) close(scraper.fd);
+        close(listen_fd);
+    }
+
+    // Reads the request (up to the blank line) and writes the response
+    // without blocking; false once the connection is done with
+    bool serve_scraper(Scraper& scraper) {
+        if (scraper.response.empty()) {
+            char buf[1024];
+            ssize_t n = recv(scraper.fd, buf, sizeof(buf), 0);
+            if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            if (n > 0) scraper.request.append(buf, size_t(n));
+            bool complete = n == 0 || scraper.request.find("\r\n\r\n") != std::string::npos ||
+                            scraper.request.find("\n\n") != std::string::npos;
+            if (!complete) return scraper.request.size() < PROMETHEUS_MAX_REQUEST;
+
+            std::string body = prometheus_text();
+            scraper.response = "HTTP/1.0 200 OK\r\n"
+                               "Content-Type: text/plain; version=0.0.4\r\n"
+                               "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                               "Connection: close\r\n\r\n" + body;
+        }
+        while (scraper.sent < scraper.response.size()) {
+            ssize_t sent = send(scraper.fd, scraper.response.data() + scraper.sent,
+                                scraper.response.size() - scraper.sent, MSG_NOSIGNAL);
+            if (sent < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            scraper.sent += size_t(sent);
+        }
+        return false;
+    }
+
+    // Nanoseconds per tick of metrics_ticks() in 32.32 fixed point
+    static uint64_t calibrate_ticks() {
+        if (!metrics_use_tsc()) return uint64_t(1) << 32;
+        uint64_t start_ns = steady_now_ns();
+        uint64_t start_ticks = metrics_ticks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        uint64_t ns = steady_now_ns() - start_ns;
+        uint64_t ticks = metrics_ticks() - start_ticks;
+        return ticks ? uint64_t((unsigned __int128)ns << 32) / ticks : uint64_t(1) << 32;
+    }
+
+    static uint64_t next_registry_id() {
+        static std::atomic<uint64_t> next{1};
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The thread's shard of this registry. The cache is keyed by registry
+    // id; ids are never reused, so the entry of a destroyed registry is
+    // never matched again.
+    MetricsShard& shard() {
+        struct Cached {
+            uint64_t registry;
+            MetricsShard* shard;
+        };
+        thread_local std::vector<Cached> local;
+        for (const auto& cached : local) {
+            if (cached.registry == id) return *cached.shard;
+        }
+        MetricsShard* created;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            shards.emplace_back(new MetricsShard());
+            created = shards.back().get();
+        }
+        local.push_back({id, created});
+        return *created;
+    }
+
+    Totals collect() {
+        Totals t;
+        std::lock_guard<std::mutex> lock(mtx);
+        for (const auto& s : shards) {
+            for (size_t c = 0; c < METRIC_COMMANDS; ++c) {
+                t.requests[c] += s->requests[c].load(std::memory_order_relaxed);
+                t.latency_sum_ns[c] += s->latency_sum_ns[c].load(std::memory_order_relaxed);
+                for (size_t b = 0; b < LATENCY_BUCKETS; ++b) {
+                    t.latency[c][b] += s->latency[c][b].load(std::memory_order_relaxed);
+                }
+            }
+            t.connections_accepted += s->connections_accepted.load(std::memory_order_relaxed);
+        }
+        return t;
+    }
+
+    struct GaugeValue {
+        std::string name;
+        std::string help;
+        double value;
+    };
+
+    std::vector<GaugeValue> gauge_values() {
+        std::vector<Gauge> copy;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            copy = gauges;
+        }
+        std::vector<GaugeValue> values;
+        for (const auto& gauge : copy) values.push_back({gauge.name, gauge.help, gauge.read()});
+        return values;
+    }
+
+    // Samples in bucket b are below 2^b * 1024 ns
+    static double bucket_upper_seconds(size_t b) {
+        return double(uint64_t(1) << b) * 1024e-9;
+    }
+
+    // Upper bound of the bucket holding the sample of rank
+    // ceil(permille / 1000 * count), in integers so 99% of 100 is the 99th
+    static std::string bucket_bound_text(const Totals& t, size_t c, uint64_t permille) {
+        uint64_t rank = (permille * t.requests[c] + 999) / 1000;
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (size_t b = 0; b < LATENCY_BUCKETS - 1; ++b) {
+            seen += t.latency[c][b];
+            if (seen >= rank) return std::to_string(uint64_t(bucket_upper_seconds(b) * 1e6 + 0.5));
+        }
+        return "inf";
+    }
+
+    static std::string format_number(double value) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.9g", value);
+        return buf;
+    }
+
+    std::string server_name;
+    const uint64_t id;
+    uint64_t ns_per_tick;
+    std::mutex mtx;
+    std::vector<std::unique_ptr<MetricsShard>> shards;
+    std::vector<Gauge> gauges;
+};
@@ -0,0 +1,433 @@
+#pragma once
+
+// Live mouse events for WATCH_MOUSE.
+//
+// One reader thread keeps the devices of a MouseInventory open while anybody
+// watches and waits on all of them with a single epoll set. EV_REL and
+// EV_KEY events read within a short batch window are packed into one binary
+// frame; consecutive motion of a device on the same axis is summed into one
+// record. The frame is built once and shared by every watcher the same way
+// subscription updates are (subscriptions.h). Frames that only carry motion
+// are droppable: a client that stops reading loses stale motion while the
+// reader never waits for it, and button events are kept until the queue
+// overflows (see queue_push in reactor.h).
+//
+// Frame payload (big-endian), pushed with MOUSE_EVENTS_REQUEST_ID:
+//   u32 sequence   frames since the stream started, a gap means frames were dropped
+//   u16 count      records that follow
+//   u16 flags      MOUSE_BATCH_HAS_KEYS if any record is EV_KEY
+//   count records of 12 bytes:
+//     u32 time_ms  event time (CLOCK_REALTIME ms, low 32 bits)
+//     u8  device   id from the WATCH_MOUSE reply
+//     u8  type     EV_REL or EV_KEY
+//     u16 code     REL_X, BTN_LEFT, ...
+//     i32 value
+//
+//   WATCH_MOUSE        -> device list, then event frames (framed protocol only)
+//   WATCH_MOUSE STOP
+//
+// A device id is never reused while the stream lives, so a client can keep
+// its device list. Once MAX_MOUSE_DEVICES distinct device nodes have been
+// seen, further new nodes are not opened or listed.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <fcntl.h>
+#include <libevdev-1.0/libevdev/libevdev.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "command_registry.h"
+#include "mouse_inventory.h"
+#include "protocol.h"
+#include "subscriptions.h"
+
+const size_t MOUSE_BATCH_HEADER_SIZE = 8;
+const size_t MOUSE_EVENT_RECORD_SIZE = 12;
+const uint16_t MOUSE_BATCH_HAS_KEYS = 1;
+const size_t MAX_MOUSE_BATCH_EVENTS = 4096;
+const size_t MAX_MOUSE_DEVICES = 256;      // ids fit the u8 device field
+
+struct MouseDevice {
+    uint8_t id;
+    std::string name;
+    std::string devnode;
+};
+
+class MouseEventStream {
+public:
+    // batch_ms - how long events are collected before a frame goes out
+    MouseEventStream(MouseInventory& inventory, int batch_ms)
+        : inventory(inventory), batch_window(batch_ms > 0 ? batch_ms : 0) {}
+
+    ~MouseEventStream() { stop(); }
+
+    void start() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+        reader = std::thread(&MouseEventStream::run, this);
+    }
+
+    void stop() {
+        if (!reader.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        wake();
+        reader.join();
+        close_devices();
+        close(wake_fd);
+        close(epoll_fd);
+    }
+
+    // Adds the channel (once) and returns the devices it will hear from.
+    // Throws like MouseInventory::snapshot() while the input directory
+    // cannot be read.
+    std::vector<MouseDevice> watch(std::shared_ptr<PushChannel> channel) {
+        auto mice = inventory.snapshot();
+        std::vector<MouseDevice> list;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (const auto& mouse : *mice) {
+                uint8_t id;
+                if (device_id(mouse.devnode, id)) list.push_back({id, mouse.name, mouse.devnode});
+            }
+            if (std::find(watchers.begin(), watchers.end(), channel) == watchers.end()) {
+                watchers.push_back(std::move(channel));
+            }
+        }
+        wake();
+        return list;
+    }
+
+    bool unwatch(const std::shared_ptr<PushChannel>& channel) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = std::find(watchers.begin(), watchers.end(), channel);
+        if (it == watchers.end()) return false;
+        watchers.erase(it);
+        return true;
+    }
+
+    size_t watcher_count() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return watchers.size();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct OpenDevice {
+        int fd;
+        struct libevdev* evdev;
+        uint8_t id;
+    };
+
+    struct Record {
+        uint32_t time_ms;
+        uint8_t device;
+        uint8_t type;
+        uint16_t code;
+        int32_t value;
+    };
+
+    void wake() {
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    // Ids stay the same for a device node as long as the stream lives;
+    // false once every id is taken by another node
+    bool device_id(const std::string& devnode, uint8_t& id) {
+        auto it = ids.find(devnode);
+        if (it != ids.end()) {
+            id = it->second;
+            return true;
+        }
+        if (ids.size() >= MAX_MOUSE_DEVICES) return false;
+        id = uint8_t(ids.size());
+        ids.emplace(devnode, id);
+        return true;
+    }
+
+    // Drops the channels of closed connections; true if any watcher is left
+    bool prune_watchers() {
+        watchers.erase(std::remove_if(watchers.begin(), watchers.end(),
+                                      [](const std::shared_ptr<PushChannel>& channel) {
+                                          return !channel->open.load(std::memory_order_relaxed);
+                                      }),
+                       watchers.end());
+        return !watchers.empty();
+    }
+
+    // Opens new mice and closes removed ones when the inventory changed
+    void sync_devices() {
+        MouseInventory::Snapshot mice;
+        try {
+            mice = inventory.snapshot();
+        }
+        catch (const std::exception&) {
+            mice = std::make_shared<const std::vector<MouseInfo>>();
+        }
+        if (mice == synced) return;
+        synced = mice;
+
+        for (auto it = devices.begin(); it != devices.end();) {
+            bool present = std::any_of(mice->begin(), mice->end(),
+                                       [&](const MouseInfo& mouse) { return mouse.devnode == it->first; });
+            if (present) {
+                ++it;
+            } else {
+                close_device(it->second);
+                it = devices.erase(it);
+            }
+        }
+        for (const auto& mouse : *mice) {
+            if (devices.count(mouse.devnode)) continue;
+            uint8_t id;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (!device_id(mouse.devnode, id)) continue;
+            }
+            int fd = open(mouse.devnode.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            if (fd < 0) continue;
+            struct libevdev* evdev = nullptr;
+            if (libevdev_new_from_fd(fd, &evdev) != 0) {
+                close(fd);
+                continue;
+            }
+            OpenDevice& device = devices[mouse.devnode];
+            device = {fd, evdev, id};
+            struct epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = &device;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        }
+    }
+
+    void close_device(OpenDevice& device) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, device.fd, nullptr);
+        libevdev_free(device.evdev);
+        close(device.fd);
+    }
+
+    void close_devices() {
+        for (auto& entry : devices) close_device(entry.second);
+        devices.clear();
+        synced = nullptr;
+    }
+
+    // Reads everything pending on the device; false once it is gone
+    bool read_device(OpenDevice& device) {
+        struct input_event ev;
+        unsigned flags = LIBEVDEV_READ_FLAG_NORMAL;
+        while (true) {
+            int rc = libevdev_next_event(device.evdev, flags, &ev);
+            if (rc == -EAGAIN) {
+                // After a kernel buffer overrun the sync events bring the
+                // state up to date, then normal reading resumes
+                if (flags == LIBEVDEV_READ_FLAG_SYNC) {
+                    flags = LIBEVDEV_READ_FLAG_NORMAL;
+                    continue;
+                }
+                return true;
+            }
+            if (rc < 0) return false;
+            if (rc == LIBEVDEV_READ_STATUS_SYNC) flags = LIBEVDEV_READ_FLAG_SYNC;
+            add_event(device.id, ev);
+        }
+    }
+
+    void add_event(uint8_t device, const struct input_event& ev) {
+        if (ev.type != EV_REL && ev.type != EV_KEY) return;
+        uint32_t time_ms = uint32_t(uint64_t(ev.input_event_sec) * 1000 + ev.input_event_usec / 1000);
+
+        if (ev.type == EV_REL) {
+            // Sum into the device's last motion on this axis unless a
+            // button event of the device came in between
+            size_t looked = 0;
+            for (size_t i = records.size(); i-- > 0 && looked < 4;) {
+                Record& record = records[i];
+                if (record.device != device) continue;
+                looked++;
+                if (record.type == EV_KEY) break;
+                if (record.code == ev.code) {
+                    record.value += ev.value;
+                    record.time_ms = time_ms;
+                    return;
+                }
+            }
+        } else {
+            has_keys = true;
+        }
+
+        if (records.empty()) batch_deadline = Clock::now() + batch_window;
+        records.push_back({time_ms, device, uint8_t(ev.type), ev.code, ev.value});
+    }
+
+    void flush() {
+        std::string out;
+        out.reserve(FRAME_HEADER_SIZE + MOUSE_BATCH_HEADER_SIZE + records.size() * MOUSE_EVENT_RECORD_SIZE);
+        size_t start = begin_frame(out);
+        char header[MOUSE_BATCH_HEADER_SIZE];
+        store_be32(header, sequence++);
+        store_be32(header + 4, uint32_t(records.size()) << 16 | (has_keys ? MOUSE_BATCH_HAS_KEYS : 0));
+        out.append(header, sizeof(header));
+        for (const Record& record : records) {
+            char bytes[MOUSE_EVENT_RECORD_SIZE];
+            store_be32(bytes, record.time_ms);
+            bytes[4] = char(record.device);
+            bytes[5] = char(record.type);
+            bytes[6] = char(record.code >> 8);
+            bytes[7] = char(record.code & 0xFF);
+            store_be32(bytes + 8, uint32_t(record.value));
+            out.append(bytes, sizeof(bytes));
+        }
+        end_frame(out, start, MOUSE_EVENTS_REQUEST_ID);
+        auto data = std::make_shared<const std::string>(std::move(out));
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            prune_watchers();
+            for (const auto& watcher : watchers) batch.add(*watcher, data, !has_keys);
+        }
+        batch.post();
+        records.clear();
+        has_keys = false;
+    }
+
+    void run() {
+        struct epoll_event events[32];
+        while (true) {
+            // Closed connections are pruned on every pass (at least once a
+            // second while watching), not only when events arrive, so the
+            // devices close soon after the last watcher is gone
+            bool watching;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (stopping) return;
+                watching = prune_watchers();
+            }
+            // Devices are only held open while somebody watches
+            if (watching) {
+                sync_devices();
+            } else if (!devices.empty()) {
+                close_devices();
+                records.clear();
+                has_keys = false;
+            }
+
+            // Idle: sleep until watched; watching: look for hotplug every second
+            int timeout = watching ? 1000 : -1;
+            if (!records.empty()) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(batch_deadline - Clock::now());
+                timeout = int(std::max<int64_t>(0, left.count()));
+            }
+
+            int n = epoll_wait(epoll_fd, events, 32, timeout);
+            if (n < 0 && errno != EINTR) return;
+            for (int i = 0; i < n; ++i) {
+                auto* device = static_cast<OpenDevice*>(events[i].data.ptr);
+                if (!device) {
+                    uint64_t count;
+                    ssize_t ignored = read(wake_fd, &count, sizeof(count));
+                    (void)ignored;
+                    continue;
+                }
+                // What the device sent before an error or hangup is still read
+                bool readable = read_device(*device);
+                if (!readable || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                    // Unplugged; the inventory reports it and it is not reopened meanwhile
+                    for (auto it = devices.begin(); it != devices.end(); ++it) {
+                        if (&it->second != device) continue;
+                        close_device(it->second);
+                        devices.erase(it);
+                        break;
+                    }
+                }
+            }
+
+            if (!records.empty() && (records.size() >= MAX_MOUSE_BATCH_EVENTS || Clock::now() >= batch_deadline)) {
+                flush();
+            }
+        }
+    }
+
+    MouseInventory& inventory;
+    std::chrono::milliseconds batch_window;
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    std::thread reader;
+
+    // Reader thread only
+    std::map<std::string, OpenDevice> devices;
+    MouseInventory::Snapshot synced;
+    std::vector<Record> records;
+    bool has_keys = false;
+    Clock::time_point batch_deadline;
+    uint32_t sequence = 0;
+    PushBatch batch;
+
+    mutable std::mutex mtx;
+    std::map<std::string, uint8_t> ids;
+    std::vector<std::shared_ptr<PushChannel>> watchers;
+    bool stopping = false;
+};
+
+// WATCH_MOUSE [STOP]
+inline void register_mouse_events_module(CommandRegistry& commands, MouseEventStream& stream) {
+    commands.add("WATCH_MOUSE", [&stream](CommandRequest& request, ResponseBuffer& out) {
+        if (!request.args.empty() && request.args != "STOP") return false;
+        out += request.timestamp;
+        if (!request.push) {
+            out += "ERROR mouse events are not available on this connection\n";
+            return true;
+        }
+        std::shared_ptr<PushChannel> channel = request.push->push_channel();
+        if (!request.args.empty()) {
+            out += stream.unwatch(channel) ? "OK stopped watching mouse events\n" : "ERROR not watching mouse events\n";
+            return true;
+        }
+        // Event frames are binary, a text connection could not tell them apart
+        if (!channel->framed) {
+            out += "ERROR WATCH_MOUSE needs the framed protocol\n";
+            return true;
+        }
+
+        try {
+            auto devices = stream.watch(channel);
+            out += "Watching mouse devices: ";
+            append_number(out, uint64_t(devices.size()));
+            out += '\n';
+            for (const auto& device : devices) {
+                out += request.timestamp;
+                append_number(out, uint64_t(device.id));
+                out += ' ';
+                out += device.name;
+                out += ": ";
+                out += device.devnode;
+                out += '\n';
+            }
+        }
+        catch (const std::exception& e) {
+            out += "Error: ";
+            out += e.what();
+            out += '\n';
+        }
+        request.log_line("COMMAND", "Received command: ");
+        return true;
+    });
+}
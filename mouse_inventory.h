@@ -0,0 +1,240 @@
+#pragma once
+
+// Cached inventory of mouse devices for MOUSE_KEYS.
+//
+// The input directory is probed once at startup; after that an inotify
+// watch keeps the cache current as devices appear, change permissions or
+// go away, so requests only copy a shared snapshot. The directory root is
+// configurable, which lets the inventory run against a fake device tree.
+
+#include <algorithm>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <libevdev-1.0/libevdev/libevdev.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "command_registry.h"
+
+struct MouseInfo {
+    std::string name;
+    std::string devnode;
+    int buttons;
+};
+
+// Opens one device node and fills info if it looks like a mouse.
+inline bool probe_mouse(const std::string& path, MouseInfo& info) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISCHR(st.st_mode)) return false;
+
+    int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct libevdev *dev = nullptr;
+    if (libevdev_new_from_fd(fd, &dev) != 0) {
+        close(fd);
+        return false;
+    }
+
+    bool is_mouse = libevdev_has_event_type(dev, EV_REL) &&
+                    libevdev_has_event_code(dev, EV_KEY, BTN_LEFT);
+    if (is_mouse) {
+        info.name = libevdev_get_name(dev);
+        info.devnode = path;
+        info.buttons = 0;
+        for (int code = BTN_LEFT; code <= BTN_TASK; ++code) {
+            if (libevdev_has_event_code(dev, EV_KEY, code)) {
+                info.buttons++;
+            }
+        }
+    }
+
+    libevdev_free(dev);
+    close(fd);
+    return is_mouse;
+}
+
+class MouseInventory {
+public:
+    using Snapshot = std::shared_ptr<const std::vector<MouseInfo>>;
+
+    explicit MouseInventory(std::string root) : root(std::move(root)) {
+        if (this->root.empty() || this->root.back() != '/') this->root += '/';
+    }
+
+    ~MouseInventory() { stop(); }
+
+    void start() {
+        stop_fd = eventfd(0, EFD_CLOEXEC);
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        watch();
+        watcher = std::thread(&MouseInventory::run, this);
+    }
+
+    void stop() {
+        if (!watcher.joinable()) return;
+        uint64_t one = 1;
+        ssize_t ignored = write(stop_fd, &one, sizeof(one));
+        (void)ignored;
+        watcher.join();
+        close(inotify_fd);
+        close(stop_fd);
+    }
+
+    // Throws std::system_error while the input directory cannot be read,
+    // like the uncached scan did.
+    Snapshot snapshot() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (scan_errno != 0) {
+            throw std::system_error(scan_errno, std::system_category(), "opendir failed");
+        }
+        return current;
+    }
+
+private:
+    // Adds the watch (if not yet added) and rescans the whole directory.
+    void watch() {
+        if (watch_fd < 0) {
+            watch_fd = inotify_add_watch(inotify_fd, root.c_str(),
+                IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE_SELF);
+        }
+        rescan();
+    }
+
+    void rescan() {
+        DIR *dir = opendir(root.c_str());
+        if (!dir) {
+            std::lock_guard<std::mutex> lock(mtx);
+            scan_errno = errno;
+            devices.clear();
+            current = std::make_shared<const std::vector<MouseInfo>>();
+            return;
+        }
+
+        devices.clear();
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (entry->d_type != DT_CHR && entry->d_type != DT_UNKNOWN) continue;
+            update_device(entry->d_name);
+        }
+        closedir(dir);
+        publish(0);
+    }
+
+    void update_device(const std::string& name) {
+        MouseInfo info;
+        if (probe_mouse(root + name, info)) {
+            devices[name] = info;
+        } else {
+            devices.erase(name);
+        }
+    }
+
+    void publish(int error) {
+        auto mice = std::make_shared<std::vector<MouseInfo>>();
+        for (const auto& entry : devices) mice->push_back(entry.second);
+        std::lock_guard<std::mutex> lock(mtx);
+        scan_errno = error;
+        current = std::move(mice);
+    }
+
+    void run() {
+        alignas(struct inotify_event) char buf[4096];
+        while (true) {
+            struct pollfd fds[2] = {{stop_fd, POLLIN, 0}, {inotify_fd, POLLIN, 0}};
+            // Without a watch (directory missing) retry every few seconds
+            int ready = poll(fds, 2, watch_fd < 0 ? 5000 : -1);
+            if (ready < 0 && errno != EINTR) return;
+            if (fds[0].revents & POLLIN) return;
+
+            if (watch_fd < 0) {
+                watch();
+                continue;
+            }
+            if (!(fds[1].revents & POLLIN)) continue;
+
+            bool changed = false;
+            bool full_rescan = false;
+            ssize_t len;
+            while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+                for (char* p = buf; p < buf + len;) {
+                    auto* event = reinterpret_cast<struct inotify_event*>(p);
+                    p += sizeof(struct inotify_event) + event->len;
+
+                    if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF)) {
+                        full_rescan = true;
+                        if (event->mask & (IN_IGNORED | IN_DELETE_SELF)) watch_fd = -1;
+                        continue;
+                    }
+                    if (event->len == 0) continue;
+
+                    std::string name(event->name);
+                    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                        changed |= devices.erase(name) > 0;
+                    } else {
+                        update_device(name);
+                        changed = true;
+                    }
+                }
+            }
+
+            if (full_rescan) {
+                if (watch_fd < 0) watch(); else rescan();
+            } else if (changed) {
+                publish(0);
+            }
+        }
+    }
+
+    std::string root;
+    int inotify_fd = -1;
+    int watch_fd = -1;
+    int stop_fd = -1;
+    std::thread watcher;
+    std::map<std::string, MouseInfo> devices;   // watcher thread only
+
+    mutable std::mutex mtx;
+    Snapshot current = std::make_shared<const std::vector<MouseInfo>>();
+    int scan_errno = 0;
+};
+
+// MOUSE_KEYS
+inline void register_mouse_module(CommandRegistry& commands, MouseInventory& inventory) {
+    commands.add("MOUSE_KEYS", [&inventory](CommandRequest& request, ResponseBuffer& out) {
+        if (!request.args.empty()) return false;
+        size_t mark = out.size();
+        try {
+            auto mice = inventory.snapshot();
+            out += request.timestamp;
+            out += "Mouse devices: ";
+            append_number(out, uint64_t(mice->size()));
+            out += '\n';
+            for (const auto& mouse : *mice) {
+                out += request.timestamp;
+                out += mouse.name;
+                out += ": ";
+                append_number(out, int64_t(mouse.buttons));
+                out += '\n';
+                request.log_line("COMMAND", "Received command: ");
+            }
+        }
+        catch (const std::exception& e) {
+            out.resize(mark);
+            out += request.timestamp;
+            out += "Error: ";
+            out += e.what();
+            out += '\n';
+        }
+        return true;
+    });
+}
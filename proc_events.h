@@ -0,0 +1,206 @@
+#pragma once
+
+// THREAD_COUNT kept current from process events instead of /proc scans.
+//
+// The kernel's proc connector (CN_PROC) reports every task it creates or
+// reaps over a netlink socket; threads are tasks too, so a fork event is one
+// more thread in the system and an exit event one less. ProcEventCounter
+// subscribes, seeds the count with one full scan and from then on applies
+// the events, so get() is an atomic load however many processes there
+// are. Events can still be missed (a socket overrun under a fork storm, a
+// task created between subscribing and the end of the seed scan), so the
+// count is replaced by a full scan every reconcile interval and right away
+// after an overrun.
+//
+// Before Linux 6.6 subscribing needs CAP_NET_ADMIN; start() returns false
+// when the kernel refuses and the server keeps sampling /proc instead.
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include "procfs.h"
+
+// Values of proc_event::what (newer headers moved the enum out of the
+// struct, so it cannot be named the same way for both)
+const uint32_t CN_PROC_EVENT_NONE = 0x00000000;
+const uint32_t CN_PROC_EVENT_FORK = 0x00000001;
+const uint32_t CN_PROC_EVENT_EXIT = 0x80000000;
+
+class ProcEventCounter {
+public:
+    explicit ProcEventCounter(int reconcile_s, std::function<int()> scan = count_system_threads)
+        : scan(std::move(scan)), reconcile_interval(reconcile_s > 0 ? reconcile_s : 1),
+          wake_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+    ~ProcEventCounter() {
+        stop();
+        close(wake_fd);
+    }
+
+    ProcEventCounter(const ProcEventCounter&) = delete;
+    ProcEventCounter& operator=(const ProcEventCounter&) = delete;
+
+    // Subscribes and seeds the count; false if the connector is unavailable
+    bool start() {
+        sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+        if (sock < 0) return false;
+
+        // Room for a burst of events while the reader is busy reconciling
+        int bytes = 4 << 20;
+        if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)) < 0) {
+            setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+        }
+
+        struct sockaddr_nl addr{};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = CN_IDX_PROC;
+        if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || !send_control(PROC_CN_MCAST_LISTEN) ||
+            !await_ack()) {
+            close(sock);
+            sock = -1;
+            return false;
+        }
+
+        // Subscribed first, so a task started during the scan is at worst
+        // counted twice until the next reconcile
+        count.store(scan(), std::memory_order_relaxed);
+        worker = std::thread(&ProcEventCounter::run, this);
+        return true;
+    }
+
+    void stop() {
+        if (!worker.joinable()) return;
+        stopping = true;
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+        worker.join();
+        send_control(PROC_CN_MCAST_IGNORE);
+        close(sock);
+        sock = -1;
+    }
+
+    int get() const { return count.load(std::memory_order_relaxed); }
+
+    // A full scan, which also corrects the running count
+    int fresh() {
+        int threads = scan();
+        if (threads >= 0) reconcile_to(threads);
+        return threads;
+    }
+
+    uint64_t events() const { return applied.load(std::memory_order_relaxed); }
+    uint64_t overruns() const { return lost.load(std::memory_order_relaxed); }
+    // Difference the last full scan found, a measure of the drift
+    int last_correction() const { return correction.load(std::memory_order_relaxed); }
+
+private:
+    bool send_control(enum proc_cn_mcast_op op) {
+        alignas(struct nlmsghdr) char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))] = {};
+        auto* header = reinterpret_cast<struct nlmsghdr*>(buf);
+        header->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+        header->nlmsg_type = NLMSG_DONE;
+        auto* message = static_cast<struct cn_msg*>(NLMSG_DATA(header));
+        message->id.idx = CN_IDX_PROC;
+        message->id.val = CN_VAL_PROC;
+        message->len = sizeof(op);
+        std::memcpy(message->data, &op, sizeof(op));
+        return send(sock, buf, header->nlmsg_len, 0) == ssize_t(header->nlmsg_len);
+    }
+
+    // The kernel answers LISTEN with an event whose err field is the result;
+    // EPERM when the capability is required and missing
+    bool await_ack() {
+        struct pollfd pfd{sock, POLLIN, 0};
+        alignas(struct nlmsghdr) char buf[4096];
+        while (poll(&pfd, 1, 1000) > 0) {
+            ssize_t n = recv(sock, buf, sizeof(buf), MSG_DONTWAIT);
+            if (n <= 0) return false;
+            const struct proc_event* event = first_event(buf, size_t(n));
+            if (event && uint32_t(event->what) == CN_PROC_EVENT_NONE) return event->event_data.ack.err == 0;
+        }
+        return false;
+    }
+
+    static const struct proc_event* first_event(const char* buf, size_t len) {
+        auto* header = reinterpret_cast<const struct nlmsghdr*>(buf);
+        if (!NLMSG_OK(header, len)) return nullptr;
+        auto* message = static_cast<const struct cn_msg*>(NLMSG_DATA(header));
+        if (message->id.idx != CN_IDX_PROC || message->id.val != CN_VAL_PROC) return nullptr;
+        return reinterpret_cast<const struct proc_event*>(message->data);
+    }
+
+    void reconcile_to(int threads) {
+        int previous = count.exchange(threads, std::memory_order_relaxed);
+        correction.store(threads - previous, std::memory_order_relaxed);
+    }
+
+    void run() {
+        alignas(struct nlmsghdr) char buf[16384];
+        struct pollfd fds[2] = {{sock, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+        auto next_reconcile = std::chrono::steady_clock::now() + reconcile_interval;
+
+        while (!stopping) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= next_reconcile) {
+                fresh();
+                next_reconcile = now + reconcile_interval;
+            }
+            int timeout = int(std::chrono::duration_cast<std::chrono::milliseconds>(next_reconcile - now).count());
+            if (poll(fds, 2, timeout) <= 0 || !(fds[0].revents & POLLIN)) continue;
+
+            // Drain the socket; events arrive one per datagram
+            while (true) {
+                ssize_t n = recv(sock, buf, sizeof(buf), MSG_DONTWAIT);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == ENOBUFS) {
+                        // Events were dropped, the count cannot be trusted
+                        lost.fetch_add(1, std::memory_order_relaxed);
+                        next_reconcile = std::chrono::steady_clock::now();
+                    }
+                    break;
+                }
+                int delta = 0;
+                uint64_t seen = 0;
+                size_t len = size_t(n);
+                for (auto* header = reinterpret_cast<const struct nlmsghdr*>(buf); NLMSG_OK(header, len);
+                     header = NLMSG_NEXT(header, len)) {
+                    const struct proc_event* event =
+                        first_event(reinterpret_cast<const char*>(header), header->nlmsg_len);
+                    if (!event) continue;
+                    uint32_t what = uint32_t(event->what);
+                    if (what == CN_PROC_EVENT_FORK) delta++;
+                    else if (what == CN_PROC_EVENT_EXIT) delta--;
+                    else continue;
+                    seen++;
+                }
+                if (delta) count.fetch_add(delta, std::memory_order_relaxed);
+                if (seen) applied.fetch_add(seen, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::function<int()> scan;
+    std::chrono::seconds reconcile_interval;
+    int sock = -1;
+    int wake_fd;
+    std::thread worker;
+    std::atomic<bool> stopping{false};
+
+    std::atomic<int> count{0};
+    std::atomic<uint64_t> applied{0};
+    std::atomic<uint64_t> lost{0};
+    std::atomic<int> correction{0};
+};
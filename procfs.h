@@ -0,0 +1,364 @@
+#pragma once
+
+// /proc readers behind MEMORY and THREAD_COUNT, and the background sampler
+// that lets request handlers answer from a shared snapshot.
+//
+// Scanning procfs is far more expensive than answering a request, so each
+// server samples at a fixed interval (SAMPLE_INTERVAL_MS) into a seqlock
+// and handlers only read the latest value. "<COMMAND> FRESH" bypasses the
+// cache for callers that need an up-to-date value.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <sys/syscall.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+inline size_t get_free_memory() {
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    size_t free_mem = 0;
+    while (getline(meminfo, line)) {
+        if (line.find("MemFree") != std::string::npos) {
+            std::istringstream iss(line);
+            iss >> line >> free_mem;
+            free_mem *= 1024;
+            break;
+        }
+    }
+    return free_mem;
+}
+
+// MemFree of a /proc/meminfo image in bytes, 0 if the line is missing
+inline size_t parse_free_memory(const char* buf, size_t len) {
+    static const char key[] = "MemFree:";
+    const size_t key_len = sizeof(key) - 1;
+    const char* end = buf + len;
+
+    for (const char* p = buf; p < end;) {
+        if (size_t(end - p) > key_len && std::memcmp(p, key, key_len) == 0) {
+            p += key_len;
+            while (p < end && *p == ' ') ++p;
+            size_t value = 0;
+            while (p < end && *p >= '0' && *p <= '9') value = value * 10 + size_t(*p++ - '0');
+            return value * 1024;
+        }
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!newline) break;
+        p = newline + 1;
+    }
+    return 0;
+}
+
+// Helper function to check if a string is numeric
+inline bool is_numeric(const char* str) {
+    if (!str || !*str) return false;
+    for (int i = 0; str[i]; i++) {
+        if (str[i] < '0' || str[i] > '9') return false;
+    }
+    return true;
+}
+
+// Parses the value of the "Threads:" line out of a /proc/<pid>/status image.
+// Uses memchr to jump between candidate line starts instead of splitting
+// the file into strings. Returns -1 if the line is missing.
+inline int parse_status_threads(const char* buf, size_t len) {
+    static const char key[] = "Threads:";
+    const size_t key_len = sizeof(key) - 1;
+    const char* end = buf + len;
+
+    for (const char* p = buf; p < end;) {
+        if (size_t(end - p) > key_len && std::memcmp(p, key, key_len) == 0) {
+            p += key_len;
+            while (p < end && (*p == ' ' || *p == '\t')) ++p;
+            int value = 0;
+            while (p < end && *p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+            return value;
+        }
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!newline) break;
+        p = newline + 1;
+    }
+    return -1;
+}
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Counts threads of all processes without heap allocations: the /proc
+// directory fd is opened once and kept, entries are read with getdents64
+// and every status file is opened relative to it and read into a stack
+// buffer. The root is configurable so it can run on a synthetic tree.
+//
+// With max_workers > 1 the PIDs collected from the getdents64 batches are
+// split into chunks that the calling thread and up to max_workers - 1
+// helper threads claim from a shared cursor; per-worker sums are added up
+// at the end.
+class ProcThreadCounter {
+public:
+    explicit ProcThreadCounter(const char* proc_root = "/proc", unsigned max_workers = 1)
+        : dir_fd(open(proc_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) {
+        for (unsigned i = 1; i < max_workers; ++i) {
+            helpers.emplace_back(&ProcThreadCounter::helper_loop, this);
+        }
+    }
+
+    ~ProcThreadCounter() {
+        {
+            std::lock_guard<std::mutex> lock(pool_mtx);
+            stopping = true;
+        }
+        start_cv.notify_all();
+        for (auto& t : helpers) t.join();
+        if (dir_fd >= 0) close(dir_fd);
+    }
+
+    ProcThreadCounter(const ProcThreadCounter&) = delete;
+    ProcThreadCounter& operator=(const ProcThreadCounter&) = delete;
+
+    int count() {
+        if (dir_fd < 0) {
+            std::cerr << "Ошибка открытия директории /proc" << std::endl;
+            return -1;
+        }
+
+        // The directory offset is shared, one walk at a time
+        std::lock_guard<std::mutex> lock(walk_mtx);
+        lseek(dir_fd, 0, SEEK_SET);
+
+        pids.clear();   // keeps its capacity between scans
+        int total_threads = 0;
+        alignas(linux_dirent64) char entries[32768];
+        long n;
+        while ((n = syscall(SYS_getdents64, dir_fd, entries, sizeof(entries))) > 0) {
+            for (long pos = 0; pos < n;) {
+                auto* entry = reinterpret_cast<linux_dirent64*>(entries + pos);
+                pos += entry->d_reclen;
+                if (entry->d_type != DT_DIR || !is_numeric(entry->d_name)) continue;
+
+                if (helpers.empty()) {
+                    int threads = process_threads(dir_fd, entry->d_name);
+                    if (threads > 0) total_threads += threads;
+                } else {
+                    pids.push_back(uint32_t(std::strtoul(entry->d_name, nullptr, 10)));
+                }
+            }
+        }
+        if (helpers.empty()) return total_threads;
+
+        next_pid.store(0, std::memory_order_relaxed);
+        parallel_total.store(0, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> pool_lock(pool_mtx);
+            active_helpers = helpers.size();
+            generation++;
+        }
+        start_cv.notify_all();
+
+        scan_chunks();
+
+        std::unique_lock<std::mutex> pool_lock(pool_mtx);
+        done_cv.wait(pool_lock, [this] { return active_helpers == 0; });
+        return parallel_total.load(std::memory_order_relaxed);
+    }
+
+    // Threads of one /proc/<pid>, -1 if the process is gone
+    static int process_threads(int proc_fd, const char* pid) {
+        char path[32];
+        size_t len = std::strlen(pid);
+        if (len > sizeof(path) - sizeof("/status")) return -1;
+        std::memcpy(path, pid, len);
+        std::memcpy(path + len, "/status", sizeof("/status"));
+
+        int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return -1;
+
+        // status is generated in one go and is well under 4 KiB, so a single
+        // read returns the Threads: line; no read-until-EOF round trip
+        char buf[4096];
+        ssize_t got = read(fd, buf, sizeof(buf));
+        close(fd);
+        return got > 0 ? parse_status_threads(buf, got) : -1;
+    }
+
+    static int process_threads(int proc_fd, uint32_t pid) {
+        char digits[16];
+        char* p = digits + sizeof(digits) - 1;
+        *p = '\0';
+        do {
+            *--p = char('0' + pid % 10);
+            pid /= 10;
+        } while (pid);
+        return process_threads(proc_fd, p);
+    }
+
+private:
+    static const size_t PIDS_PER_CHUNK = 64;
+
+    void scan_chunks() {
+        int local = 0;
+        size_t begin;
+        while ((begin = next_pid.fetch_add(PIDS_PER_CHUNK, std::memory_order_relaxed)) < pids.size()) {
+            size_t end = std::min(begin + PIDS_PER_CHUNK, pids.size());
+            for (size_t i = begin; i < end; ++i) {
+                int threads = process_threads(dir_fd, pids[i]);
+                if (threads > 0) local += threads;
+            }
+        }
+        parallel_total.fetch_add(local, std::memory_order_relaxed);
+    }
+
+    void helper_loop() {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(pool_mtx);
+                start_cv.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            scan_chunks();
+            std::lock_guard<std::mutex> lock(pool_mtx);
+            if (--active_helpers == 0) done_cv.notify_one();
+        }
+    }
+
+    int dir_fd;
+    std::mutex walk_mtx;
+    std::vector<uint32_t> pids;
+    std::atomic<size_t> next_pid{0};
+    std::atomic<int> parallel_total{0};
+
+    std::vector<std::thread> helpers;
+    std::mutex pool_mtx;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    uint64_t generation = 0;
+    size_t active_helpers = 0;
+    bool stopping = false;
+};
+
+// Function to count all threads in the system. THREAD_COUNT_WORKERS caps
+// the number of threads scanning /proc in parallel (default 1, 0 - one
+// per core).
+inline int count_system_threads() {
+    static ProcThreadCounter counter("/proc", [] {
+        const char* value = std::getenv("THREAD_COUNT_WORKERS");
+        int workers = value && *value ? std::atoi(value) : 1;
+        if (workers <= 0) workers = std::max(1u, std::thread::hardware_concurrency());
+        return unsigned(workers);
+    }());
+    return counter.count();
+}
+
+// Single-writer seqlock for small trivially copyable values. The payload is
+// kept in relaxed atomic words, so readers racing with the writer never
+// touch torn non-atomic memory; they just retry.
+template <typename T>
+class Seqlock {
+    static_assert(std::is_trivially_copyable<T>::value, "Seqlock needs a trivially copyable type");
+    static const size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+public:
+    void store(const T& value) {
+        uint64_t buf[WORDS] = {};
+        std::memcpy(buf, &value, sizeof(T));
+
+        uint64_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; ++i) words[i].store(buf[i], std::memory_order_relaxed);
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    T load() const {
+        uint64_t buf[WORDS];
+        uint64_t before, after;
+        do {
+            before = sequence.load(std::memory_order_acquire);
+            for (size_t i = 0; i < WORDS; ++i) buf[i] = words[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while (before != after || (before & 1));
+
+        T value;
+        std::memcpy(&value, buf, sizeof(T));
+        return value;
+    }
+
+private:
+    std::atomic<uint64_t> sequence{0};
+    std::atomic<uint64_t> words[WORDS] = {};
+};
+
+// Runs sample() every interval_ms on its own thread and publishes the
+// result; get() is a seqlock read and never blocks on procfs. fresh()
+// calls fresh_sample, or sample if none is given; it must be safe to call
+// from request threads.
+template <typename T>
+class PeriodicSampler {
+public:
+    PeriodicSampler(std::function<T()> sample, int interval_ms, std::function<T()> fresh_sample = nullptr)
+        : sample(std::move(sample)), fresh_sample(fresh_sample ? std::move(fresh_sample) : this->sample),
+          interval(interval_ms > 0 ? interval_ms : 1) {}
+
+    ~PeriodicSampler() { stop(); }
+
+    void start() {
+        value.store(sample());
+        worker = std::thread(&PeriodicSampler::run, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+
+    T get() const { return value.load(); }
+
+    // Uncached value for callers that ask for FRESH
+    T fresh() const { return fresh_sample(); }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!cv.wait_for(lock, interval, [this] { return stopping; })) {
+            lock.unlock();
+            value.store(sample());
+            lock.lock();
+        }
+    }
+
+    std::function<T()> sample;
+    std::function<T()> fresh_sample;
+    std::chrono::milliseconds interval;
+    Seqlock<T> value;
+    std::thread worker;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stopping = false;
+};
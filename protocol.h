@@ -0,0 +1,183 @@
+#pragma once
+
+// Wire protocol shared by the servers and the client.
+//
+// The first byte a client sends selects the protocol for the connection:
+// FRAME_MAGIC switches to framed mode, anything else is the first byte of a
+// legacy text command ("MEMORY", "THREAD_COUNT", ...) and the connection
+// keeps the old one-recv-per-command behaviour.
+//
+// A frame is an 8 byte header followed by the payload:
+//   u32 payload length (big-endian)
+//   u32 request id     (big-endian, echoed back in the response)
+//   payload            (the same text the legacy protocol uses)
+// A client may send many frames without waiting; responses carry the id of
+// the request they answer and may arrive in any order. Data the server
+// pushes on its own uses PUSH_REQUEST_ID (subscription updates) or
+// MOUSE_EVENTS_REQUEST_ID (binary input events, see mouse_events.h).
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+const uint8_t FRAME_MAGIC = 0xFB;
+const size_t FRAME_HEADER_SIZE = 8;
+const uint32_t MAX_FRAME_PAYLOAD = 1 << 20;
+const uint32_t PUSH_REQUEST_ID = 0xFFFFFFFF;
+const uint32_t MOUSE_EVENTS_REQUEST_ID = 0xFFFFFFFE;
+
+enum class ProtocolMode { Unknown, Legacy, Framed };
+
+enum class FrameStatus { Incomplete, Ready, Invalid };
+
+struct Frame {
+    uint32_t request_id = 0;
+    std::string payload;
+};
+
+// Growable byte ring used as a per-connection receive buffer. Storage is
+// only allocated once data arrives, so idle connections stay cheap.
+class RingBuffer {
+public:
+    size_t size() const { return tail - head; }
+    bool empty() const { return head == tail; }
+
+    // Contiguous free space of at least min_free bytes to recv() into,
+    // followed by commit() with the number of bytes actually written.
+    std::pair<char*, size_t> write_area(size_t min_free) {
+        reserve(size() + min_free);
+        size_t mask = buf.size() - 1;
+        size_t pos = tail & mask;
+        size_t free_total = buf.size() - size();
+        size_t contiguous = buf.size() - pos;
+        return {buf.data() + pos, contiguous < free_total ? contiguous : free_total};
+    }
+
+    void commit(size_t len) { tail += len; }
+
+    void append(const char* data, size_t len) {
+        while (len > 0) {
+            auto area = write_area(len);
+            size_t n = area.second < len ? area.second : len;
+            std::memcpy(area.first, data, n);
+            commit(n);
+            data += n;
+            len -= n;
+        }
+    }
+
+    void copy_out(size_t offset, char* dst, size_t len) const {
+        size_t mask = buf.size() - 1;
+        for (size_t done = 0; done < len;) {
+            size_t pos = (head + offset + done) & mask;
+            size_t n = buf.size() - pos;
+            if (n > len - done) n = len - done;
+            std::memcpy(dst + done, buf.data() + pos, n);
+            done += n;
+        }
+    }
+
+    uint8_t peek(size_t offset) const {
+        return static_cast<uint8_t>(buf[(head + offset) & (buf.size() - 1)]);
+    }
+
+    void consume(size_t len) {
+        head += len;
+        if (head == tail) head = tail = 0;
+    }
+
+    std::string take(size_t len) {
+        std::string out;
+        take_into(out, len);
+        return out;
+    }
+
+    // Like take(), but reuses the capacity of dst (any string type)
+    template <typename String>
+    void take_into(String& dst, size_t len) {
+        dst.resize(len);
+        copy_out(0, &dst[0], len);
+        consume(len);
+    }
+
+private:
+    void reserve(size_t needed) {
+        if (needed <= buf.size()) return;
+        size_t capacity = buf.empty() ? 1024 : buf.size();
+        while (capacity < needed) capacity *= 2;
+
+        std::vector<char> grown(capacity);
+        size_t used = size();
+        if (used > 0) copy_out(0, grown.data(), used);
+        buf.swap(grown);
+        head = 0;
+        tail = used;
+    }
+
+    std::vector<char> buf;  // size is always zero or a power of two
+    size_t head = 0;
+    size_t tail = 0;
+};
+
+inline uint32_t load_be32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+inline void store_be32(char* p, uint32_t v) {
+    v = htonl(v);
+    std::memcpy(p, &v, sizeof(v));
+}
+
+// Decides the protocol from the first received byte; consumes the magic.
+inline ProtocolMode detect_protocol(RingBuffer& in) {
+    if (in.empty()) return ProtocolMode::Unknown;
+    if (in.peek(0) == FRAME_MAGIC) {
+        in.consume(1);
+        return ProtocolMode::Framed;
+    }
+    return ProtocolMode::Legacy;
+}
+
+inline FrameStatus next_frame(RingBuffer& in, Frame& frame) {
+    if (in.size() < FRAME_HEADER_SIZE) return FrameStatus::Incomplete;
+
+    char header[FRAME_HEADER_SIZE];
+    in.copy_out(0, header, sizeof(header));
+    uint32_t length = load_be32(header);
+    if (length > MAX_FRAME_PAYLOAD) return FrameStatus::Invalid;
+    if (in.size() < FRAME_HEADER_SIZE + length) return FrameStatus::Incomplete;
+
+    frame.request_id = load_be32(header + 4);
+    in.consume(FRAME_HEADER_SIZE);
+    in.take_into(frame.payload, length);
+    return FrameStatus::Ready;
+}
+
+inline void append_frame(std::string& out, uint32_t request_id, std::string_view payload) {
+    char header[FRAME_HEADER_SIZE];
+    store_be32(header, static_cast<uint32_t>(payload.size()));
+    store_be32(header + 4, request_id);
+    out.append(header, sizeof(header));
+    out += payload;
+}
+
+// For payloads written straight into out: begin_frame() reserves the
+// header, end_frame() fills it in once the payload is complete.
+template <typename String>
+size_t begin_frame(String& out) {
+    size_t start = out.size();
+    out.append(FRAME_HEADER_SIZE, '\0');
+    return start;
+}
+
+template <typename String>
+void end_frame(String& out, size_t start, uint32_t request_id) {
+    store_be32(&out[start], static_cast<uint32_t>(out.size() - start - FRAME_HEADER_SIZE));
+    store_be32(&out[start + 4], request_id);
+}
@@ -0,0 +1,599 @@
+#pragma once
+
+// Edge-triggered epoll reactor serving command connections.
+//
+// Every reactor thread owns its own listening sockets (SO_REUSEPORT, the
+// kernel balances accepts) and the connections accepted on them, so no
+// connection state is shared between threads. A listener is bound to a
+// command registry; a server can listen on several ports that answer
+// different command sets from the same event loop. A unix socket listener
+// (local_socket.h) cannot be shared out by the kernel, so only the first
+// reactor gets one.
+//
+// Other threads reach a connection only through its reactor's mailbox
+// (subscription updates, deferred replies). A legacy request answered later
+// leaves an empty slot in the output queue that its reply fills, so
+// responses still go out in request order; a framed reply carries its
+// request id and is queued when it arrives. A closing connection stays
+// until its deferred replies are sent. Pushed buffers are shared between subscribers and
+// queued by reference behind any pending responses; output goes out with
+// one sendmsg over all queued pieces. A connection that does not read its
+// updates keeps at most MAX_QUEUED_PUSHES of them, the oldest unsent
+// droppable ones (periodic values, mouse motion) are dropped first; others
+// (button events) only go once the queue reaches twice the limit.
+//
+// A client that sends requests but does not read the replies is not read
+// either once OUTPUT_HIGH_WATER bytes of output wait for it; reading resumes
+// when the backlog is under OUTPUT_LOW_WATER. Framed requests are answered
+// as they are read, so the backlog includes their replies.
+//
+// uring_reactor.h drives the same connections through io_uring.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "command_registry.h"
+#include "local_socket.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "subscriptions.h"
+
+struct ReactorListener {
+    int fd;
+    const CommandRegistry* commands;
+    bool seqpacket = false;     // AF_UNIX SOCK_SEQPACKET (local_socket.h)
+};
+
+// State shared by all reactor threads of a process
+struct ReactorContext {
+    std::atomic<uint32_t> next_client_id{1};
+    std::atomic<int> active_connections{0};
+    std::atomic<uint64_t> pushes_dropped{0};
+    MetricsRegistry* metrics = nullptr;
+    int wakeup_fd = -1;     // becomes readable when the loops must return
+};
+
+// A piece of output queued ahead of Connection::out
+struct OutSegment {
+    std::shared_ptr<const std::string> shared;  // pushed update, shared with other subscribers
+    ResponseBuffer owned;                       // responses that were pending when it arrived
+    bool droppable = false;
+    uint32_t awaiting = 0;                      // slot of a deferred reply not here yet; output stops at it
+
+    std::string_view data() const { return shared ? std::string_view(*shared) : std::string_view(owned); }
+};
+
+const size_t MAX_QUEUED_PUSHES = 32;
+const int MAX_IOV = 64;
+const size_t OUTPUT_HIGH_WATER = 256 * 1024;
+const size_t OUTPUT_LOW_WATER = 64 * 1024;
+
+// Per-connection state driven by the reactor. A fresh connection only holds
+// the fd and a few empty containers; the request and response buffers keep
+// their capacity after the first requests, so later ones do not allocate.
+struct Connection : PushTarget, ReplyTarget {
+    int fd = -1;
+    uint32_t id = 0;
+    const CommandRegistry* commands = nullptr;
+    std::shared_ptr<ReactorMailbox> mailbox;
+    ProtocolMode mode = ProtocolMode::Unknown;
+    RingBuffer in;
+    Frame request;                      // reused for every request
+    std::vector<OutSegment> queued;     // sent before out
+    size_t queued_pushes = 0;
+    size_t queued_bytes = 0;            // data of queued
+    ResponseBuffer out;                 // responses are appended here
+    size_t out_offset = 0;              // into the first unsent piece
+    bool closing = false;
+    bool input_paused = false;          // output above OUTPUT_HIGH_WATER, not read until it drains
+    bool seqpacket = false;             // AF_UNIX SOCK_SEQPACKET (local_socket.h)
+    size_t message_limit = LOCAL_MAX_MESSAGE;   // seqpacket: largest message sent
+    unsigned late_replies = 0;          // deferred replies still to arrive
+    uint32_t last_slot = 0;
+    std::shared_ptr<PushChannel> channel;
+
+    std::shared_ptr<PushChannel> push_channel() override {
+        if (!channel) {
+            channel = std::make_shared<PushChannel>();
+            channel->mailbox = mailbox;
+            channel->fd = fd;
+            channel->client_id = id;
+            channel->framed = mode == ProtocolMode::Framed;
+        }
+        return channel;
+    }
+
+    std::shared_ptr<DeferredReply> defer_reply() override;
+};
+
+// Brings a deferred response back to the connection's reactor
+class ReactorReply final : public DeferredReply {
+public:
+    ReactorReply(std::shared_ptr<ReactorMailbox> mailbox, int fd, uint32_t client_id, bool framed,
+                 uint32_t request_id, uint32_t slot)
+        : mailbox(std::move(mailbox)), fd(fd), client_id(client_id), framed(framed), request_id(request_id),
+          slot(slot) {}
+
+    // The connection waits for every reply, so an abandoned one still answers
+    ~ReactorReply() override {
+        if (!completed) complete("");
+    }
+
+    void complete(std::string_view response) override {
+        completed = true;
+        std::string data;
+        if (framed) {
+            append_frame(data, request_id, response);
+        } else {
+            data.assign(response);
+        }
+        std::vector<PushMessage> messages;
+        messages.push_back({fd, client_id, std::make_shared<const std::string>(std::move(data)), false, true, slot});
+        mailbox->post(messages);
+    }
+
+private:
+    std::shared_ptr<ReactorMailbox> mailbox;
+    int fd;
+    uint32_t client_id;
+    bool framed;
+    uint32_t request_id;
+    uint32_t slot;
+    bool completed = false;
+};
+
+inline std::shared_ptr<DeferredReply> Connection::defer_reply() {
+    late_replies++;
+    bool framed = mode == ProtocolMode::Framed;
+    uint32_t slot = 0;
+    if (!framed) {
+        if (++last_slot == 0) ++last_slot;
+        slot = last_slot;
+    }
+    return std::make_shared<ReactorReply>(mailbox, fd, id, framed, request.request_id, slot);
+}
+
+const int MAX_EVENTS = 256;
+
+inline void queue_segment(Connection& conn, OutSegment segment) {
+    conn.queued_bytes += segment.data().size();
+    conn.queued.push_back(std::move(segment));
+}
+
+// Bytes waiting to be sent
+inline size_t output_backlog(const Connection& conn) {
+    return conn.queued_bytes + conn.out.size() - conn.out_offset;
+}
+
+// Queues a pushed buffer behind everything already pending. Returns false
+// if an older update had to be dropped to make room.
+inline bool queue_push(Connection& conn, std::shared_ptr<const std::string> data, bool droppable = true) {
+    if (conn.closing) return true;
+    if (!conn.out.empty()) {
+        // out_offset keeps pointing into the first piece
+        queue_segment(conn, {nullptr, std::move(conn.out), false});
+        conn.out.clear();
+    }
+
+    bool dropped = false;
+    if (conn.queued_pushes >= MAX_QUEUED_PUSHES) {
+        bool overflowing = conn.queued_pushes >= 2 * MAX_QUEUED_PUSHES;
+        for (size_t i = 0; i < conn.queued.size(); ++i) {
+            if (!conn.queued[i].shared || (i == 0 && conn.out_offset > 0)) continue;
+            if (!conn.queued[i].droppable && !overflowing) continue;
+            conn.queued_bytes -= conn.queued[i].data().size();
+            conn.queued.erase(conn.queued.begin() + i);
+            conn.queued_pushes--;
+            dropped = true;
+            break;
+        }
+    }
+    queue_segment(conn, {std::move(data), {}, droppable});
+    conn.queued_pushes++;
+    return !dropped;
+}
+
+// Marks sent bytes as done, front to back.
+inline void advance_output(Connection& conn, size_t sent) {
+    size_t done = 0;
+    while (sent > 0 && done < conn.queued.size()) {
+        size_t left = conn.queued[done].data().size() - conn.out_offset;
+        if (sent < left) {
+            conn.out_offset += sent;
+            sent = 0;
+            break;
+        }
+        sent -= left;
+        conn.out_offset = 0;
+        conn.queued_bytes -= conn.queued[done].data().size();
+        if (conn.queued[done].shared) conn.queued_pushes--;
+        done++;
+    }
+    conn.queued.erase(conn.queued.begin(), conn.queued.begin() + done);
+    conn.out_offset += sent;
+}
+
+// Closes the pending response as a piece of its own, so that on a seqpacket
+// connection it leaves as a separate message.
+inline void seal_response(Connection& conn) {
+    if (conn.out.empty()) return;
+    queue_segment(conn, {nullptr, std::move(conn.out), false});
+    conn.out.clear();
+}
+
+// Keeps the place of a legacy response deferred by its handler, behind
+// the responses before it and ahead of those after it
+inline void hold_reply_slot(Connection& conn) {
+    seal_response(conn);
+    OutSegment slot;
+    slot.awaiting = conn.last_slot;
+    queue_segment(conn, std::move(slot));
+}
+
+// Takes a deferred response coming back through the mailbox
+inline void deliver_reply(Connection& conn, const PushMessage& reply) {
+    if (conn.late_replies > 0) conn.late_replies--;
+    if (reply.slot) {
+        for (auto& segment : conn.queued) {
+            if (segment.awaiting != reply.slot) continue;
+            segment.owned.assign(*reply.data);
+            conn.queued_bytes += segment.owned.size();
+            segment.awaiting = 0;
+            break;
+        }
+        return;
+    }
+    // A whole frame; out_offset keeps pointing into the first piece
+    if (!conn.out.empty()) {
+        queue_segment(conn, {nullptr, std::move(conn.out), false});
+        conn.out.clear();
+    }
+    queue_segment(conn, {nullptr, ResponseBuffer(*reply.data), false});
+}
+
+// Returns false when the connection must be dropped.
+inline bool flush_output(Connection& conn) {
+    while (true) {
+        struct iovec iov[MAX_IOV];
+        int count = 0;
+        size_t offset = conn.out_offset;
+        bool held = false;
+        // A seqpacket send is one message: one piece, cut at message_limit
+        int max_iov = conn.seqpacket ? 1 : MAX_IOV;
+        size_t budget = conn.seqpacket ? conn.message_limit : SIZE_MAX;
+        for (size_t i = 0; i < conn.queued.size() && count < max_iov; ++i) {
+            if (conn.queued[i].awaiting) {
+                held = true;
+                break;
+            }
+            std::string_view data = conn.queued[i].data();
+            iov[count].iov_base = const_cast<char*>(data.data()) + offset;
+            iov[count].iov_len = std::min(data.size() - offset, budget);
+            budget -= iov[count].iov_len;
+            offset = 0;
+            count++;
+        }
+        if (!held && count < max_iov && conn.out.size() > offset) {
+            iov[count].iov_base = &conn.out[offset];
+            iov[count].iov_len = std::min(conn.out.size() - offset, budget);
+            count++;
+        }
+        if (count == 0) break;
+
+        struct msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t sent = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            return false;
+        }
+        advance_output(conn, sent);
+    }
+    // The rest waits for a deferred reply
+    if (!conn.queued.empty()) return true;
+    conn.out.clear();
+    conn.out_offset = 0;
+    return !conn.closing || conn.late_replies > 0;
+}
+
+inline void detect_mode(Connection& conn) {
+    if (conn.mode != ProtocolMode::Unknown) return;
+    conn.mode = detect_protocol(conn.in);
+    // A legacy reply must leave as one message however long it is
+    if (conn.mode == ProtocolMode::Legacy && conn.seqpacket) conn.message_limit = allow_large_messages(conn.fd);
+}
+
+// Answers every complete request buffered on the connection. Framed
+// requests are parsed one by one, so pipelined or coalesced frames are all
+// served, as far as the output high-water mark allows; the legacy protocol
+// has no framing, so everything read in one readiness round is one
+// command, as it was with a single blocking recv.
+inline bool process_input(Connection& conn) {
+    detect_mode(conn);
+
+    if (conn.mode == ProtocolMode::Legacy) {
+        if (conn.in.empty()) return true;
+        bool close_connection = false;
+        conn.in.take_into(conn.request.payload, conn.in.size());
+        if (!conn.commands->dispatch_to(conn.out, conn.request.payload, conn.id, close_connection, &conn, &conn)) {
+            hold_reply_slot(conn);
+        }
+        if (close_connection) conn.closing = true;
+        return true;
+    }
+
+    // Frames beyond the high-water mark wait in the buffer
+    while (!conn.closing && output_backlog(conn) < OUTPUT_HIGH_WATER) {
+        FrameStatus status = next_frame(conn.in, conn.request);
+        if (status == FrameStatus::Incomplete) break;
+        if (status == FrameStatus::Invalid) return false;
+
+        // The response is written in place behind a reserved frame header
+        bool close_connection = false;
+        size_t start = begin_frame(conn.out);
+        if (conn.commands->dispatch_to(conn.out, conn.request.payload, conn.id, close_connection, &conn, &conn)) {
+            end_frame(conn.out, start, conn.request.request_id);
+        } else {
+            conn.out.resize(start);
+        }
+        if (close_connection) conn.closing = true;
+    }
+    return true;
+}
+
+// Drains the socket (edge-triggered) into the connection's ring buffer and
+// answers what was read. A seqpacket connection is answered message by
+// message, so each legacy command gets its own response, and framed
+// requests are answered as they arrive. Reading stops early, leaving the
+// rest in the socket, once the output backlog reaches OUTPUT_HIGH_WATER;
+// flush_and_resume() picks it up again.
+inline bool handle_readable(Connection& conn) {
+    while (true) {
+        bool peer_closed = false;
+        while (true) {
+            if (conn.input_paused || output_backlog(conn) >= OUTPUT_HIGH_WATER) {
+                conn.input_paused = true;
+                break;
+            }
+            ssize_t bytes_read;
+            if (conn.seqpacket) {
+                bytes_read = recv_message(conn.fd, conn.in);
+                if (bytes_read > 0 && !conn.closing) {
+                    if (!process_input(conn)) return false;
+                    // A legacy response is one message, like its command
+                    if (conn.mode == ProtocolMode::Legacy) seal_response(conn);
+                }
+            } else {
+                auto area = conn.in.write_area(1024);
+                bytes_read = recv(conn.fd, area.first, area.second, 0);
+                if (bytes_read > 0) {
+                    conn.in.commit(bytes_read);
+                    detect_mode(conn);
+                    // A legacy command longer than any frame is cut there
+                    bool answer = conn.mode == ProtocolMode::Framed ||
+                                  (conn.mode == ProtocolMode::Legacy && conn.in.size() >= MAX_FRAME_PAYLOAD);
+                    if (answer && !conn.closing && !process_input(conn)) return false;
+                }
+            }
+            if (bytes_read > 0) continue;
+            if (bytes_read == 0) {
+                peer_closed = true;
+                break;
+            }
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+
+        if (!conn.closing && !process_input(conn)) return false;
+        // Requests held back by the high-water mark are answered after a
+        // resume, even when the peer has finished sending
+        if (output_backlog(conn) >= OUTPUT_HIGH_WATER) conn.input_paused = true;
+        if (peer_closed && !conn.input_paused) conn.closing = true;
+        if (!flush_output(conn)) return false;
+        // Paused, but the socket took the backlog at once: no EPOLLOUT
+        // edge will come, so go on reading here
+        if (!conn.input_paused || conn.closing || output_backlog(conn) > OUTPUT_LOW_WATER) return true;
+        conn.input_paused = false;
+    }
+}
+
+// Sends what it can; a connection paused by the high-water mark is read
+// again once its backlog is under OUTPUT_LOW_WATER
+inline bool flush_and_resume(Connection& conn) {
+    if (!flush_output(conn)) return false;
+    if (!conn.input_paused || output_backlog(conn) > OUTPUT_LOW_WATER) return true;
+    conn.input_paused = false;
+    return handle_readable(conn);
+}
+
+inline int create_listen_socket(int port, int backlog) {
+    int server_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(server_socket < 0) {
+        std::cerr << "Socket creation error: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    int reuse = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    // Every reactor binds its own listener, the kernel balances accepts
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+
+    struct sockaddr_in server_addr;
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+
+    if(bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        std::cerr << "Bind error on port " << port << ": " << strerror(errno) << std::endl;
+        close(server_socket);
+        return -1;
+    }
+
+    if(listen(server_socket, backlog) < 0) {
+        std::cerr << "Listen error: " << strerror(errno) << std::endl;
+        close(server_socket);
+        return -1;
+    }
+    return server_socket;
+}
+
+inline void reactor_loop(ReactorContext& context, std::vector<ReactorListener> listeners) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        std::cerr << "epoll_create1 error: " << strerror(errno) << std::endl;
+        return;
+    }
+
+    std::unordered_map<int, ReactorListener> listener_by_fd;
+    for (const auto& listener : listeners) {
+        struct epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = listener.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener.fd, &ev);
+        listener_by_fd[listener.fd] = listener;
+    }
+    // Shared with the push channels of its connections, see PushChannel
+    auto mailbox = std::make_shared<ReactorMailbox>();
+    {
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = mailbox->fd();
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mailbox->fd(), &ev);
+    }
+    if (context.wakeup_fd >= 0) {
+        // Level-triggered and never read, so every reactor sees it
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = context.wakeup_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, context.wakeup_fd, &ev);
+    }
+
+    std::unordered_map<int, Connection> connections;
+    auto drop = [&](int fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        auto it = connections.find(fd);
+        if (it->second.channel) it->second.channel->open = false;
+        connections.erase(it);
+        context.active_connections--;
+    };
+    std::vector<PushMessage> pushes;
+
+    struct epoll_event events[MAX_EVENTS];
+    bool running = true;
+    while (running) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "epoll_wait error: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+
+            if (fd == context.wakeup_fd) {
+                running = false;
+                continue;
+            }
+
+            if (fd == mailbox->fd()) {
+                mailbox->drain(pushes);
+                for (auto& push : pushes) {
+                    auto it = connections.find(push.fd);
+                    if (it == connections.end() || it->second.id != push.client_id) continue;
+                    if (push.reply) {
+                        deliver_reply(it->second, push);
+                    } else if (!queue_push(it->second, std::move(push.data), push.droppable)) {
+                        context.pushes_dropped++;
+                    }
+                }
+                // Flush once per connection, after all of its updates are queued
+                for (auto& push : pushes) {
+                    auto it = connections.find(push.fd);
+                    if (it == connections.end() || it->second.id != push.client_id) continue;
+                    if ((!it->second.queued.empty() || it->second.closing) && !flush_and_resume(it->second)) drop(push.fd);
+                }
+                pushes.clear();
+                continue;
+            }
+
+            auto listener = listener_by_fd.find(fd);
+            if (listener != listener_by_fd.end()) {
+                while (true) {
+                    int client_socket = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (client_socket < 0) {
+                        if (errno == EINTR) continue;
+                        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                            std::cerr << "Accept error: " << strerror(errno) << std::endl;
+                        }
+                        break;
+                    }
+
+                    struct epoll_event client_ev{};
+                    client_ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                    client_ev.data.fd = client_socket;
+                    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &client_ev) < 0) {
+                        close(client_socket);
+                        continue;
+                    }
+                    Connection& conn = connections[client_socket];
+                    conn.fd = client_socket;
+                    conn.id = context.next_client_id++;
+                    conn.commands = listener->second.commands;
+                    conn.seqpacket = listener->second.seqpacket;
+                    conn.mailbox = mailbox;
+                    context.active_connections++;
+                    if (context.metrics) context.metrics->record_connection();
+                }
+                continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+            Connection& conn = it->second;
+
+            bool keep = true;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                keep = false;
+            } else {
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP)) keep = handle_readable(conn);
+                if (keep && (events[i].events & EPOLLOUT)) keep = flush_and_resume(conn);
+            }
+            if (!keep) drop(fd);
+        }
+    }
+
+    for (auto& entry : connections) {
+        if (entry.second.channel) entry.second.channel->open = false;
+        close(entry.first);
+    }
+    context.active_connections -= int(connections.size());
+    close(epoll_fd);
+}
+
+// Lift the fd soft limit to the hard one so a single process can hold
+// tens of thousands of idle connections.
+inline void raise_fd_limit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
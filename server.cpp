@@ -0,0 +1,289 @@
+// Unified server: the commands of server1 and server2 and the log writer of
+// log_server in one process.
+//
+// The main port answers every command, so a client needs a single
+// (framed, pipelined) connection for memory, mouse, thread and window
+// requests. The old ports 8080 and 8081 are kept as compatibility
+// listeners that answer exactly the command set and wording of the server
+// that used to own them. SUBSCRIBE MEMORY|THREAD_COUNT streams updates and
+// WATCH_MOUSE streams input events on the main port, HISTORY MEMORY returns
+// up to a day of samples in one response. Events are logged through an
+// in-process ring to logs/server.log without a separate log_server.
+// Every port has a unix socket twin (local_socket.h) for clients on this
+// host.
+//
+//   g++ -std=c++17 -O2 -o server server.cpp -levdev -lX11 -lz -pthread
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "command_modules.h"
+#include "history.h"
+#include "local_socket.h"
+#include "log_ring.h"
+#include "log_writer.h"
+#include "metrics.h"
+#include "mouse_events.h"
+#include "mouse_inventory.h"
+#include "procfs.h"
+#include "proc_events.h"
+#include "reactor.h"
+#include "uring_reactor.h"
+#include "window_mover.h"
+
+std::atomic<bool> logging{true};
+int wakeup_fd = -1;
+
+LogProducer* log_producer = nullptr;
+
+void send_log(std::string_view event_type, std::string_view data, uint32_t client_id = 0) {
+    if (log_producer) log_producer->publish(event_type, data, client_id);
+}
+
+MetricsRegistry metrics("server");
+ReactorContext reactor_context;
+
+int env_int(const char* name, int default_value) {
+    const char* value = std::getenv(name);
+    if (!value || !*value) return default_value;
+    return std::atoi(value);
+}
+
+void signal_handler(int) {
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeup_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+int main() {
+    wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    std::signal(SIGINT, signal_handler);
+    std::signal(SIGTERM, signal_handler);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // SERVER_PORT - port answering all commands,
+    // SERVER1_PORT / SERVER2_PORT - compatibility listeners (0 disables),
+    // SERVER_BACKLOG - listen() backlog, SERVER_REACTORS - event loop threads,
+    // SERVER_SOCKET / SERVER1_SOCKET / SERVER2_SOCKET - unix sockets for local
+    // clients with the same command sets ("@name" abstract, "" disables)
+    int port = env_int("SERVER_PORT", 8082);
+    int server1_port = env_int("SERVER1_PORT", 8080);
+    int server2_port = env_int("SERVER2_PORT", 8081);
+    int backlog = env_int("SERVER_BACKLOG", SOMAXCONN);
+    int reactors = std::max(1, env_int("SERVER_REACTORS", 1));
+
+    raise_fd_limit();
+
+    // IO_BACKEND - epoll (default) or uring
+    auto run_reactor = select_reactor_loop(std::getenv("IO_BACKEND"));
+
+    // The listeners come first, so that a busy port fails before any worker
+    // thread runs. Every reactor gets its own socket per port (SO_REUSEPORT);
+    // the command sets are filled in further down.
+    CommandRegistry server1_commands(&metrics);
+    CommandRegistry server2_commands(&metrics);
+    CommandRegistry all_commands(&metrics);
+    std::vector<std::vector<ReactorListener>> listeners(reactors);
+    auto close_listeners = [&listeners] {
+        for (const auto& reactor_listeners : listeners) {
+            for (const auto& listener : reactor_listeners) close(listener.fd);
+        }
+    };
+    const std::pair<int, const CommandRegistry*> ports[] = {
+        {port, &all_commands}, {server1_port, &server1_commands}, {server2_port, &server2_commands}};
+    for (auto& reactor_listeners : listeners) {
+        for (const auto& entry : ports) {
+            if (entry.first <= 0) continue;
+            int fd = create_listen_socket(entry.first, backlog);
+            if (fd < 0) {
+                close_listeners();
+                return 1;
+            }
+            reactor_listeners.push_back({fd, entry.second});
+        }
+    }
+    const std::pair<std::string, const CommandRegistry*> sockets[] = {
+        {local_socket_name("SERVER_SOCKET", SERVER_SOCKET), &all_commands},
+        {local_socket_name("SERVER1_SOCKET", SERVER1_SOCKET), &server1_commands},
+        {local_socket_name("SERVER2_SOCKET", SERVER2_SOCKET), &server2_commands}};
+    for (const auto& entry : sockets) {
+        if (entry.first.empty()) continue;
+        int fd = create_local_listen_socket(entry.first, backlog);
+        if (fd < 0) {
+            close_listeners();
+            return 1;
+        }
+        listeners[0].push_back({fd, entry.second, true});
+    }
+
+    // Same knobs as log_server; everything goes to logs/server.*
+    mkdir("logs", 0777);
+    LogWriterOptions log_options;
+    log_options.flush_bytes = env_int("LOG_FLUSH_BYTES", log_options.flush_bytes);
+    log_options.flush_interval_ms = env_int("LOG_FLUSH_MS", log_options.flush_interval_ms);
+    log_options.fsync = parse_fsync_policy(std::getenv("LOG_FSYNC"));
+    log_options.format = parse_log_format(std::getenv("LOG_FORMAT"));
+    log_options.fsync_interval_ms = env_int("LOG_FSYNC_MS", log_options.fsync_interval_ms);
+    log_options.stats_interval_s = env_int("LOG_STATS_S", log_options.stats_interval_s);
+    log_options.rotate_bytes = uint64_t(env_int("LOG_ROTATE_MB", int(log_options.rotate_bytes >> 20))) << 20;
+    log_options.rotate_interval_s = env_int("LOG_ROTATE_S", log_options.rotate_interval_s);
+    log_options.compress_level = env_int("LOG_COMPRESS", log_options.compress_level);
+    log_options.max_pending = size_t(std::max(1, env_int("LOG_MAX_PENDING", int(log_options.max_pending))));
+    LogWriter log_writer(log_options);
+
+    LogConsumer log_consumer;
+    if (!log_consumer.open_private()) {
+        std::cerr << "Log ring error: " << strerror(errno) << std::endl;
+        close_listeners();
+        return 1;
+    }
+    LogProducer producer(log_consumer.ring());
+    log_producer = &producer;
+    std::thread log_thread(pump_log_ring<LogWriter>, std::ref(log_consumer), "server", std::ref(log_writer), std::cref(logging));
+
+    // INPUT_DIR - where to look for input devices (a fake tree for testing)
+    const char* input_dir = std::getenv("INPUT_DIR");
+    MouseInventory inventory(input_dir && *input_dir ? input_dir : "/dev/input/");
+    inventory.start();
+
+    // MOUSE_BATCH_MS - how long input events are collected into one WATCH_MOUSE frame
+    MouseEventStream mouse_events(inventory, env_int("MOUSE_BATCH_MS", 10));
+    mouse_events.start();
+
+    // SAMPLE_INTERVAL_MS - how often /proc is re-read for MEMORY and THREAD_COUNT.
+    // With io_uring the meminfo reads are asynchronous too.
+    int sample_interval = env_int("SAMPLE_INTERVAL_MS", 500);
+    std::function<size_t()> sample_memory = get_free_memory;
+    std::unique_ptr<AsyncProcfsReader> meminfo;
+    if (run_reactor == uring_reactor_loop) {
+        meminfo.reset(new AsyncProcfsReader("/proc/meminfo"));
+        if (meminfo->ok()) sample_memory = [&meminfo] { return meminfo->sample(parse_free_memory); };
+    }
+    PeriodicSampler<size_t> memory_sampler(sample_memory, sample_interval, get_free_memory);
+    memory_sampler.start();
+    PeriodicSampler<int> thread_sampler(count_system_threads, sample_interval);
+
+    // THREAD_EVENTS - keep THREAD_COUNT current from proc connector events
+    // (0 - sample /proc), THREAD_RECONCILE_S - full /proc reconcile period
+    ProcEventCounter thread_events(env_int("THREAD_RECONCILE_S", 30));
+    bool event_driven = env_int("THREAD_EVENTS", 1) != 0 && thread_events.start();
+    if (env_int("THREAD_EVENTS", 1) != 0 && !event_driven) {
+        std::cerr << "Proc connector unavailable (needs CAP_NET_ADMIN before Linux 6.6), sampling /proc for THREAD_COUNT" << std::endl;
+    }
+    if (!event_driven) thread_sampler.start();
+
+    // HISTORY MEMORY: the sampled value once a second, kept for a day
+    MetricHistory memory_history("MEMORY");
+    memory_history.start([&memory_sampler] { return double(memory_sampler.get()); });
+
+    // SUBSCRIBE_TICK_MS - how often subscriptions are checked for updates
+    SubscriptionHub subscriptions(env_int("SUBSCRIBE_TICK_MS", 100));
+    subscriptions.add_topic("MEMORY", [&memory_sampler] { return double(memory_sampler.get()); });
+    subscriptions.add_topic("THREAD_COUNT", [&, event_driven] {
+        return double(event_driven ? thread_events.get() : thread_sampler.get());
+    });
+    subscriptions.start();
+
+    // Without X the other commands still work, MOVE_WINDOW reports an error
+    WindowMover window_mover;
+    if (!window_mover.open()) {
+        std::cerr << "MOVE_WINDOW disabled: no X server or terminal window" << std::endl;
+        send_log("SERVER_ERROR", "X11 connection failed");
+    }
+    window_mover.start();
+
+    // METRICS_PORT - Prometheus endpoint, 0 disables it
+    // METRICS_ADDR - address it listens on, loopback only by default
+    int metrics_port = env_int("METRICS_PORT", 9182);
+    metrics.add_gauge("server_active_connections", "Open client connections.",
+                      [] { return double(reactor_context.active_connections.load()); });
+    metrics.add_gauge("server_subscriptions", "Active SUBSCRIBE registrations.",
+                      [&subscriptions] { return double(subscriptions.subscriber_count()); });
+    metrics.add_gauge("server_mouse_watchers", "Connections receiving WATCH_MOUSE events.",
+                      [&mouse_events] { return double(mouse_events.watcher_count()); });
+    metrics.add_gauge("server_pushes_dropped", "Subscription updates dropped for slow clients.",
+                      [] { return double(reactor_context.pushes_dropped.load()); });
+    metrics.add_gauge("server_log_dropped", "Log records dropped because the log ring was full.",
+                      [&log_consumer] { return double(log_consumer.dropped()); });
+    metrics.add_gauge("server_log_truncated", "Log records cut to fit a log ring slot.",
+                      [&log_consumer] { return double(log_consumer.truncated()); });
+    metrics.add_gauge("server_log_stale_slots", "Log ring slots a producer left claimed for over a second.",
+                      [&log_consumer] { return double(log_consumer.stale()); });
+    if (event_driven) {
+        metrics.add_gauge("server_thread_events", "Process events applied to THREAD_COUNT.",
+                          [&thread_events] { return double(thread_events.events()); });
+        metrics.add_gauge("server_thread_count_correction", "Change made by the last full /proc reconcile.",
+                          [&thread_events] { return double(thread_events.last_correction()); });
+    }
+    const char* metrics_addr = std::getenv("METRICS_ADDR");
+    if (metrics_port > 0 &&
+        !metrics.serve_prometheus(metrics_port, metrics_addr && *metrics_addr ? metrics_addr : "127.0.0.1")) {
+        std::cerr << "Metrics endpoint error: " << strerror(errno) << std::endl;
+    }
+
+    server1_commands.set_logger(send_log);
+    register_memory_module(server1_commands, memory_sampler);
+    register_mouse_module(server1_commands, inventory);
+    register_control_commands(server1_commands, metrics, SERVER1_TEXTS);
+
+    server2_commands.set_logger(send_log);
+    if (event_driven) {
+        register_thread_module(server2_commands, thread_events);
+    } else {
+        register_thread_module(server2_commands, thread_sampler);
+    }
+    register_window_module(server2_commands, window_mover);
+    register_control_commands(server2_commands, metrics, SERVER2_TEXTS);
+
+    all_commands.set_logger(send_log);
+    all_commands.merge(server2_commands);
+    all_commands.merge(server1_commands);
+    register_subscription_module(all_commands, subscriptions);
+    register_history_module(all_commands, {&memory_history});
+    register_mouse_events_module(all_commands, mouse_events);
+    register_control_commands(all_commands, metrics, SERVER1_TEXTS);
+
+    reactor_context.metrics = &metrics;
+    reactor_context.wakeup_fd = wakeup_fd;
+
+    std::cout << "Server started on port " << port << " (compatibility ports "
+              << server1_port << ", " << server2_port << ")" << std::endl;
+    send_log("SERVER_START", "Server started on port " + std::to_string(port));
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < listeners.size(); ++i) {
+        threads.emplace_back(run_reactor, std::ref(reactor_context), listeners[i]);
+    }
+    run_reactor(reactor_context, listeners[0]);
+    for (auto& t : threads) t.join();
+    close_listeners();
+
+    send_log("SERVER_STOP", "Server stopped");
+    std::cout << "Server stopped" << std::endl;
+
+    window_mover.stop();
+    subscriptions.stop();
+    mouse_events.stop();
+    thread_events.stop();
+    thread_sampler.stop();
+    memory_history.stop();
+    memory_sampler.stop();
+    inventory.stop();
+
+    logging = false;
+    log_thread.join();
+    log_producer = nullptr;
+    log_writer.stop();
+    close(wakeup_fd);
+    return 0;
+}
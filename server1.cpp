@@ -1,201 +1,158 @@
 #include <iostream>
 #include <sys/socket.h>
-#include <netinet/in.h>
 #include <unistd.h>
 #include <thread>
-#include <mutex>
-#include <fcntl.h>
-#include <libevdev-1.0/libevdev/libevdev.h>
-#include <dirent.h>
 #include <vector>
 #include <string>
-#include <system_error>
-#include <fstream>
-#include <sstream>
+#include <cerrno>
 #include <cstring>
-#include <arpa/inet.h> 
-#include <ctime> // Для inet_pton
-
-std::mutex mtx;
-
-const char* LOG_FIFO = "/tmp/server1_log.fifo";
-
-void send_log(const std::string& event_type, const std::string& data) {
-    int fd = open(LOG_FIFO, O_WRONLY | O_NONBLOCK);
-    if (fd == -1) return;
-    
-    std::string message = event_type + "|" + data;
-    write(fd, message.c_str(), message.size());
-    close(fd);
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include "protocol.h"
+#include "log_ring.h"
+#include "log_net.h"
+#include "history.h"
+#include "mouse_events.h"
+#include "mouse_inventory.h"
+#include "procfs.h"
+#include "metrics.h"
+#include "command_modules.h"
+#include "local_socket.h"
+#include "reactor.h"
+#include "uring_reactor.h"
+
+LogProducer log_producer(SERVER1_LOG_RING);
+LogShipping log_shipping;
+
+void send_log(std::string_view event_type, std::string_view data, uint32_t client_id = 0) {
+    log_producer.publish(event_type, data, client_id);
 }
 
-struct MouseInfo {
-    std::string name;
-    std::string devnode;
-    int buttons;
-};
-
-std::vector<MouseInfo> detect_mice() {
-    std::vector<MouseInfo> mice;
-    const std::string input_dir = "/dev/input/";
-
-    DIR *dir = opendir(input_dir.c_str());
-    if (!dir) {
-        throw std::system_error(errno, std::system_category(), "opendir failed");
-    }
-
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != nullptr) {
-        if (entry->d_type != DT_CHR) continue;
-
-        std::string path = input_dir + entry->d_name;
-        int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
-        if (fd < 0) continue;
-
-        struct libevdev *dev = nullptr;
-        int rc = libevdev_new_from_fd(fd, &dev);
-        if (rc != 0) {
-            close(fd);
-            continue;
-        }
-
-        if (libevdev_has_event_type(dev, EV_REL) &&
-            libevdev_has_event_code(dev, EV_KEY, BTN_LEFT)) {
-            
-            MouseInfo info;
-            info.name = libevdev_get_name(dev);
-            info.devnode = path;
-            info.buttons = 0;
-
-            for (int code = BTN_LEFT; code <= BTN_TASK; ++code) {
-                if (libevdev_has_event_code(dev, EV_KEY, code)) {
-                    info.buttons++;
-                }
-            }
-
-            mice.push_back(info);
-        }
-
-        libevdev_free(dev);
-        close(fd);
-    }
-    closedir(dir);
+MetricsRegistry metrics("server1");
+ReactorContext reactor_context;
+CommandRegistry commands(&metrics);
 
-    return mice;
+int env_int(const char* name, int default_value) {
+    const char* value = std::getenv(name);
+    if (!value || !*value) return default_value;
+    return std::atoi(value);
 }
 
-size_t get_free_memory() {
-    std::ifstream meminfo("/proc/meminfo");
-    std::string line;
-    size_t free_mem = 0;
-    while (getline(meminfo, line)) {
-        if (line.find("MemFree") != std::string::npos) {
-            std::istringstream iss(line);
-            iss >> line >> free_mem;
-            free_mem *= 1024;
-            break;
-        }
-    }
-    return free_mem;
-}
-
-
-std::string get_current_time() {
-    std::time_t now = std::time(nullptr);
-    char buf[20];
-    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
-    return std::string(buf);
-}
-
-void handle_client(int client_socket) {
-    while(true) {
-        char buffer[1024] = {0};
-        ssize_t bytes_read = recv(client_socket, buffer, sizeof(buffer), 0);
-        
-        if(bytes_read <= 0) break;
-
-        std::string command(buffer, bytes_read);
-        std::string response;
-        std::string timestamp = "[" + get_current_time() + "] ";
-        
-        send_log("CLIENT_CONNECT", "New client connected");
-        
-        if (command == "MEMORY") {
-            size_t free_mem = get_free_memory();
-            response = timestamp + "Free memory: " + std::to_string(free_mem) + " bytes\n";
-            send_log("COMMAND", "Received command: " + command);
-        }
-        else if (command == "MOUSE_KEYS") {
-            try {
-                auto mice = detect_mice();
-                if (mice.empty()) {
-                    response = timestamp + "Mouse devices: 0\n";
-                } else {
-                    response = timestamp + "Mouse devices: " + std::to_string(mice.size()) + "\n";
-                    for (const auto& mouse : mice) {
-                        response += timestamp + mouse.name + ": " + std::to_string(mouse.buttons) + "\n";
-                        send_log("COMMAND", "Received command: " + command);
-                    }
-                }
-            } 
-            catch (const std::exception& e) {
-                response = timestamp + "Error: " + std::string(e.what()) + "\n";
-            }
-        }
-        else if (command == "EXIT") {
-            response = timestamp + "Connection closed";
-            send_log("EXIT", "Received command: " + response);
-            send(client_socket, response.c_str(), response.size(), 0);
-            break;
-        }
-        else {
-            response = timestamp + "Invalid command\n";
-        }
-
-        if(send(client_socket, response.c_str(), response.size(), 0) <= 0) break;
-    }
-    close(client_socket);
-}
-
-
-
 int main() {
-    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if(server_socket < 0) {
-        std::cerr << "Socket creation error: " << strerror(errno) << std::endl;
+    // LOG_COLLECTOR - send logs to a log_server over the network
+    // (tcp:host:port, udp:host:port or unix:name) instead of the local ring,
+    // LOG_SOURCE - the name this instance's logs are kept under there (as
+    // remote-<name>; instances may share one)
+    const char* collector = std::getenv("LOG_COLLECTOR");
+    const char* source = std::getenv("LOG_SOURCE");
+    if (collector && *collector &&
+        !log_shipping.start(collector, source && *source ? source : "server1", log_producer)) {
+        std::cerr << "Log collector address error: " << collector << std::endl;
         return 1;
     }
 
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(8080);
-    server_addr.sin_addr.s_addr = INADDR_ANY;
+    // SERVER1_BACKLOG - listen() backlog, SERVER1_REACTORS - event loop threads,
+    // SERVER1_SOCKET - unix socket for local clients ("@name" abstract, "" disables)
+    int backlog = env_int("SERVER1_BACKLOG", SOMAXCONN);
+    std::string local_socket = local_socket_name("SERVER1_SOCKET", SERVER1_SOCKET);
+    int reactors = env_int("SERVER1_REACTORS", 1);
+    if (reactors < 1) reactors = 1;
+
+    raise_fd_limit();
+
+    // IO_BACKEND - epoll (default) or uring
+    auto run_reactor = select_reactor_loop(std::getenv("IO_BACKEND"));
+
+    // INPUT_DIR - where to look for input devices (a fake tree for testing)
+    const char* input_dir = std::getenv("INPUT_DIR");
+    MouseInventory inventory(input_dir && *input_dir ? input_dir : "/dev/input/");
+    inventory.start();
+
+    // MOUSE_BATCH_MS - how long input events are collected into one WATCH_MOUSE frame
+    MouseEventStream mouse_events(inventory, env_int("MOUSE_BATCH_MS", 10));
+    mouse_events.start();
+
+    // SAMPLE_INTERVAL_MS - how often /proc/meminfo is re-read for MEMORY.
+    // With io_uring the sampler's reads are asynchronous too.
+    std::function<size_t()> sample_memory = get_free_memory;
+    std::unique_ptr<AsyncProcfsReader> meminfo;
+    if (run_reactor == uring_reactor_loop) {
+        meminfo.reset(new AsyncProcfsReader("/proc/meminfo"));
+        if (meminfo->ok()) sample_memory = [&meminfo] { return meminfo->sample(parse_free_memory); };
+    }
+    PeriodicSampler<size_t> memory_sampler(sample_memory, env_int("SAMPLE_INTERVAL_MS", 500), get_free_memory);
+    memory_sampler.start();
+
+    // HISTORY MEMORY: the sampled value once a second, kept for a day
+    MetricHistory memory_history("MEMORY");
+    memory_history.start([&memory_sampler] { return double(memory_sampler.get()); });
+
+    // SUBSCRIBE_TICK_MS - how often subscriptions are checked for updates
+    SubscriptionHub subscriptions(env_int("SUBSCRIBE_TICK_MS", 100));
+    subscriptions.add_topic("MEMORY", [&memory_sampler] { return double(memory_sampler.get()); });
+    subscriptions.start();
+
+    // METRICS_PORT - Prometheus endpoint, 0 disables it
+    // METRICS_ADDR - address it listens on, loopback only by default
+    int metrics_port = env_int("METRICS_PORT", 9180);
+    metrics.add_gauge("server_active_connections", "Open client connections.",
+                      [] { return double(reactor_context.active_connections.load()); });
+    metrics.add_gauge("server_subscriptions", "Active SUBSCRIBE registrations.",
+                      [&subscriptions] { return double(subscriptions.subscriber_count()); });
+    metrics.add_gauge("server_mouse_watchers", "Connections receiving WATCH_MOUSE events.",
+                      [&mouse_events] { return double(mouse_events.watcher_count()); });
+    metrics.add_gauge("server_pushes_dropped", "Subscription updates dropped for slow clients.",
+                      [] { return double(reactor_context.pushes_dropped.load()); });
+    const char* metrics_addr = std::getenv("METRICS_ADDR");
+    if (metrics_port > 0 &&
+        !metrics.serve_prometheus(metrics_port, metrics_addr && *metrics_addr ? metrics_addr : "127.0.0.1")) {
+        std::cerr << "Metrics endpoint error: " << strerror(errno) << std::endl;
+    }
 
-    if(bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        std::cerr << "Bind error: " << strerror(errno) << std::endl;
-        close(server_socket);
-        return 1;
+    commands.set_logger(send_log);
+    register_memory_module(commands, memory_sampler);
+    register_history_module(commands, {&memory_history});
+    register_mouse_module(commands, inventory);
+    register_subscription_module(commands, subscriptions);
+    register_mouse_events_module(commands, mouse_events);
+    register_control_commands(commands, metrics, SERVER1_TEXTS);
+    reactor_context.metrics = &metrics;
+
+    std::vector<int> listen_sockets;
+    for (int i = 0; i < reactors; ++i) {
+        int server_socket = create_listen_socket(8080, backlog);
+        if (server_socket < 0) {
+            for (int fd : listen_sockets) close(fd);
+            return 1;
+        }
+        listen_sockets.push_back(server_socket);
     }
 
-    if(listen(server_socket, 5) < 0) {
-        std::cerr << "Listen error: " << strerror(errno) << std::endl;
-        close(server_socket);
-        return 1;
+    std::vector<ReactorListener> first_listeners = {{listen_sockets[0], &commands}};
+    int local_fd = -1;
+    if (!local_socket.empty()) {
+        local_fd = create_local_listen_socket(local_socket, backlog);
+        if (local_fd < 0) {
+            for (int fd : listen_sockets) close(fd);
+            return 1;
+        }
+        first_listeners.push_back({local_fd, &commands, true});
     }
     
     std::cout << "Server 1 started on port 8080" << std::endl;
+    if (local_fd >= 0) std::cout << "Local clients: " << local_socket << std::endl;
     send_log("SERVER_START", "Server 1 started on port 8080");
 
-    while (true) {
-        int client_socket = accept(server_socket, nullptr, nullptr);
-        if(client_socket < 0) {
-            std::cerr << "Accept error: " << strerror(errno) << std::endl;
-            continue;
-        }
-        
-        std::thread(handle_client, client_socket).detach();
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < listen_sockets.size(); ++i) {
+        threads.emplace_back(run_reactor, std::ref(reactor_context),
+                             std::vector<ReactorListener>{{listen_sockets[i], &commands}});
     }
+    run_reactor(reactor_context, first_listeners);
 
-    close(server_socket);
+    for (auto& t : threads) t.join();
+    for (int fd : listen_sockets) close(fd);
+    if (local_fd >= 0) close(local_fd);
     return 0;
 }
\ No newline at end of file
@@ -5,8 +5,6 @@
 #include <thread>
 #include <mutex>
 #include <dirent.h>
-#include <X11/Xlib.h>
-#include <X11/Xatom.h>
 #include <sstream>
 #include <fstream>
 #include <string>
@@ -17,216 +15,423 @@
 #include <cstring>
 #include <arpa/inet.h> 
 #include <ctime>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <unordered_map>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include "arena.h"
+#include "protocol.h"
+#include "local_socket.h"
+#include "log_ring.h"
+#include "log_net.h"
+#include "procfs.h"
+#include "proc_events.h"
+#include "metrics.h"
+#include "command_modules.h"
+#include "window_mover.h"
 
-std::mutex mtx;
 std::atomic<bool> running{true};
 std::atomic<int> active_connections{0};
 
-Display* display = nullptr;
-Window terminal_window = 0;
+LogProducer log_producer(SERVER2_LOG_RING);
+LogShipping log_shipping;
 
-const char* LOG_FIFO = "/tmp/server2_log.fifo";
-
-void send_log(const std::string& event_type, const std::string& data) {
-    int fd = open(LOG_FIFO, O_WRONLY | O_NONBLOCK);
-    if (fd == -1) return;
-
-    std::string message = event_type + "|" + data;
-    write(fd, message.c_str(), message.size());
-    close(fd);
+void send_log(std::string_view event_type, std::string_view data, uint32_t client_id = 0) {
+    log_producer.publish(event_type, data, client_id);
 }
 
-// Helper function to check if a string is numeric
-bool is_numeric(const char* str) {
-    if (!str || !*str) return false;
-    for (int i = 0; str[i]; i++) {
-        if (str[i] < '0' || str[i] > '9') return false;
-    }
-    return true;
-}
+std::atomic<uint32_t> next_client_id{1};
+MetricsRegistry metrics("server2");
 
-// Function to count all threads in the system
-int count_system_threads() {
-    int total_threads = 0;
-    DIR* proc_dir = opendir("/proc");
-    
-    if (!proc_dir) {
-        std::cerr << "Ошибка открытия директории /proc" << std::endl;
-        return -1;
-    }
-    
-    struct dirent* entry;
-    while ((entry = readdir(proc_dir)) != nullptr) {
-        if (entry->d_type != DT_DIR || !is_numeric(entry->d_name)) {
-            continue;
-        }
-        
-        std::string status_path = std::string("/proc/") + entry->d_name + "/status";
-        std::ifstream status_file(status_path);
-        if (!status_file) continue;
-        
-        std::string line;
-        while (std::getline(status_file, line)) {
-            if (line.find("Threads:") == 0) {
-                int thread_count = 0;
-                std::istringstream iss(line.substr(9));
-                iss >> thread_count;
-                total_threads += thread_count;
-                break;
-            }
+WindowMover window_mover;
+CommandRegistry commands(&metrics);
+
+// Пул потоков фиксированного размера с кражей задач: у каждого воркера своя
+// очередь, свободный воркер забирает задачи с хвоста чужих очередей.
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t size) : queues(size) {
+        for (size_t i = 0; i < size; ++i) {
+            workers.emplace_back(&WorkerPool::worker_loop, this, i);
         }
     }
-    
-    closedir(proc_dir);
-    return total_threads;
-}
 
-void signal_handler(int) {
-    running = false;
-}
+    ~WorkerPool() { shutdown(); }
 
-class ConnectionCounter {
-public:
-    ConnectionCounter() { active_connections++; }
-    ~ConnectionCounter() { active_connections--; }
-};
-
-bool init_x11_connection() {
-    display = XOpenDisplay(nullptr);
-    if (!display) {
-        std::cerr << "Ошибка подключения к X Server" << std::endl;
-        return false;
+    void submit(std::function<void()> task) {
+        size_t idx = next_queue++ % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[idx].mtx);
+            queues[idx].tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(wait_mtx);
+            queued++;
+            pending++;
+        }
+        wait_cv.notify_one();
     }
 
-    // Try to get window from environment variable
-    const char* env_window = std::getenv("WINDOWID");
-    if (env_window) {
-        terminal_window = std::stoul(env_window, nullptr, 0);
-        return true;
+    // Дожидается выполнения всех поставленных задач и останавливает воркеров
+    void shutdown() {
+        {
+            std::unique_lock<std::mutex> lock(wait_mtx);
+            if (stopping) return;
+            idle_cv.wait(lock, [this] { return pending == 0; });
+            stopping = true;
+        }
+        wait_cv.notify_all();
+        for (auto& t : workers) t.join();
     }
 
-    // Search window by PID
-    Atom net_wm_pid = XInternAtom(display, "_NET_WM_PID", False);
-    Window root = DefaultRootWindow(display);
-    Window* children;
-    unsigned num_children;
-    
-    if (!XQueryTree(display, root, &root, &root, &children, &num_children)) {
+private:
+    struct Queue {
+        std::mutex mtx;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool try_pop(size_t self, std::function<void()>& task) {
+        {
+            std::lock_guard<std::mutex> lock(queues[self].mtx);
+            if (!queues[self].tasks.empty()) {
+                task = std::move(queues[self].tasks.front());
+                queues[self].tasks.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); ++i) {
+            Queue& victim = queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mtx);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.back());
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
         return false;
     }
 
-    pid_t pid = getpid();
-    for (unsigned i = 0; i < num_children; ++i) {
-        Atom actual_type;
-        int actual_format;
-        unsigned long nitems, bytes_after;
-        unsigned char* data = nullptr;
-
-        if (XGetWindowProperty(display, children[i], net_wm_pid,
-                             0, 1, False, XA_CARDINAL,
-                             &actual_type, &actual_format,
-                             &nitems, &bytes_after, &data) == Success) {
-            if (actual_type == XA_CARDINAL && actual_format == 32 && nitems == 1) {
-                if (*(pid_t*)data == pid) {
-                    terminal_window = children[i];
-                    XFree(data);
-                    break;
+    void worker_loop(size_t self) {
+        while (true) {
+            std::function<void()> task;
+            if (try_pop(self, task)) {
+                {
+                    std::lock_guard<std::mutex> lock(wait_mtx);
+                    queued--;
                 }
+                task();
+                std::lock_guard<std::mutex> lock(wait_mtx);
+                if (--pending == 0) idle_cv.notify_all();
+                continue;
             }
-            XFree(data);
+            std::unique_lock<std::mutex> lock(wait_mtx);
+            wait_cv.wait(lock, [this] { return queued > 0 || stopping; });
+            if (stopping && queued == 0) return;
         }
     }
-    XFree(children);
 
-    return terminal_window != 0;
+    std::vector<Queue> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next_queue{0};
+    std::mutex wait_mtx;
+    std::condition_variable wait_cv;
+    std::condition_variable idle_cv;
+    size_t queued = 0;   // задачи в очередях
+    size_t pending = 0;  // задачи в очередях и выполняемые
+    bool stopping = false;
+};
+
+// Состояние клиента. Запросы в кадровом режиме выполняются в пуле
+// параллельно, поэтому соединение разделяется задачами через shared_ptr
+// и сокет закрывается только после завершения последней из них.
+struct ClientConnection {
+    ClientConnection(int fd, bool seqpacket) : fd(fd), id(next_client_id++), seqpacket(seqpacket) {
+        active_connections++;
+    }
+    ~ClientConnection() {
+        close(fd);
+        active_connections--;
+    }
+
+    int fd;
+    uint32_t id;
+    bool seqpacket;         // локальный сокет: ответ уходит сообщениями
+    size_t message_limit = LOCAL_MAX_MESSAGE;   // не длиннее этого
+    ProtocolMode mode = ProtocolMode::Unknown;
+    RingBuffer in;          // читается только воркером, владеющим EPOLLONESHOT
+    std::mutex send_mtx;    // ответы из разных воркеров не перемешиваются
+    // Кадры, отданные пулу и ещё не отвеченные. После EXIT сокет
+    // закрывается, только когда отправлен последний из них.
+    std::atomic<int> pending_replies{0};
+    std::atomic<bool> closing{false};
+};
+
+int epoll_fd = -1;
+int wakeup_fd = -1;
+WorkerPool* worker_pool = nullptr;
+std::mutex clients_mtx;
+std::unordered_map<int, std::shared_ptr<ClientConnection>> clients;
+
+int env_int(const char* name, int default_value) {
+    const char* value = std::getenv(name);
+    if (!value || !*value) return default_value;
+    return std::atoi(value);
 }
 
-bool move_window(int x, int y) {
-    std::lock_guard<std::mutex> lock(mtx);
-    if (!display || !terminal_window) return false;
-    
-    XWindowChanges changes;
-    changes.x = x;
-    changes.y = y;
-    
-    XConfigureWindow(display, terminal_window, CWX | CWY, &changes);
-    XFlush(display);
+void close_client(const std::shared_ptr<ClientConnection>& conn) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+    shutdown(conn->fd, SHUT_RDWR);
+    std::lock_guard<std::mutex> lock(clients_mtx);
+    clients.erase(conn->fd);
+}
+
+bool send_all(ClientConnection& conn, std::string_view data) {
+    std::lock_guard<std::mutex> lock(conn.send_mtx);
+    size_t offset = 0;
+    while (offset < data.size()) {
+        size_t len = data.size() - offset;
+        if (conn.seqpacket) len = std::min(len, conn.message_limit);
+        ssize_t sent = send(conn.fd, data.data() + offset, len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        offset += sent;
+    }
     return true;
 }
 
+// "Received command:<ответ>" в памяти запроса
+void log_response(RequestArena& arena, std::string_view response, uint32_t client_id) {
+    std::pmr::string line("Received command:", arena.get());
+    line += response;
+    send_log("COMMAND", line, client_id);
+}
 
-// Добавить функцию получения времени
-std::string get_current_time() {
-    std::time_t now = std::time(nullptr);
-    char buf[20];
-    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
-    return std::string(buf);
+// Снова ждёт данных клиента (сокет зарегистрирован с EPOLLONESHOT)
+void rearm_client(const std::shared_ptr<ClientConnection>& conn) {
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.fd = conn->fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) != 0) close_client(conn);
 }
 
-// Модифицированная функция handle_client для сервера 2
-void handle_client(int client_socket) {
-    ConnectionCounter counter;
-    char buffer[1024];
+// Кадр отвечен: последний ответ после EXIT закрывает сокет, воркер,
+// читающий его, увидит EOF и уберёт соединение
+void finish_frame(ClientConnection& conn) {
+    if (--conn.pending_replies == 0 && conn.closing) {
+        shutdown(conn.fd, SHUT_RDWR);
+    }
+}
 
-    try {
-        while (running) {
-            ssize_t bytes_read = recv(client_socket, buffer, sizeof(buffer), 0);
-            if (bytes_read <= 0) break;
+// Ответ, который обработчик отложил (MOVE_WINDOW ждёт поток X11), пока он
+// не готов, не занимает воркер. Готовый ответ отправляет пул, чтобы
+// медленный клиент не задерживал поток, который его завершил. Пока ждёт
+// команда старого протокола, сокет не читается, так что ответы идут в
+// порядке команд; после отправки сокет возвращается в epoll.
+class LateReply final : public DeferredReply {
+public:
+    LateReply(std::shared_ptr<ClientConnection> conn, bool framed, uint32_t request_id)
+        : conn(std::move(conn)), framed(framed), request_id(request_id) {}
 
-            std::string request(buffer, bytes_read);
-            std::string response;
-            std::string timestamp = "[" + get_current_time() + "] ";
+    // Клиент ждёт ответа, поэтому брошенный обработчиком тоже отвечает
+    ~LateReply() override {
+        if (!completed) complete("");
+    }
 
-            send_log("CLIENT_CONNECT", "New client connected");
+    void complete(std::string_view response) override {
+        completed = true;
+        worker_pool->submit([conn = conn, framed = framed, request_id = request_id, text = std::string(response)] {
+            if (framed) {
+                std::string out;
+                append_frame(out, request_id, text);
+                send_all(*conn, out);
+            } else {
+                send_all(*conn, text);
+            }
+            send_log("COMMAND", "Received command:" + text, conn->id);
 
-            if (request == "THREAD_COUNT") {
-                int total_threads = count_system_threads();
-                response = timestamp + "Всего потоков в системе: " + std::to_string(total_threads);
-                send_log("COMMAND", "Received command: " + request);
+            if (framed) {
+                finish_frame(*conn);
+            } else {
+                rearm_client(conn);
             }
-            else if (request.rfind("MOVE_WINDOW", 0) == 0) {
-                size_t space_pos = request.find(' ');
-                if (space_pos != std::string::npos) {
-                    std::istringstream iss(request.substr(space_pos + 1));
-                    int x, y;
-                    if (iss >> x >> y) {
-                        bool success = move_window(x, y);
-                        response = timestamp + (success ? 
-                            "OK Окно перемещено в " + std::to_string(x) + "x" + std::to_string(y) :
-                            "ERROR Ошибка перемещения");
-                           
-                    } else {
-                        response = timestamp + "ERROR Неверный формат координат";
+        });
+    }
+
+private:
+    std::shared_ptr<ClientConnection> conn;
+    bool framed;
+    uint32_t request_id;
+    bool completed = false;
+};
+
+struct LateReplyTarget : ReplyTarget {
+    LateReplyTarget(const std::shared_ptr<ClientConnection>& conn, bool framed, uint32_t request_id)
+        : conn(conn), framed(framed), request_id(request_id) {}
+
+    std::shared_ptr<DeferredReply> defer_reply() override {
+        return std::make_shared<LateReply>(conn, framed, request_id);
+    }
+
+    const std::shared_ptr<ClientConnection>& conn;
+    bool framed;
+    uint32_t request_id;
+};
+
+// Ответ, кадр и строка лога собираются в арене воркера (arena.h), которая
+// сбрасывается после отправки, так что запрос не обращается к куче.
+void serve_frame(const std::shared_ptr<ClientConnection>& conn, const Frame& frame) {
+    try {
+        RequestArena& arena = thread_request_arena();
+        RequestArena::Scope scope(arena);
+        bool close_connection = false;
+        ResponseBuffer out(arena.get());
+        size_t start = begin_frame(out);
+        LateReplyTarget later(conn, true, frame.request_id);
+        // Отложенный ответ допишет и учтёт LateReply
+        if (!commands.dispatch_to(out, frame.payload, conn->id, close_connection, nullptr, &later)) return;
+        end_frame(out, start, frame.request_id);
+
+        send_all(*conn, out);
+        if (close_connection) {
+            conn->closing = true;
+        } else {
+            log_response(arena, std::string_view(out).substr(FRAME_HEADER_SIZE), conn->id);
+        }
+    }
+    catch(const std::exception& e) {
+        std::cerr << "Ошибка в клиенте: " << e.what() << std::endl;
+    }
+    finish_frame(*conn);
+}
+
+enum class LegacyResult { Keep, Close, Deferred };
+
+// Выполняет всё накопленное как одну команду старого протокола
+LegacyResult serve_legacy(const std::shared_ptr<ClientConnection>& conn) {
+    RequestArena& arena = thread_request_arena();
+    RequestArena::Scope scope(arena);
+    bool close_connection = false;
+    std::pmr::string command(arena.get());
+    conn->in.take_into(command, conn->in.size());
+    ResponseBuffer response(arena.get());
+    LateReplyTarget later(conn, false, 0);
+    if (!commands.dispatch_to(response, command, conn->id, close_connection, nullptr, &later)) {
+        return LegacyResult::Deferred;
+    }
+
+    send_all(*conn, response);
+    if (close_connection) return LegacyResult::Close;
+    log_response(arena, response, conn->id);
+    return LegacyResult::Keep;
+}
+
+// Читает всё, что пришло от готового к чтению клиента, в потоке пула.
+// Сокет зарегистрирован с EPOLLONESHOT, поэтому читает его в каждый момент
+// только один воркер. Команды старого текстового протокола выполняются
+// сразу (на локальном сокете - каждое сообщение отдельно), кадры раздаются
+// пулу по отдельности и отвечают в порядке готовности. После отложенной
+// команды старого протокола соединение больше не трогается: его вернёт в
+// epoll LateReply.
+void handle_client(WorkerPool& pool, const std::shared_ptr<ClientConnection>& conn) {
+    bool keep = true;
+
+    try {
+        while (true) {
+            ssize_t bytes_read;
+            if (conn->seqpacket) {
+                bytes_read = recv_message(conn->fd, conn->in, MSG_DONTWAIT);
+                if (bytes_read > 0) {
+                    if (conn->mode == ProtocolMode::Unknown) {
+                        conn->mode = detect_protocol(conn->in);
+                        // Текстовый ответ не делится на сообщения, иначе клиент не найдёт его конец
+                        if (conn->mode == ProtocolMode::Legacy) conn->message_limit = allow_large_messages(conn->fd);
+                    }
+                    if (conn->mode == ProtocolMode::Legacy && !conn->in.empty()) {
+                        LegacyResult result = serve_legacy(conn);
+                        if (result == LegacyResult::Deferred) return;
+                        if (result == LegacyResult::Close) {
+                            keep = false;
+                            break;
+                        }
                     }
-                } else {
-                    response = timestamp + "ERROR Неверный формат команды";
                 }
+            } else {
+                auto area = conn->in.write_area(1024);
+                bytes_read = recv(conn->fd, area.first, area.second, MSG_DONTWAIT);
+                if (bytes_read > 0) conn->in.commit(bytes_read);
             }
-            else if (request == "EXIT") {
-                response = timestamp + " Соединение закрыто";
-                send_log("EXIT", "Received command: " + request);
-                send(client_socket, response.c_str(), response.size(), 0);
-                break;
-            }
-            else {
-                response = timestamp + "ERROR Неизвестная команда";
-            }
+            if (bytes_read > 0) continue;
+            if (bytes_read < 0 && errno == EINTR) continue;
+            if (bytes_read == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) keep = false;
+            break;
+        }
+
+        if (conn->mode == ProtocolMode::Unknown) conn->mode = detect_protocol(conn->in);
 
-            send(client_socket, response.c_str(), response.size(), 0);
-            send_log("COMMAND", "Received command:"+ response);
+        if (conn->mode == ProtocolMode::Legacy && !conn->in.empty() && keep) {
+            LegacyResult result = serve_legacy(conn);
+            if (result == LegacyResult::Deferred) return;
+            keep = result == LegacyResult::Keep;
+        }
+        else if (conn->mode == ProtocolMode::Framed) {
+            Frame frame;
+            FrameStatus status;
+            while ((status = next_frame(conn->in, frame)) == FrameStatus::Ready) {
+                // После EXIT новые запросы не принимаются
+                if (conn->closing) continue;
+                conn->pending_replies++;
+                pool.submit([conn, frame]() { serve_frame(conn, frame); });
+            }
+            if (status == FrameStatus::Invalid) keep = false;
         }
     }
     catch(const std::exception& e) {
         std::cerr << "Ошибка в клиенте: " << e.what() << std::endl;
+        keep = false;
+    }
+
+    if (keep) {
+        rearm_client(conn);
+        return;
+    }
+    close_client(conn);
+}
+
+void signal_handler(int) {
+    running = false;
+    if (wakeup_fd >= 0) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeup_fd, &one, sizeof(one));
+        (void)ignored;
     }
-    close(client_socket);
 }
 
 int main() {
+    wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
     std::signal(SIGINT, signal_handler);
     std::signal(SIGTERM, signal_handler);
 
-    if (!init_x11_connection()) {
+    // LOG_COLLECTOR - отправлять логи log_server по сети (tcp:хост:порт,
+    // udp:хост:порт или unix:имя) вместо локального кольца,
+    // LOG_SOURCE - имя, под которым там хранятся логи этого экземпляра (как
+    // remote-<имя>; несколько экземпляров могут делить одно имя)
+    const char* collector = std::getenv("LOG_COLLECTOR");
+    const char* source = std::getenv("LOG_SOURCE");
+    if (collector && *collector &&
+        !log_shipping.start(collector, source && *source ? source : "server2", log_producer)) {
+        std::cerr << "Неверный адрес сборщика логов: " << collector << std::endl;
+        return 1;
+    }
+
+    if (!window_mover.open()) {
         std::cerr << "Не удалось подключиться к X Server или найти окно терминала" << std::endl;
         send_log("SERVER_ERROR", "X11 connection failed");
         return 1;
@@ -238,16 +443,12 @@ int main() {
         return 1;
     }
 
-    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
+    int server_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (server_socket < 0) {
         std::cerr << "Ошибка создания сокета: " << strerror(errno) << std::endl;
         return 1;
     }
 
-    // Делаем сокет неблокирующим
-    int flags = fcntl(server_socket, F_GETFL, 0);
-    fcntl(server_socket, F_SETFL, flags | O_NONBLOCK);
-
     sockaddr_in server_addr{};
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(8081);
@@ -262,36 +463,148 @@ int main() {
         return 1;
     }
 
-    listen(server_socket, 5);
+    // SERVER2_BACKLOG - очередь listen(), SERVER2_WORKERS - размер пула
+    listen(server_socket, env_int("SERVER2_BACKLOG", SOMAXCONN));
+
+    // SERVER2_SOCKET - unix-сокет для локальных клиентов ("@имя" - абстрактный, "" - отключить)
+    std::string local_socket = local_socket_name("SERVER2_SOCKET", SERVER2_SOCKET);
+    int local_fd = -1;
+    if (!local_socket.empty()) {
+        local_fd = create_local_listen_socket(local_socket, env_int("SERVER2_BACKLOG", SOMAXCONN));
+        if (local_fd < 0) {
+            send_log("SERVER_ERROR", "Bind failed");
+            return 1;
+        }
+    }
+
+    // THREAD_EVENTS - вести THREAD_COUNT по событиям proc connector (0 - сканировать /proc),
+    // THREAD_RECONCILE_S - период полной сверки счётчика с /proc
+    ProcEventCounter thread_events(env_int("THREAD_RECONCILE_S", 30));
+    bool event_driven = env_int("THREAD_EVENTS", 1) != 0 && thread_events.start();
+    if (env_int("THREAD_EVENTS", 1) != 0 && !event_driven) {
+        std::cerr << "proc connector недоступен (до Linux 6.6 нужен CAP_NET_ADMIN), потоки считаются по /proc" << std::endl;
+    }
+
+    // SAMPLE_INTERVAL_MS - период пересчёта потоков по /proc
+    PeriodicSampler<int> thread_sampler(count_system_threads, env_int("SAMPLE_INTERVAL_MS", 500));
+    if (!event_driven) thread_sampler.start();
+
+    // METRICS_PORT - порт для Prometheus, 0 - отключить
+    // METRICS_ADDR - адрес, на котором он слушает (по умолчанию только 127.0.0.1)
+    int metrics_port = env_int("METRICS_PORT", 9181);
+    metrics.add_gauge("server_active_connections", "Open client connections.",
+                      [] { return double(active_connections.load()); });
+    if (event_driven) {
+        metrics.add_gauge("server_thread_events", "Process events applied to THREAD_COUNT.",
+                          [&thread_events] { return double(thread_events.events()); });
+        metrics.add_gauge("server_thread_count_correction", "Change made by the last full /proc reconcile.",
+                          [&thread_events] { return double(thread_events.last_correction()); });
+    }
+    const char* metrics_addr = std::getenv("METRICS_ADDR");
+    if (metrics_port > 0 &&
+        !metrics.serve_prometheus(metrics_port, metrics_addr && *metrics_addr ? metrics_addr : "127.0.0.1")) {
+        std::cerr << "Ошибка запуска метрик: " << strerror(errno) << std::endl;
+    }
+    window_mover.start();
+
+    commands.set_logger(send_log);
+    if (event_driven) {
+        register_thread_module(commands, thread_events);
+    } else {
+        register_thread_module(commands, thread_sampler);
+    }
+    register_window_module(commands, window_mover);
+    register_control_commands(commands, metrics, SERVER2_TEXTS);
+
+    int workers = env_int("SERVER2_WORKERS", std::max(1u, std::thread::hardware_concurrency()));
+    WorkerPool pool(std::max(1, workers));
+    worker_pool = &pool;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = server_socket;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &ev);
+    if (local_fd >= 0) {
+        ev.data.fd = local_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, local_fd, &ev);
+    }
+    ev.data.fd = wakeup_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &ev);
+
     std::cout << "Сервер 2 запущен на порту 8081" << std::endl;
+    if (local_fd >= 0) std::cout << "Локальные клиенты: " << local_socket << std::endl;
     send_log("SERVER_START", "Server 2 started on port 8081");
 
+    epoll_event events[64];
     while (running) {
-        sockaddr_in client_addr{};
-        socklen_t addr_len = sizeof(client_addr);
-        int client_socket = accept(server_socket, (sockaddr*)&client_addr, &addr_len);
-        
-        if (client_socket < 0) {
-            if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                // Ждем 100ms перед следующей проверкой
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        int n = epoll_wait(epoll_fd, events, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Ошибка epoll_wait: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < n && running; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wakeup_fd) continue;
+
+            if (fd == server_socket || fd == local_fd) {
+                while (true) {
+                    int client_socket = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+                    if (client_socket < 0) {
+                        if (errno == EINTR) continue;
+                        if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                            std::cerr << "Ошибка accept: " << strerror(errno) << std::endl;
+                        }
+                        break;
+                    }
+
+                    auto conn = std::make_shared<ClientConnection>(client_socket, fd == local_fd);
+                    metrics.record_connection();
+                    {
+                        std::lock_guard<std::mutex> lock(clients_mtx);
+                        clients[client_socket] = conn;
+                    }
+                    epoll_event client_ev{};
+                    client_ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+                    client_ev.data.fd = client_socket;
+                    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &client_ev) < 0) {
+                        close_client(conn);
+                    }
+                }
                 continue;
             }
-            std::cerr << "Ошибка accept: " << strerror(errno) << std::endl;
-            continue;
+
+            std::shared_ptr<ClientConnection> conn;
+            {
+                std::lock_guard<std::mutex> lock(clients_mtx);
+                auto it = clients.find(fd);
+                if (it != clients.end()) conn = it->second;
+            }
+            if (conn) pool.submit([&pool, conn]() { handle_client(pool, conn); });
         }
-        
-        std::thread([client_socket](){ 
-            handle_client(client_socket); 
-        }).detach();
     }
 
-    // Корректное завершение
+    // Корректное завершение: новые подключения не принимаем,
+    // дожидаемся уже принятых в работу запросов
+    close(server_socket);
+    if (local_fd >= 0) close(local_fd);
+    // Отложенные перемещения отвечают через пул, поэтому поток X11
+    // останавливается первым, а пул дожидается и этих ответов
+    window_mover.stop();
+    pool.shutdown();
+    {
+        std::lock_guard<std::mutex> lock(clients_mtx);
+        clients.clear();
+    }
+
     send_log("SERVER_STOP", "Server 2 stopped");
     std::cout << "Сервер 2 остановлен" << std::endl;
     
-    if (display) XCloseDisplay(display);
-    close(server_socket);
+    thread_events.stop();
+    close(epoll_fd);
+    close(wakeup_fd);
     close(lock_fd);
     
     return 0;
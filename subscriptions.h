@@ -0,0 +1,335 @@
+#pragma once
+
+// Push-based updates for SUBSCRIBE.
+//
+// A SubscriptionHub owns one thread that wakes every tick, reads each
+// subscribed topic once (from its sampler, never from procfs directly) and
+// decides per subscriber whether its interval has passed and the value
+// moved by at least its delta. The update is serialized once per protocol
+// into a shared buffer; subscribers only receive a reference to it, batched
+// per reactor into a single mailbox post. The reactor that owns the
+// connection queues the buffer and sends it with writev; a slow consumer
+// loses its oldest unsent updates instead of growing its queue without
+// bound (see reactor.h).
+//
+//   SUBSCRIBE <topic> <interval_ms> [delta]   -> OK, then UPDATE lines
+//   UNSUBSCRIBE <topic>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "command_registry.h"
+#include "protocol.h"
+
+// A message for one connection, handed from any thread to its reactor
+struct PushMessage {
+    int fd;
+    uint32_t client_id;     // guards against the fd being reused
+    std::shared_ptr<const std::string> data;
+    bool droppable = true;  // superseded by later messages, may be dropped for a slow client
+    bool reply = false;     // a deferred response (CommandRequest::defer), never dropped
+    uint32_t slot = 0;      // where a legacy reply goes in the output, see reactor.h
+};
+
+// Cross-thread queue of a reactor; the eventfd is in the reactor's epoll set.
+class ReactorMailbox {
+public:
+    ReactorMailbox() : event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+    ~ReactorMailbox() { close(event_fd); }
+
+    int fd() const { return event_fd; }
+
+    // Takes the messages; wakes the reactor only if the mailbox was empty
+    void post(std::vector<PushMessage>& messages) {
+        if (messages.empty()) return;
+        bool wake;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            wake = pending.empty();
+            if (wake) {
+                pending.swap(messages);
+            } else {
+                for (auto& message : messages) pending.push_back(std::move(message));
+            }
+        }
+        messages.clear();
+        if (wake) {
+            uint64_t one = 1;
+            ssize_t ignored = write(event_fd, &one, sizeof(one));
+            (void)ignored;
+        }
+    }
+
+    void drain(std::vector<PushMessage>& messages) {
+        uint64_t count;
+        ssize_t ignored = read(event_fd, &count, sizeof(count));
+        (void)ignored;
+        std::lock_guard<std::mutex> lock(mtx);
+        messages.swap(pending);
+    }
+
+private:
+    int event_fd;
+    std::mutex mtx;
+    std::vector<PushMessage> pending;
+};
+
+// Where updates for one connection go. The reactor clears open when the
+// connection is dropped and the hub forgets the subscription on its next
+// pass. The mailbox is shared, so a publisher that still holds the channel
+// after the reactor has returned posts into a queue nobody drains instead
+// of a destroyed one.
+struct PushChannel {
+    std::shared_ptr<ReactorMailbox> mailbox;
+    int fd;
+    uint32_t client_id;
+    bool framed;
+    std::atomic<bool> open{true};
+};
+
+// Implemented by connections that can receive pushed data
+class PushTarget {
+public:
+    virtual std::shared_ptr<PushChannel> push_channel() = 0;
+
+protected:
+    ~PushTarget() = default;
+};
+
+// Collects the messages of one round per reactor, so every mailbox is
+// posted (and its reactor woken) once however many of its connections
+// receive the buffer.
+class PushBatch {
+public:
+    void add(const PushChannel& channel, std::shared_ptr<const std::string> data, bool droppable = true) {
+        outbox_for(channel.mailbox).push_back({channel.fd, channel.client_id, std::move(data), droppable});
+    }
+
+    void post() {
+        for (auto& outbox : outboxes) outbox.mailbox->post(outbox.messages);
+    }
+
+private:
+    struct Outbox {
+        std::shared_ptr<ReactorMailbox> mailbox;
+        std::vector<PushMessage> messages;
+    };
+
+    std::vector<PushMessage>& outbox_for(const std::shared_ptr<ReactorMailbox>& mailbox) {
+        for (auto& outbox : outboxes) {
+            if (outbox.mailbox == mailbox) return outbox.messages;
+        }
+        outboxes.push_back({mailbox, {}});
+        return outboxes.back().messages;
+    }
+
+    std::vector<Outbox> outboxes;
+};
+
+class SubscriptionHub {
+public:
+    explicit SubscriptionHub(int tick_ms) : tick(tick_ms > 0 ? tick_ms : 1) {}
+
+    ~SubscriptionHub() { stop(); }
+
+    // Topics are added before start()
+    void add_topic(const std::string& name, std::function<double()> read) {
+        topics.push_back({name, std::move(read)});
+    }
+
+    bool has_topic(const std::string& name) const { return find_topic(name) != nullptr; }
+
+    int tick_ms() const { return int(tick.count()); }
+
+    void start() {
+        worker = std::thread(&SubscriptionHub::run, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+
+    // Replaces an existing subscription of the same channel to the topic
+    void subscribe(const std::string& topic, std::shared_ptr<PushChannel> channel, int interval_ms, double delta) {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& sub : subscribers) {
+            if (sub.channel == channel && sub.topic == topic) {
+                sub.interval = std::chrono::milliseconds(interval_ms);
+                sub.delta = delta;
+                return;
+            }
+        }
+        subscribers.push_back({topic, std::move(channel), std::chrono::milliseconds(interval_ms), delta});
+    }
+
+    bool unsubscribe(const std::string& topic, const std::shared_ptr<PushChannel>& channel) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = std::find_if(subscribers.begin(), subscribers.end(), [&](const Subscriber& sub) {
+            return sub.channel == channel && sub.topic == topic;
+        });
+        if (it == subscribers.end()) return false;
+        subscribers.erase(it);
+        return true;
+    }
+
+    size_t subscriber_count() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return subscribers.size();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Topic {
+        std::string name;
+        std::function<double()> read;
+    };
+
+    struct Subscriber {
+        std::string topic;
+        std::shared_ptr<PushChannel> channel;
+        std::chrono::milliseconds interval;
+        double delta;
+        Clock::time_point next_due{};
+        bool sent = false;
+        double last_value = 0;
+    };
+
+    // One serialized update, built lazily per protocol
+    struct Update {
+        bool read = false;
+        double value = 0;
+        std::shared_ptr<const std::string> legacy;
+        std::shared_ptr<const std::string> framed;
+    };
+
+    const Topic* find_topic(const std::string& name) const {
+        for (const auto& topic : topics) {
+            if (topic.name == name) return &topic;
+        }
+        return nullptr;
+    }
+
+    void run() {
+        std::vector<Update> updates(topics.size());
+        PushBatch batch;
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!cv.wait_for(lock, tick, [this] { return stopping; })) {
+            if (subscribers.empty()) continue;
+
+            Clock::time_point now = Clock::now();
+            std::string timestamp;
+            for (auto& update : updates) update = Update();
+
+            for (size_t i = 0; i < subscribers.size();) {
+                Subscriber& sub = subscribers[i];
+                if (!sub.channel->open.load(std::memory_order_relaxed)) {
+                    subscribers[i] = std::move(subscribers.back());
+                    subscribers.pop_back();
+                    continue;
+                }
+                ++i;
+                if (now < sub.next_due) continue;
+
+                size_t t = find_topic(sub.topic) - topics.data();
+                Update& update = updates[t];
+                if (!update.read) {
+                    update.value = topics[t].read();
+                    update.read = true;
+                }
+                if (sub.sent && std::fabs(update.value - sub.last_value) < sub.delta) continue;
+
+                if (timestamp.empty()) timestamp = std::string(timestamp_prefix());
+                std::shared_ptr<const std::string>& data = sub.channel->framed ? update.framed : update.legacy;
+                if (!data) data = serialize(timestamp, topics[t].name, update.value, sub.channel->framed);
+
+                batch.add(*sub.channel, data);
+                sub.sent = true;
+                sub.last_value = update.value;
+                sub.next_due = now + sub.interval;
+            }
+
+            lock.unlock();
+            batch.post();
+            lock.lock();
+        }
+    }
+
+    static std::shared_ptr<const std::string> serialize(const std::string& timestamp, const std::string& topic,
+                                                        double value, bool framed) {
+        std::ostringstream text;
+        text.precision(15);
+        text << timestamp << "UPDATE " << topic << " " << value << "\n";
+        if (!framed) return std::make_shared<const std::string>(text.str());
+        std::string out;
+        append_frame(out, PUSH_REQUEST_ID, text.str());
+        return std::make_shared<const std::string>(std::move(out));
+    }
+
+    std::vector<Topic> topics;
+    std::chrono::milliseconds tick;
+
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<Subscriber> subscribers;
+    bool stopping = false;
+    std::thread worker;
+};
+
+// SUBSCRIBE / UNSUBSCRIBE for the topics of a hub. Only connections served
+// by a reactor can receive pushes.
+inline void register_subscription_module(CommandRegistry& commands, SubscriptionHub& hub) {
+    commands.add("SUBSCRIBE", [&hub](CommandRequest& request, ResponseBuffer& out) {
+        std::istringstream iss{std::string(request.args)};
+        std::string topic;
+        int interval_ms = 0;
+        double delta = 0;
+        out += request.timestamp;
+        if (!(iss >> topic >> interval_ms) || interval_ms <= 0) {
+            out += "ERROR usage: SUBSCRIBE <topic> <interval_ms> [delta]\n";
+            return true;
+        }
+        iss >> delta;
+        if (!hub.has_topic(topic)) {
+            out += "ERROR unknown topic " + topic + "\n";
+            return true;
+        }
+        if (!request.push) {
+            out += "ERROR subscriptions are not available on this connection\n";
+            return true;
+        }
+
+        // Intervals are served at the hub's tick granularity
+        interval_ms = std::max(interval_ms, hub.tick_ms());
+        hub.subscribe(topic, request.push->push_channel(), interval_ms, std::max(delta, 0.0));
+        out += "OK subscribed to " + topic + " every " + std::to_string(interval_ms) + " ms\n";
+        request.log_line("COMMAND", "Received command: ");
+        return true;
+    });
+    commands.add("UNSUBSCRIBE", [&hub](CommandRequest& request, ResponseBuffer& out) {
+        if (request.args.empty()) return false;
+        std::string topic(request.args);
+        bool removed = request.push && hub.unsubscribe(topic, request.push->push_channel());
+        out += request.timestamp;
+        out += removed ? "OK unsubscribed from " : "ERROR not subscribed to ";
+        out += topic + "\n";
+        return true;
+    });
+}
@@ -0,0 +1,232 @@
+// Checks WindowMover (window_mover.h) and the deferred MOVE_WINDOW reply.
+//
+// Without an X Server the mover is given a fake sink that records the
+// moves: requests queued while one is being applied must reach the sink as
+// a single move to the last coordinates, every caller must get that move's
+// result, and stop() must still answer what is queued. MOVE_WINDOW is
+// dispatched through a CommandRegistry with a ReplyTarget to check that the
+// handler returns without a response and the reply arrives later.
+//
+// When DISPLAY can be opened (e.g. under xvfb-run) a real window is moved
+// too, and a move of a window that does not exist must report the
+// BadWindow error instead of success.
+//
+//   g++ -std=c++17 -O2 -o test_window_mover test_window_mover.cpp -lX11 -pthread
+//   ./test_window_mover            or  xvfb-run ./test_window_mover
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "window_mover.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    std::cout << (ok ? "ok   " : "FAIL ") << what << std::endl;
+    if (!ok) failures++;
+}
+
+// Records the moves; the first one is held until release() so that the
+// following requests pile up in the queue
+class FakeSink {
+public:
+    bool operator()(int x, int y) {
+        std::unique_lock<std::mutex> lock(mtx);
+        moves.emplace_back(x, y);
+        cv.notify_all();
+        cv.wait(lock, [this] { return released; });
+        return result;
+    }
+
+    void wait_for_moves(size_t count) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&] { return moves.size() >= count; });
+    }
+
+    void release() {
+        std::lock_guard<std::mutex> lock(mtx);
+        released = true;
+        cv.notify_all();
+    }
+
+    std::vector<std::pair<int, int>> taken() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return moves;
+    }
+
+    bool result = true;
+
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<std::pair<int, int>> moves;
+    bool released = false;
+};
+
+// Collects the results handed to the completion callbacks
+struct Results {
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<bool> values;
+
+    WindowMover::MoveDone callback() {
+        return [this](bool moved) {
+            std::lock_guard<std::mutex> lock(mtx);
+            values.push_back(moved);
+            cv.notify_all();
+        };
+    }
+
+    bool wait_for(size_t count) {
+        std::unique_lock<std::mutex> lock(mtx);
+        return cv.wait_for(lock, std::chrono::seconds(5), [&] { return values.size() >= count; });
+    }
+};
+
+static void test_coalescing(bool succeed) {
+    FakeSink sink;
+    sink.result = succeed;
+    WindowMover mover;
+    mover.open([&sink](int x, int y) { return sink(x, y); });
+    mover.start();
+
+    Results results;
+    mover.move(1, 1, results.callback());
+    sink.wait_for_moves(1);
+    for (int i = 2; i <= 10; ++i) mover.move(i * 10, i * 20, results.callback());
+    sink.release();
+
+    check(results.wait_for(10), "every queued move is answered");
+    auto moves = sink.taken();
+    check(moves.size() == 2, "moves queued behind a busy sink are applied once");
+    check(moves.size() == 2 && moves[1] == std::make_pair(100, 200), "the coalesced move uses the last coordinates");
+    bool all_match = true;
+    for (bool value : results.values) all_match = all_match && value == succeed;
+    check(all_match, succeed ? "every caller sees the success" : "every caller sees the failure");
+    mover.stop();
+}
+
+static void test_stop() {
+    FakeSink sink;
+    WindowMover mover;
+    mover.open([&sink](int x, int y) { return sink(x, y); });
+    mover.start();
+
+    Results results;
+    mover.move(1, 1, results.callback());
+    sink.wait_for_moves(1);
+    mover.move(2, 2, results.callback());
+    std::thread stopper([&mover] { mover.stop(); });
+    sink.release();
+    stopper.join();
+    check(results.values.size() == 2, "stop() answers the queued moves");
+
+    mover.move(3, 3, results.callback());
+    check(results.values.size() == 3 && !results.values.back(), "a move after stop() fails at once");
+}
+
+// A connection that takes late replies
+class FakeConnection : public ReplyTarget {
+public:
+    class Reply final : public DeferredReply {
+    public:
+        explicit Reply(std::promise<std::string>& promise) : promise(promise) {}
+        void complete(std::string_view response) override { promise.set_value(std::string(response)); }
+
+    private:
+        std::promise<std::string>& promise;
+    };
+
+    std::shared_ptr<DeferredReply> defer_reply() override { return std::make_shared<Reply>(reply); }
+
+    std::promise<std::string> reply;
+};
+
+static void test_deferred_command() {
+    FakeSink sink;
+    sink.release();
+    WindowMover mover;
+    mover.open([&sink](int x, int y) { return sink(x, y); });
+    mover.start();
+    CommandRegistry commands;
+    register_window_module(commands, mover);
+
+    ResponseBuffer out;
+    bool close_connection = false;
+    FakeConnection conn;
+    std::future<std::string> late = conn.reply.get_future();
+    bool answered = commands.dispatch_to(out, "MOVE_WINDOW 30 40", 1, close_connection, nullptr, &conn);
+    check(!answered && out.empty(), "MOVE_WINDOW defers its reply");
+    bool ready = late.wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+    std::string reply = ready ? late.get() : std::string();
+    check(reply.find("OK") != std::string::npos && reply.find("30x40") != std::string::npos,
+          "the late reply carries the result");
+
+    answered = commands.dispatch_to(out, "MOVE_WINDOW 50 60", 1, close_connection);
+    check(answered && out.find("50x60") != std::string::npos, "without a ReplyTarget it answers in place");
+
+    out.clear();
+    answered = commands.dispatch_to(out, "MOVE_WINDOW 50", 1, close_connection, nullptr, &conn);
+    check(answered && out.find("ERROR") != std::string::npos, "a malformed command is answered at once");
+    mover.stop();
+}
+
+static void test_x_server() {
+    Display* display = XOpenDisplay(nullptr);
+    if (!display) {
+        std::cout << "skip X Server tests (DISPLAY cannot be opened)" << std::endl;
+        return;
+    }
+    Window window = XCreateSimpleWindow(display, DefaultRootWindow(display), 0, 0, 100, 100, 0, 0, 0);
+    XMapWindow(display, window);
+    XSync(display, False);
+
+    {
+        setenv("WINDOWID", std::to_string(window).c_str(), 1);
+        WindowMover mover;
+        check(mover.open(), "open() finds the window from WINDOWID");
+        mover.start();
+        check(mover.move(120, 80).get(), "a real window is moved");
+        mover.stop();
+
+        XWindowAttributes attributes;
+        XSync(display, False);
+        XGetWindowAttributes(display, window, &attributes);
+        std::cout << "     window is at " << attributes.x << "x" << attributes.y << std::endl;
+    }
+    {
+        // Ids of this client's resources are valid until it frees them;
+        // one that was destroyed is a BadWindow for every client
+        Window gone = XCreateSimpleWindow(display, DefaultRootWindow(display), 0, 0, 10, 10, 0, 0, 0);
+        XDestroyWindow(display, gone);
+        XSync(display, False);
+        setenv("WINDOWID", std::to_string(gone).c_str(), 1);
+        WindowMover mover;
+        mover.open();
+        mover.start();
+        check(!mover.move(10, 10).get(), "a move of a destroyed window reports the X error");
+        mover.stop();
+    }
+
+    XDestroyWindow(display, window);
+    XCloseDisplay(display);
+}
+
+int main() {
+    test_coalescing(true);
+    test_coalescing(false);
+    test_stop();
+    test_deferred_command();
+    test_x_server();
+
+    std::cout << (failures ? "FAILED" : "all passed") << std::endl;
+    return failures ? 1 : 0;
+}
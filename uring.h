@@ -0,0 +1,347 @@
+#pragma once
+
+// Minimal io_uring wrapper on the raw syscalls (no liburing).
+//
+// One IoUring belongs to one thread: submissions and completions are not
+// locked. get_sqe() hands out a zeroed submission entry, submit() publishes
+// everything prepared since the last call in one io_uring_enter and can
+// wait for completions in the same call, for_each_cqe() consumes what the
+// kernel has posted. ProvidedBuffers is a registered buffer ring the kernel
+// picks receive buffers from, so idle connections do not pin any memory.
+//
+// AsyncProcfsReader keeps a procfs file open and reads it through a ring:
+// the read is submitted at one sample and collected at the next, so the
+// sampler thread never blocks in procfs and pays one syscall per sample
+// instead of open/read/close.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <initializer_list>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+class IoUring {
+public:
+    IoUring() = default;
+    ~IoUring() { destroy(); }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // false (errno set) if the kernel has no usable io_uring. A single
+    // issuer ring may only be used by the thread that created it.
+    bool init(unsigned entries, unsigned cq_entries = 0, bool single_issuer = true) {
+        struct io_uring_params params{};
+        params.flags = IORING_SETUP_COOP_TASKRUN;
+        if (single_issuer) params.flags |= IORING_SETUP_SINGLE_ISSUER;
+        if (cq_entries) {
+            params.flags |= IORING_SETUP_CQSIZE;
+            params.cq_entries = cq_entries;
+        }
+        ring_fd = int(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring_fd < 0 && errno == EINVAL) {
+            // Before 6.0: no SINGLE_ISSUER / COOP_TASKRUN
+            params.flags &= ~(IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN);
+            ring_fd = int(syscall(__NR_io_uring_setup, entries, &params));
+        }
+        if (ring_fd < 0) return false;
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+            destroy();
+            errno = ENOSYS;
+            return false;
+        }
+
+        ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                             params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+        ring_memory = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                           IORING_OFF_SQ_RING);
+        if (ring_memory == MAP_FAILED) {
+            ring_memory = nullptr;
+            destroy();
+            return false;
+        }
+        sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        void* sqes_memory = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                                 IORING_OFF_SQES);
+        if (sqes_memory == MAP_FAILED) {
+            destroy();
+            return false;
+        }
+        sqes = static_cast<struct io_uring_sqe*>(sqes_memory);
+
+        char* base = static_cast<char*>(ring_memory);
+        sq_head = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+        cq_head = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(base + params.cq_off.cqes);
+
+        // Slot i of the submission array always points at sqes[i]
+        unsigned* array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+        for (unsigned i = 0; i < sq_entries; ++i) array[i] = i;
+        local_tail = *sq_tail;
+        submitted_tail = local_tail;
+        return true;
+    }
+
+    int fd() const { return ring_fd; }
+
+    // io_uring_enter calls made so far
+    uint64_t enter_calls() const { return enters; }
+
+    // true if every opcode is supported by the running kernel
+    bool supports(std::initializer_list<uint8_t> opcodes) const {
+        const unsigned count = 256;
+        alignas(struct io_uring_probe) char buf[sizeof(struct io_uring_probe) + count * sizeof(struct io_uring_probe_op)] = {};
+        auto* probe = reinterpret_cast<struct io_uring_probe*>(buf);
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, count) < 0) return false;
+        for (uint8_t opcode : opcodes) {
+            if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) return false;
+        }
+        return true;
+    }
+
+    // A zeroed entry, or null when the submission queue is full (submit()
+    // and try again)
+    struct io_uring_sqe* get_sqe() {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (local_tail - head >= sq_entries) return nullptr;
+        struct io_uring_sqe* sqe = &sqes[local_tail & sq_mask];
+        std::memset(sqe, 0, sizeof(*sqe));
+        local_tail++;
+        return sqe;
+    }
+
+    // Like get_sqe(), submitting the queue first if it is full
+    struct io_uring_sqe* next_sqe() {
+        struct io_uring_sqe* sqe = get_sqe();
+        if (!sqe) {
+            submit();
+            sqe = get_sqe();
+        }
+        return sqe;
+    }
+
+    // Submits the prepared entries and waits for wait_for completions.
+    // Returns the io_uring_enter result (negative errno on failure).
+    int submit(unsigned wait_for = 0) {
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        unsigned pending = local_tail - submitted_tail;
+        unsigned flags = wait_for ? IORING_ENTER_GETEVENTS : 0;
+        while (true) {
+            enters++;
+            long result = syscall(__NR_io_uring_enter, ring_fd, pending, wait_for, flags, nullptr, 0);
+            if (result >= 0) {
+                submitted_tail += unsigned(result);
+                return int(result);
+            }
+            if (errno == EINTR && !wait_for) continue;
+            return -errno;
+        }
+    }
+
+    // Calls f(cqe) for every posted completion, then releases them
+    template <typename F>
+    unsigned for_each_cqe(F f) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        unsigned seen = 0;
+        for (; head != tail; ++head, ++seen) {
+            f(cqes[head & cq_mask]);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return seen;
+    }
+
+    // Closes the ring; the kernel cancels whatever is still pending
+    void destroy() {
+        if (sqes) munmap(sqes, sqes_size);
+        if (ring_memory) munmap(ring_memory, ring_size);
+        if (ring_fd >= 0) close(ring_fd);
+        sqes = nullptr;
+        ring_memory = nullptr;
+        ring_fd = -1;
+    }
+
+private:
+    int ring_fd = -1;
+    void* ring_memory = nullptr;
+    size_t ring_size = 0;
+    struct io_uring_sqe* sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned local_tail = 0;        // entries handed out by get_sqe()
+    unsigned submitted_tail = 0;    // entries the kernel has taken
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    struct io_uring_cqe* cqes = nullptr;
+    uint64_t enters = 0;
+};
+
+// count buffers of size bytes registered as buffer group `group`; count
+// must be a power of two. A completion names the buffer it filled, the
+// owner copies the data out and hands the buffer back with recycle().
+class ProvidedBuffers {
+public:
+    ProvidedBuffers() = default;
+    ~ProvidedBuffers() {
+        if (ring_memory) munmap(ring_memory, ring_bytes());
+        if (memory) munmap(memory, size_t(count) * size);
+    }
+
+    ProvidedBuffers(const ProvidedBuffers&) = delete;
+    ProvidedBuffers& operator=(const ProvidedBuffers&) = delete;
+
+    // Needs 5.19 (IORING_REGISTER_PBUF_RING); false if unsupported
+    bool init(IoUring& uring, uint16_t group, unsigned count, unsigned size) {
+        this->group = group;
+        this->count = count;
+        this->size = size;
+        mask = count - 1;
+        void* ring = mmap(nullptr, ring_bytes(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) return false;
+        ring_memory = static_cast<struct io_uring_buf*>(ring);
+        void* data = mmap(nullptr, size_t(count) * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) return false;
+        memory = static_cast<char*>(data);
+
+        struct io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(ring_memory);
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if (syscall(__NR_io_uring_register, uring.fd(), IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return false;
+
+        for (unsigned id = 0; id < count; ++id) put(uint16_t(id));
+        publish();
+        return true;
+    }
+
+    uint16_t group_id() const { return group; }
+    const char* data(uint16_t id) const { return memory + size_t(id) * size; }
+
+    void recycle(uint16_t id) {
+        put(id);
+        publish();
+    }
+
+private:
+    size_t ring_bytes() const { return size_t(count) * sizeof(struct io_uring_buf); }
+
+    void put(uint16_t id) {
+        struct io_uring_buf* buf = &ring_memory[tail & mask];
+        buf->addr = reinterpret_cast<uint64_t>(memory + size_t(id) * size);
+        buf->len = size;
+        buf->bid = id;
+        tail++;
+    }
+
+    // The ring tail overlays resv of the first entry. io_uring_buf_ring is
+    // not used: in C++ its flexible array lands 8 bytes too far.
+    void publish() { __atomic_store_n(&ring_memory[0].resv, tail, __ATOMIC_RELEASE); }
+
+    struct io_uring_buf* ring_memory = nullptr;
+    char* memory = nullptr;
+    uint16_t group = 0;
+    unsigned count = 0;
+    unsigned size = 0;
+    unsigned mask = 0;
+    uint16_t tail = 0;
+};
+
+// Reads a procfs file through its own ring. sample() returns the file as
+// it was at the previous call (the first call waits for a read), so the
+// value is at most one sampling interval older than a synchronous read.
+// Meant for a single sampler thread.
+class AsyncProcfsReader {
+public:
+    explicit AsyncProcfsReader(const char* path) : fd(open(path, O_RDONLY | O_CLOEXEC)) {
+        // sample() may run on more than one thread, one after the other
+        ready = fd >= 0 && uring.init(4, 0, false) && uring.supports({IORING_OP_READ});
+    }
+
+    ~AsyncProcfsReader() {
+        // The kernel may still be writing into buf
+        if (in_flight) cancel_read();
+        uring.destroy();
+        if (fd >= 0) close(fd);
+    }
+
+    AsyncProcfsReader(const AsyncProcfsReader&) = delete;
+    AsyncProcfsReader& operator=(const AsyncProcfsReader&) = delete;
+
+    bool ok() const { return ready; }
+
+    // Calls parse(data, length) on the last completed read and queues the
+    // next one; both happen in one io_uring_enter
+    template <typename Parse>
+    auto sample(Parse parse) -> decltype(parse(nullptr, 0)) {
+        if (!in_flight) {
+            queue_read();
+            uring.submit(1);
+        }
+        int result = -1;
+        while (uring.for_each_cqe([&](const struct io_uring_cqe& cqe) { result = cqe.res; }) == 0) {
+            int error = uring.submit(1);
+            if (error < 0 && error != -EINTR) break;
+        }
+        in_flight = false;
+        auto value = parse(buf, result > 0 ? size_t(result) : 0);
+        queue_read();
+        uring.submit();
+        return value;
+    }
+
+private:
+    // procfs regenerates the file for a read at offset 0 of the same fd
+    void queue_read() {
+        struct io_uring_sqe* sqe = uring.get_sqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(buf);
+        sqe->len = sizeof(buf);
+        sqe->off = 0;
+        sqe->user_data = READ_TAG;
+        in_flight = true;
+    }
+
+    // Cancels the outstanding read and reaps it and the cancel request
+    void cancel_read() {
+        struct io_uring_sqe* sqe = uring.get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = READ_TAG;
+        sqe->user_data = CANCEL_TAG;
+        bool read_done = false;
+        bool cancel_done = false;
+        while (!read_done || !cancel_done) {
+            int error = uring.submit(1);
+            if (error < 0 && error != -EINTR) return;
+            uring.for_each_cqe([&](const struct io_uring_cqe& cqe) {
+                if (cqe.user_data == READ_TAG) read_done = true;
+                if (cqe.user_data == CANCEL_TAG) cancel_done = true;
+            });
+        }
+        in_flight = false;
+    }
+
+    static const uint64_t READ_TAG = 1;
+    static const uint64_t CANCEL_TAG = 2;
+
+    int fd;
+    IoUring uring;
+    bool ready = false;
+    bool in_flight = false;
+    char buf[4096];
+};
@@ -0,0 +1,420 @@
+#pragma once
+
+// io_uring flavour of the reactor, selected with IO_BACKEND=uring.
+//
+// Connections, protocol handling and push queueing are the ones of
+// reactor.h; only the way bytes move differs. Every listener has one
+// multishot accept and every connection one multishot recv that takes its
+// buffers from a ring shared by the reactor's connections (uring.h). A
+// connection has at most one send in flight: the responses produced while
+// it is out are collected behind it, so pipelined requests leave in one
+// send. Queued pushes go out by reference (SENDMSG over their buffers) and
+// are released when the send completes. The last send of a closing
+// connection is linked to a shutdown.
+// A unix socket connection sends one queued piece at a time, so messages
+// keep the boundaries they have in reactor.h. Once a connection's output
+// backlog reaches OUTPUT_HIGH_WATER its multishot recv is cancelled, and it
+// is armed again when the backlog is under OUTPUT_LOW_WATER.
+// Everything prepared while handling a batch of completions goes to the
+// kernel with the next wait, one io_uring_enter per loop iteration instead
+// of epoll_wait plus a recv and a send per ready connection.
+//
+// uring_available() checks once for the kernel features (6.0+); without
+// them, or if a ring cannot be set up, the servers run reactor_loop.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "reactor.h"
+#include "uring.h"
+
+const unsigned URING_ENTRIES = 1024;
+const unsigned URING_BUFFERS = 1024;      // receive buffers per reactor
+const unsigned URING_BUFFER_SIZE = 4096;
+const uint16_t URING_BUFFER_GROUP = 0;
+static_assert(URING_BUFFER_SIZE >= LOCAL_MAX_MESSAGE, "a seqpacket message must fit one buffer");
+
+enum class UringOp : uint32_t { Accept = 1, Recv, Send, Shutdown, Mailbox, Wakeup, Cancel };
+
+inline uint64_t uring_tag(UringOp op, uint32_t index) { return uint64_t(op) << 32 | index; }
+
+struct UringConnection : Connection {
+    // The send in flight: queued pieces taken by reference, then the
+    // responses swapped out of out (the buffers trade places, so neither
+    // loses its capacity). The iovecs and header stay put until it completes.
+    std::vector<OutSegment> sending;
+    ResponseBuffer sending_out;
+    size_t sending_offset = 0;      // into the concatenation of the above
+    struct iovec iov[MAX_IOV];
+    struct msghdr msg{};
+    unsigned in_flight = 0;         // requests the kernel still holds for it
+    bool recv_armed = false;
+    bool send_in_flight = false;
+    bool shutdown_queued = false;
+    bool peer_closed = false;
+    bool failed = false;            // nothing more is sent, only torn down
+};
+
+// Multishot recv needs 6.0; the probe only knows opcodes, not their flags
+inline bool uring_available() {
+    static const bool available = [] {
+        struct utsname name;
+        int major = 0, minor = 0;
+        if (uname(&name) != 0 || std::sscanf(name.release, "%d.%d", &major, &minor) != 2) return false;
+        if (major < 6) return false;
+
+        IoUring uring;
+        if (!uring.init(8)) return false;
+        if (!uring.supports({IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_SENDMSG,
+                             IORING_OP_SHUTDOWN, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL})) {
+            return false;
+        }
+        ProvidedBuffers buffers;
+        return buffers.init(uring, URING_BUFFER_GROUP, 1, 64);
+    }();
+    return available;
+}
+
+inline void uring_reactor_loop(ReactorContext& context, std::vector<ReactorListener> listeners) {
+    // The ring goes first at the end, so the kernel is done with the send
+    // buffers before the connections are freed
+    ProvidedBuffers buffers;
+    IoUring uring;
+    if (!uring.init(URING_ENTRIES, URING_ENTRIES * 4) ||
+        !buffers.init(uring, URING_BUFFER_GROUP, URING_BUFFERS, URING_BUFFER_SIZE)) {
+        std::cerr << "io_uring setup error: " << strerror(errno) << ", using epoll" << std::endl;
+        uring.destroy();
+        reactor_loop(context, std::move(listeners));
+        return;
+    }
+
+    auto mailbox = std::make_shared<ReactorMailbox>();
+    std::unordered_map<int, UringConnection> connections;
+    std::vector<int> touched;       // connections to serve after a batch
+    std::vector<PushMessage> pushes;
+    bool running = true;
+
+    auto arm_accept = [&](uint32_t index) {
+        struct io_uring_sqe* sqe = uring.next_sqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listeners[index].fd;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->user_data = uring_tag(UringOp::Accept, index);
+    };
+    auto arm_recv = [&](UringConnection& conn) {
+        struct io_uring_sqe* sqe = uring.next_sqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = conn.fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = buffers.group_id();
+        // The full length of a message too big for the buffer, to refuse it
+        if (conn.seqpacket) sqe->msg_flags = MSG_TRUNC;
+        sqe->user_data = uring_tag(UringOp::Recv, uint32_t(conn.fd));
+        conn.in_flight++;
+        conn.recv_armed = true;
+    };
+    // Ends the multishot recv; its last completion comes with -ECANCELED
+    auto cancel_recv = [&](UringConnection& conn) {
+        struct io_uring_sqe* sqe = uring.next_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = uring_tag(UringOp::Recv, uint32_t(conn.fd));
+        sqe->user_data = uring_tag(UringOp::Cancel, uint32_t(conn.fd));
+        conn.in_flight++;
+    };
+    auto arm_poll = [&](int fd, UringOp op, bool multishot) {
+        struct io_uring_sqe* sqe = uring.next_sqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = POLLIN;
+        if (multishot) sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = uring_tag(op, 0);
+    };
+    auto queue_shutdown = [&](UringConnection& conn) {
+        struct io_uring_sqe* sqe = uring.next_sqe();
+        sqe->opcode = IORING_OP_SHUTDOWN;
+        sqe->fd = conn.fd;
+        sqe->len = SHUT_RDWR;
+        sqe->user_data = uring_tag(UringOp::Shutdown, uint32_t(conn.fd));
+        conn.in_flight++;
+        conn.shutdown_queued = true;
+    };
+
+    auto sending_size = [](const UringConnection& conn) {
+        size_t size = conn.sending_out.size();
+        for (const auto& segment : conn.sending) size += segment.data().size();
+        return size;
+    };
+
+    // Moves the next output into sending: everything queued (a seqpacket
+    // connection one piece, which is one message), then out
+    auto take_output = [](UringConnection& conn) {
+        conn.sending.clear();
+        conn.sending_out.clear();
+        conn.sending_offset = 0;
+        size_t limit = conn.seqpacket ? 1 : size_t(MAX_IOV - 1);
+        size_t taken = 0;
+        // Nothing behind the slot of a deferred reply goes before it
+        while (taken < std::min(conn.queued.size(), limit) && !conn.queued[taken].awaiting) taken++;
+        for (size_t i = 0; i < taken; ++i) {
+            if (conn.queued[i].shared) conn.queued_pushes--;
+            conn.queued_bytes -= conn.queued[i].data().size();
+            conn.sending.push_back(std::move(conn.queued[i]));
+        }
+        conn.queued.erase(conn.queued.begin(), conn.queued.begin() + taken);
+        if (conn.queued.empty() && !(conn.seqpacket && taken)) {
+            conn.sending_out.swap(conn.out);
+        }
+    };
+
+    // Starts the next send if none is out; a closing connection gets its
+    // shutdown linked behind the last one
+    auto flush = [&](UringConnection& conn) {
+        if (conn.send_in_flight || conn.shutdown_queued) return;
+        size_t total = sending_size(conn);
+        if (!conn.failed && conn.sending_offset == total) {
+            take_output(conn);
+            total = sending_size(conn);
+        }
+        if (!conn.failed && conn.sending_offset < total) {
+            // The unsent rest, by reference
+            size_t skip = conn.sending_offset;
+            size_t budget = conn.seqpacket ? conn.message_limit : SIZE_MAX;
+            int count = 0;
+            auto add = [&](std::string_view data) {
+                if (skip >= data.size()) {
+                    skip -= data.size();
+                    return;
+                }
+                size_t len = std::min(data.size() - skip, budget);
+                if (len == 0) return;
+                conn.iov[count].iov_base = const_cast<char*>(data.data()) + skip;
+                conn.iov[count].iov_len = len;
+                budget -= len;
+                skip = 0;
+                count++;
+            };
+            for (const auto& segment : conn.sending) add(segment.data());
+            add(conn.sending_out);
+            size_t len = 0;
+            for (int i = 0; i < count; ++i) len += conn.iov[i].iov_len;
+
+            struct io_uring_sqe* sqe = uring.next_sqe();
+            sqe->fd = conn.fd;
+            if (count == 1) {
+                sqe->opcode = IORING_OP_SEND;
+                sqe->addr = reinterpret_cast<uint64_t>(conn.iov[0].iov_base);
+                sqe->len = uint32_t(conn.iov[0].iov_len);
+            } else {
+                conn.msg = {};
+                conn.msg.msg_iov = conn.iov;
+                conn.msg.msg_iovlen = size_t(count);
+                sqe->opcode = IORING_OP_SENDMSG;
+                sqe->addr = reinterpret_cast<uint64_t>(&conn.msg);
+                sqe->len = 1;
+            }
+            // The kernel retries short sends itself
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+            sqe->user_data = uring_tag(UringOp::Send, uint32_t(conn.fd));
+            conn.in_flight++;
+            conn.send_in_flight = true;
+            bool last = conn.sending_offset + len == total && conn.queued.empty() && conn.out.empty() &&
+                        conn.late_replies == 0;
+            if (!conn.closing || !last) return;
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+        // A closing connection waits for its deferred replies
+        if (conn.closing && (conn.late_replies == 0 || conn.failed)) queue_shutdown(conn);
+    };
+
+    // Stops receiving while too much output waits, resumes once it drained
+    auto pace_input = [&](UringConnection& conn) {
+        if (conn.closing) return;
+        size_t backlog = output_backlog(conn) + sending_size(conn) - conn.sending_offset;
+        if (!conn.input_paused && backlog >= OUTPUT_HIGH_WATER) {
+            conn.input_paused = true;
+            if (conn.recv_armed) cancel_recv(conn);
+        } else if (conn.input_paused && backlog <= OUTPUT_LOW_WATER) {
+            conn.input_paused = false;
+            // Still armed if the cancel has not completed; it re-arms then
+            if (!conn.recv_armed) arm_recv(conn);
+        }
+    };
+
+    // Answers what arrived, starts output and frees a finished connection
+    auto serve = [&](int fd) {
+        auto it = connections.find(fd);
+        if (it == connections.end()) return;
+        UringConnection& conn = it->second;
+
+        if (!conn.closing && !conn.in.empty() && !process_input(conn)) conn.failed = conn.closing = true;
+        // Requests held back by the high-water mark are answered first
+        if (conn.peer_closed && output_backlog(conn) < OUTPUT_HIGH_WATER) conn.closing = true;
+        flush(conn);
+        pace_input(conn);
+
+        if (conn.closing && conn.in_flight == 0 && (conn.late_replies == 0 || conn.failed)) {
+            close(fd);
+            if (conn.channel) conn.channel->open = false;
+            connections.erase(it);
+            context.active_connections--;
+        }
+    };
+
+    auto handle = [&](const struct io_uring_cqe& cqe) {
+        uint32_t index = uint32_t(cqe.user_data);
+        bool more = cqe.flags & IORING_CQE_F_MORE;
+
+        switch (UringOp(cqe.user_data >> 32)) {
+        case UringOp::Accept:
+            if (cqe.res >= 0) {
+                UringConnection& conn = connections[cqe.res];
+                conn.fd = cqe.res;
+                conn.id = context.next_client_id++;
+                conn.commands = listeners[index].commands;
+                conn.seqpacket = listeners[index].seqpacket;
+                conn.mailbox = mailbox;
+                context.active_connections++;
+                if (context.metrics) context.metrics->record_connection();
+                arm_recv(conn);
+            } else if (cqe.res != -EAGAIN && cqe.res != -EINTR) {
+                std::cerr << "Accept error: " << strerror(-cqe.res) << std::endl;
+            }
+            if (!more && running) arm_accept(index);
+            break;
+
+        case UringOp::Recv: {
+            auto it = connections.find(int(index));
+            if (it == connections.end()) break;
+            UringConnection& conn = it->second;
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                uint16_t id = uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                if (cqe.res > int(URING_BUFFER_SIZE)) {
+                    conn.failed = conn.closing = true;
+                } else if (cqe.res > 0 && !conn.closing) {
+                    conn.in.append(buffers.data(id), size_t(cqe.res));
+                    if (conn.seqpacket) {
+                        if (!process_input(conn)) conn.failed = conn.closing = true;
+                        if (conn.mode == ProtocolMode::Legacy) seal_response(conn);
+                    }
+                }
+                buffers.recycle(id);
+            }
+            if (!more) {
+                conn.in_flight--;
+                conn.recv_armed = false;
+                if (cqe.res == 0) {
+                    conn.peer_closed = true;
+                } else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+                    conn.failed = conn.closing = true;
+                } else if (!conn.closing && !conn.input_paused) {
+                    // Out of buffers for a moment, the kernel ended the
+                    // multishot, or a pause was lifted before its cancel
+                    // landed; the buffers are back by now
+                    arm_recv(conn);
+                }
+            }
+            touched.push_back(int(index));
+            break;
+        }
+
+        case UringOp::Send: {
+            auto it = connections.find(int(index));
+            if (it == connections.end()) break;
+            UringConnection& conn = it->second;
+            conn.in_flight--;
+            conn.send_in_flight = false;
+            if (cqe.res < 0) {
+                conn.failed = conn.closing = true;
+            } else {
+                conn.sending_offset += size_t(cqe.res);
+            }
+            touched.push_back(int(index));
+            break;
+        }
+
+        case UringOp::Cancel: {
+            auto it = connections.find(int(index));
+            if (it == connections.end()) break;
+            it->second.in_flight--;
+            touched.push_back(int(index));
+            break;
+        }
+
+        case UringOp::Shutdown: {
+            auto it = connections.find(int(index));
+            if (it == connections.end()) break;
+            UringConnection& conn = it->second;
+            conn.in_flight--;
+            // Cancelled because the linked send failed: shut down on its own
+            if (cqe.res == -ECANCELED) {
+                conn.shutdown_queued = false;
+                conn.failed = true;
+            }
+            touched.push_back(int(index));
+            break;
+        }
+
+        case UringOp::Mailbox:
+            mailbox->drain(pushes);
+            for (auto& push : pushes) {
+                auto it = connections.find(push.fd);
+                if (it == connections.end() || it->second.id != push.client_id) continue;
+                if (push.reply) {
+                    deliver_reply(it->second, push);
+                } else if (!queue_push(it->second, std::move(push.data), push.droppable)) {
+                    context.pushes_dropped++;
+                }
+                touched.push_back(push.fd);
+            }
+            pushes.clear();
+            if (!more) arm_poll(mailbox->fd(), UringOp::Mailbox, true);
+            break;
+
+        case UringOp::Wakeup:
+            running = false;
+            break;
+        }
+    };
+
+    for (uint32_t i = 0; i < listeners.size(); ++i) arm_accept(i);
+    arm_poll(mailbox->fd(), UringOp::Mailbox, true);
+    // Level-triggered and never read, so every reactor sees it
+    if (context.wakeup_fd >= 0) arm_poll(context.wakeup_fd, UringOp::Wakeup, false);
+
+    while (running) {
+        int result = uring.submit(1);
+        if (result < 0 && result != -EINTR && result != -EBUSY && result != -EAGAIN) {
+            std::cerr << "io_uring_enter error: " << strerror(-result) << std::endl;
+            break;
+        }
+        uring.for_each_cqe(handle);
+        for (int fd : touched) serve(fd);
+        touched.clear();
+    }
+
+    uring.destroy();
+    for (auto& entry : connections) {
+        if (entry.second.channel) entry.second.channel->open = false;
+        close(entry.first);
+    }
+    context.active_connections -= int(connections.size());
+}
+
+// IO_BACKEND=uring runs uring_reactor_loop where the kernel supports it
+inline auto select_reactor_loop(const char* backend) -> void (*)(ReactorContext&, std::vector<ReactorListener>) {
+    if (!backend || std::string(backend) != "uring") return reactor_loop;
+    if (uring_available()) return uring_reactor_loop;
+    std::cerr << "io_uring backend not supported by this kernel, using epoll" << std::endl;
+    return reactor_loop;
+}
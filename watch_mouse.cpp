@@ -0,0 +1,175 @@
+// Prints the WATCH_MOUSE event stream of server1 (or the unified server).
+//
+// With --fake it first creates a virtual mouse through uinput that keeps
+// drawing a square and clicking, so the whole path (inventory, reader,
+// fan-out) can be checked on a machine without a real mouse. The server
+// must be able to read the new /dev/input node.
+//
+//   g++ -std=c++17 -O2 -o watch_mouse watch_mouse.cpp -pthread
+//   ./watch_mouse [--host=127.0.0.1] [--port=8080] [--fake]
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "protocol.h"
+
+std::atomic<bool> running{true};
+
+void emit(int fd, uint16_t type, uint16_t code, int32_t value) {
+    struct input_event ev{};
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+    ssize_t ignored = write(fd, &ev, sizeof(ev));
+    (void)ignored;
+}
+
+// Virtual mouse: a 40px square every second, a click at each corner
+int create_fake_mouse() {
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_KEYBIT, BTN_LEFT);
+    ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT);
+    ioctl(fd, UI_SET_EVBIT, EV_REL);
+    ioctl(fd, UI_SET_RELBIT, REL_X);
+    ioctl(fd, UI_SET_RELBIT, REL_Y);
+
+    struct uinput_setup setup{};
+    setup.id.bustype = BUS_VIRTUAL;
+    std::strcpy(setup.name, "watch_mouse virtual mouse");
+    if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void drive_fake_mouse(int fd) {
+    const int dx[] = {1, 0, -1, 0};
+    const int dy[] = {0, 1, 0, -1};
+    while (running) {
+        for (int side = 0; side < 4 && running; ++side) {
+            for (int step = 0; step < 40; ++step) {
+                emit(fd, EV_REL, REL_X, dx[side]);
+                emit(fd, EV_REL, REL_Y, dy[side]);
+                emit(fd, EV_SYN, SYN_REPORT, 0);
+                std::this_thread::sleep_for(std::chrono::microseconds(6250));
+            }
+            emit(fd, EV_KEY, BTN_LEFT, 1);
+            emit(fd, EV_SYN, SYN_REPORT, 0);
+            emit(fd, EV_KEY, BTN_LEFT, 0);
+            emit(fd, EV_SYN, SYN_REPORT, 0);
+        }
+    }
+    ioctl(fd, UI_DEV_DESTROY);
+    close(fd);
+}
+
+bool read_exact(int fd, char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    bool fake = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--host=", 0) == 0) host = arg.substr(7);
+        else if (arg.rfind("--port=", 0) == 0) port = std::atoi(arg.c_str() + 7);
+        else if (arg == "--fake") fake = true;
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--host=127.0.0.1] [--port=8080] [--fake]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::thread mouse_thread;
+    if (fake) {
+        int fd = create_fake_mouse();
+        if (fd < 0) {
+            std::cerr << "Cannot create uinput device: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        mouse_thread = std::thread(drive_fake_mouse, fd);
+        // Give the server's inventory time to notice the new device
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        std::cerr << "Cannot connect to " << host << ":" << port << ": " << strerror(errno) << std::endl;
+        running = false;
+        if (mouse_thread.joinable()) mouse_thread.join();
+        return 1;
+    }
+
+    std::string request(1, char(FRAME_MAGIC));
+    append_frame(request, 1, "WATCH_MOUSE");
+    send(sock, request.data(), request.size(), MSG_NOSIGNAL);
+
+    uint32_t expected = 0;
+    bool first = true;
+    char header[FRAME_HEADER_SIZE];
+    std::string payload;
+    while (read_exact(sock, header, sizeof(header))) {
+        uint32_t length = load_be32(header);
+        uint32_t request_id = load_be32(header + 4);
+        payload.resize(length);
+        if (!read_exact(sock, &payload[0], length)) break;
+
+        if (request_id != MOUSE_EVENTS_REQUEST_ID) {
+            std::cout << payload << std::flush;
+            continue;
+        }
+        if (length < 8) continue;
+        uint32_t sequence = load_be32(payload.data());
+        uint32_t count = load_be32(payload.data() + 4) >> 16;
+        if (!first && sequence != expected) {
+            std::cout << "-- " << sequence - expected << " frames dropped" << std::endl;
+        }
+        first = false;
+        expected = sequence + 1;
+
+        for (uint32_t i = 0; i < count && 8 + (i + 1) * 12 <= length; ++i) {
+            const char* record = payload.data() + 8 + i * 12;
+            uint32_t time_ms = load_be32(record);
+            unsigned device = uint8_t(record[4]);
+            unsigned type = uint8_t(record[5]);
+            unsigned code = uint8_t(record[6]) << 8 | uint8_t(record[7]);
+            int32_t value = int32_t(load_be32(record + 8));
+            std::cout << time_ms << " dev " << device << (type == EV_KEY ? " key " : " rel ")
+                      << "0x" << std::hex << code << std::dec << " " << value << "\n";
+        }
+        std::cout << std::flush;
+    }
+
+    running = false;
+    if (mouse_thread.joinable()) mouse_thread.join();
+    close(sock);
+    return 0;
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+// Владелец соединения с X11 для MOVE_WINDOW.
+//
+// open() подключается к X Server и находит окно терминала (WINDOWID или
+// окно с _NET_WM_PID нашего процесса). После start() все вызовы Xlib
+// делает только поток WindowMover. Клиенты кладут запросы в общую очередь
+// вместе с функцией завершения, которую поток вызывает с результатом.
+// Накопившиеся подряд перемещения схлопываются до последних координат: окно
+// двигается один раз, XSync вызывается один раз на пачку (он же приносит
+// ошибки вроде BadWindow), а все ожидающие получают результат этого
+// перемещения. Обработчик MOVE_WINDOW откладывает ответ (defer() в
+// command_registry.h), так что ни реактор, ни воркер server2 не ждут X11.
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <charconv>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "command_registry.h"
+
+class WindowMover {
+public:
+    // Перемещение вместо X11 (для проверок без X Server)
+    using MoveSink = std::function<bool(int x, int y)>;
+    // Вызывается в потоке WindowMover (или сразу, если он остановлен)
+    using MoveDone = std::function<void(bool moved)>;
+
+    ~WindowMover() {
+        stop();
+        if (display) XCloseDisplay(display);
+    }
+
+    // false, если нет X Server или окно не найдено
+    bool open() {
+        display = XOpenDisplay(nullptr);
+        if (!display) {
+            std::cerr << "Ошибка подключения к X Server" << std::endl;
+            return false;
+        }
+        // Ошибки протокола сообщаются в apply(), а не завершают процесс
+        XSetErrorHandler(record_x_error);
+
+        // Try to get window from environment variable
+        const char* env_window = std::getenv("WINDOWID");
+        if (env_window) {
+            window = std::stoul(env_window, nullptr, 0);
+            return true;
+        }
+
+        // Search window by PID
+        Atom net_wm_pid = XInternAtom(display, "_NET_WM_PID", False);
+        Window root = DefaultRootWindow(display);
+        Window* children;
+        unsigned num_children;
+
+        if (!XQueryTree(display, root, &root, &root, &children, &num_children)) {
+            return false;
+        }
+
+        pid_t pid = getpid();
+        for (unsigned i = 0; i < num_children; ++i) {
+            Atom actual_type;
+            int actual_format;
+            unsigned long nitems, bytes_after;
+            unsigned char* data = nullptr;
+
+            if (XGetWindowProperty(display, children[i], net_wm_pid,
+                                 0, 1, False, XA_CARDINAL,
+                                 &actual_type, &actual_format,
+                                 &nitems, &bytes_after, &data) == Success) {
+                if (actual_type == XA_CARDINAL && actual_format == 32 && nitems == 1) {
+                    if (*(pid_t*)data == pid) {
+                        window = children[i];
+                        XFree(data);
+                        break;
+                    }
+                }
+                XFree(data);
+            }
+        }
+        XFree(children);
+
+        return window != 0;
+    }
+
+    void open(MoveSink sink) { this->sink = std::move(sink); }
+
+    void start() {
+        worker = std::thread(&WindowMover::run, this);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mtx);
+            stopping = true;
+        }
+        queue_cv.notify_one();
+        if (worker.joinable()) worker.join();
+    }
+
+    void move(int x, int y, MoveDone done) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mtx);
+            if (!stopping) {
+                queue.push_back(MoveRequest{x, y, std::move(done)});
+                queue_cv.notify_one();
+                return;
+            }
+        }
+        done(false);
+    }
+
+    // Для вызывающих, которые могут ждать
+    std::future<bool> move(int x, int y) {
+        auto promise = std::make_shared<std::promise<bool>>();
+        std::future<bool> result = promise->get_future();
+        move(x, y, [promise](bool moved) { promise->set_value(moved); });
+        return result;
+    }
+
+private:
+    struct MoveRequest {
+        int x;
+        int y;
+        MoveDone done;
+    };
+
+    void run() {
+        std::vector<MoveRequest> batch;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(queue_mtx);
+                queue_cv.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                batch.swap(queue);
+            }
+
+            bool success = apply(batch.back().x, batch.back().y);
+            for (auto& request : batch) request.done(success);
+            batch.clear();
+        }
+    }
+
+    static int record_x_error(Display*, XErrorEvent* event) {
+        x_error = event->error_code;
+        return 0;
+    }
+
+    bool apply(int x, int y) {
+        if (sink) return sink(x, y);
+        if (!display || !window) return false;
+
+        XWindowChanges changes;
+        changes.x = x;
+        changes.y = y;
+
+        // XSync дожидается ответа сервера, ошибка запроса к этому моменту
+        // уже прошла через record_x_error
+        x_error = Success;
+        XConfigureWindow(display, window, CWX | CWY, &changes);
+        XSync(display, False);
+        return x_error == Success;
+    }
+
+    // Пишется обработчиком ошибок Xlib, который вызывается в потоке,
+    // делающем запросы, то есть только в потоке WindowMover
+    static inline int x_error = Success;
+
+    Display* display = nullptr;
+    Window window = 0;
+    MoveSink sink;
+
+    std::mutex queue_mtx;
+    std::condition_variable queue_cv;
+    std::vector<MoveRequest> queue;
+    bool stopping = false;
+    std::thread worker;
+};
+
+inline void append_move_result(ResponseBuffer& out, bool moved, int x, int y) {
+    if (moved) {
+        out += "OK Окно перемещено в ";
+        append_number(out, int64_t(x));
+        out += 'x';
+        append_number(out, int64_t(y));
+    } else {
+        out += "ERROR Ошибка перемещения";
+    }
+}
+
+// MOVE_WINDOW <x> <y>
+inline void register_window_module(CommandRegistry& commands, WindowMover& mover) {
+    commands.add("MOVE_WINDOW", [&mover](CommandRequest& request, ResponseBuffer& out) {
+        out += request.timestamp;
+        if (request.line.find(' ') == std::string_view::npos) {
+            out += "ERROR Неверный формат команды";
+            return true;
+        }
+        const char* p = request.args.data();
+        const char* end = p + request.args.size();
+        int x, y;
+        while (p < end && *p == ' ') ++p;
+        auto rx = std::from_chars(p, end, x);
+        while (rx.ec == std::errc() && rx.ptr < end && *rx.ptr == ' ') ++rx.ptr;
+        auto ry = rx.ec == std::errc() ? std::from_chars(rx.ptr, end, y) : rx;
+        if (rx.ec == std::errc() && ry.ec == std::errc()) {
+            if (auto reply = request.defer()) {
+                // Ответ соберёт поток X11, когда окно будет перемещено
+                mover.move(x, y, [reply, x, y](bool moved) {
+                    ResponseBuffer late;
+                    late += timestamp_prefix();
+                    append_move_result(late, moved, x, y);
+                    reply->complete(late);
+                });
+            } else {
+                append_move_result(out, mover.move(x, y).get(), x, y);
+            }
+        } else {
+            out += "ERROR Неверный формат координат";
+        }
+        return true;
+    });
+}